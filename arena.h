@@ -0,0 +1,113 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+
+// Bump-pointer allocator for objects that live as long as the arena itself.
+//
+// Memory comes from large anonymous mappings, asking the kernel for
+// transparent huge pages where it can, so an allocation is a pointer
+// increment and releasing everything is one munmap per chunk. Individual
+// allocations are never freed and destructors are never run: only put
+// trivially destructible objects and raw bytes in an arena.
+//
+// Allocation is not thread safe. Bytes written by the allocating thread
+// are visible to other threads once it publishes a pointer to them with
+// release ordering, as BlockStore does for its elements.
+class Arena {
+public:
+    static constexpr std::size_t kDefaultChunkBytes = std::size_t(64) << 20;
+
+    explicit Arena(std::size_t chunkBytes = kDefaultChunkBytes)
+        : chunkBytes(roundToPages(chunkBytes)), cursor(nullptr), limit(nullptr), used(0),
+          reserved(0) {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena() { release(); }
+
+    // Uninitialised, aligned memory for size bytes; align must be a power of
+    // two. Requests larger than a chunk get a mapping of their own.
+    void* allocate(std::size_t size, std::size_t align = alignof(std::max_align_t)) {
+        uintptr_t start = (reinterpret_cast<uintptr_t>(cursor) + align - 1) & ~uintptr_t(align - 1);
+        if (cursor == nullptr || start + size > reinterpret_cast<uintptr_t>(limit)) {
+            if (size + align > chunkBytes / 4) {
+                char* own = map(roundToPages(size + align));
+                used += size;
+                return own;  // page aligned; the current chunk stays open
+            }
+            cursor = map(chunkBytes);
+            limit = cursor + chunkBytes;
+            start = reinterpret_cast<uintptr_t>(cursor);
+        }
+        cursor = reinterpret_cast<char*>(start + size);
+        used += size;
+        return reinterpret_cast<void*>(start);
+    }
+
+    // Copies bytes into the arena and returns a view of the copy
+    std::string_view copy(std::string_view bytes) {
+        if (bytes.empty()) {
+            return std::string_view();
+        }
+        char* destination = static_cast<char*>(allocate(bytes.size(), 1));
+        std::memcpy(destination, bytes.data(), bytes.size());
+        return std::string_view(destination, bytes.size());
+    }
+
+    // Bytes handed out, and bytes mapped to serve them
+    std::size_t bytesUsed() const { return used; }
+    std::size_t bytesReserved() const { return reserved; }
+
+    // Unmaps every chunk; everything allocated so far becomes invalid
+    void release() {
+        for (const std::pair<char*, std::size_t>& mapping : mappings) {
+            munmap(mapping.first, mapping.second);
+        }
+        mappings.clear();
+        cursor = limit = nullptr;
+        used = reserved = 0;
+    }
+
+private:
+    static constexpr std::size_t kPageBytes = 4096;
+    static constexpr std::size_t kHugePageBytes = std::size_t(2) << 20;
+
+    static std::size_t roundToPages(std::size_t bytes) {
+        return std::max(kPageBytes, (bytes + kPageBytes - 1) & ~(kPageBytes - 1));
+    }
+
+    char* map(std::size_t bytes) {
+        void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                            -1, 0);
+        if (memory == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+#ifdef MADV_HUGEPAGE
+        if (bytes >= kHugePageBytes) {
+            madvise(memory, bytes, MADV_HUGEPAGE);  // a hint; failure is harmless
+        }
+#endif
+        mappings.emplace_back(static_cast<char*>(memory), bytes);
+        reserved += bytes;
+        return static_cast<char*>(memory);
+    }
+
+    std::size_t chunkBytes;
+    char* cursor;  // Next free byte of the current chunk
+    char* limit;   // End of the current chunk
+    std::size_t used;
+    std::size_t reserved;
+    std::vector<std::pair<char*, std::size_t>> mappings;
+};
+
+#endif  // ARENA_H
@@ -0,0 +1,301 @@
+#ifndef BATCH_IMPORTER_H
+#define BATCH_IMPORTER_H
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+#include "blockchain.h"
+#include "bounded_queue.h"
+#include "mapped_file.h"
+#include "recovery.h"
+#include "sharded_election.h"
+#include "voter_index.h"
+#include "voter_registry.h"
+
+// A voterID,choice record read in batch mode
+struct VoteRecord {
+    std::string_view voterID;
+    std::string_view choice;
+    uint64_t line;   // 1-based line number in the input
+    bool wellFormed; // Both fields present and non-empty
+};
+
+// Records parsed from one piece of batch input. The views point into
+// storage for stdin input and into the mapped file otherwise.
+struct RecordChunk {
+    std::vector<char> storage;
+    std::vector<VoteRecord> records;
+};
+
+// Streams voterID,choice records into the chain through a pipeline of
+// threads: parse, then registry check, then block building and hashing.
+// Persisting overlaps with all three on the chain log's flusher. Rejected
+// records are written to a CSV file rather than the console.
+class BatchImporter {
+private:
+    VoterRegistry& registry;
+    Blockchain* blockchain;
+    ShardedElection* sharded;
+    std::size_t votesPerBlock;
+    std::string checkpointPath;
+    uint64_t lastCheckpointHeight;
+    BoundedQueue<RecordChunk> parsedQueue;   // Parse -> check
+    BoundedQueue<std::vector<std::string>> voteQueue;  // Check -> append
+    uint64_t rejected[4] = {};               // Per VoterRegistry::VoteStatus
+    uint64_t shardedAccepted = 0;            // Votes sent to the shards
+    bool inputFailed = false;
+    bool rejectsFailed = false;
+
+    static constexpr std::size_t kChunkBytes = 1 << 20;
+
+    // Splits the complete lines in [begin, end) into records; a first line
+    // whose voter ID is not numeric is taken as a header and skipped
+    static void parseLines(const char* begin, const char* end, uint64_t& line,
+                           std::vector<VoteRecord>& records) {
+        const char* row = begin;
+        while (row < end) {
+            const char* rowEnd = static_cast<const char*>(std::memchr(row, '\n', end - row));
+            if (rowEnd == nullptr) {
+                rowEnd = end;
+            }
+            const char* lineEnd = rowEnd > row && rowEnd[-1] == '\r' ? rowEnd - 1 : rowEnd;
+            ++line;
+            if (lineEnd > row) {
+                const char* comma = static_cast<const char*>(std::memchr(row, ',', lineEnd - row));
+                VoteRecord record;
+                record.line = line;
+                record.voterID = std::string_view(row, (comma != nullptr ? comma : lineEnd) - row);
+                record.choice = comma != nullptr ? std::string_view(comma + 1, lineEnd - comma - 1)
+                                                 : std::string_view();
+                record.wellFormed = !record.voterID.empty() && !record.choice.empty();
+                uint64_t numericID;
+                if (line != 1 || parseVoterID(record.voterID, numericID)) {
+                    records.push_back(record);
+                }
+            }
+            row = rowEnd + 1;
+        }
+    }
+
+    // Parse stage for a file: the records are views into the mapping
+    void parseFile(const MappedFile& input) {
+        const char* begin = input.data();
+        const char* end = begin + input.size();
+        uint64_t line = 0;
+        while (begin < end) {
+            const char* cut = begin + std::min<std::size_t>(kChunkBytes, end - begin);
+            const char* newline = static_cast<const char*>(std::memchr(cut - 1, '\n', end - (cut - 1)));
+            cut = newline != nullptr ? newline + 1 : end;
+            RecordChunk chunk;
+            parseLines(begin, cut, line, chunk.records);
+            if (!parsedQueue.push(std::move(chunk))) {
+                break;
+            }
+            begin = cut;
+        }
+        parsedQueue.close();
+    }
+
+    // Parse stage for stdin: reads large blocks and carries any partial last
+    // line over to the next chunk
+    void parseStdin() {
+        std::vector<char> carry;
+        uint64_t line = 0;
+        bool done = false;
+        while (!done) {
+            RecordChunk chunk;
+            chunk.storage.swap(carry);
+            std::size_t filled = chunk.storage.size();
+            chunk.storage.resize(filled + kChunkBytes);
+            ssize_t n;
+            do {
+                n = ::read(STDIN_FILENO, chunk.storage.data() + filled, kChunkBytes);
+            } while (n < 0 && errno == EINTR);
+            if (n < 0) {
+                inputFailed = true;
+            }
+            done = n <= 0;
+            filled += n > 0 ? static_cast<std::size_t>(n) : 0;
+            chunk.storage.resize(filled);
+
+            const char* begin = chunk.storage.data();
+            const char* end = begin + filled;
+            if (!done) {
+                // Hold back the unfinished last line
+                const char* last = begin + filled;
+                while (last > begin && last[-1] != '\n') {
+                    --last;
+                }
+                carry.assign(last, end);
+                end = last;
+            }
+            parseLines(begin, end, line, chunk.records);
+            if (!chunk.records.empty() && !parsedQueue.push(std::move(chunk))) {
+                break;
+            }
+        }
+        parsedQueue.close();
+    }
+
+    // Check stage: claims each voter and passes the accepted choices on
+    void checkRecords(std::ofstream& rejects) {
+        RecordChunk chunk;
+        while (parsedQueue.pop(chunk)) {
+            std::vector<std::string> votes;
+            votes.reserve(chunk.records.size());
+            std::vector<uint32_t> rows;
+            for (const VoteRecord& record : chunk.records) {
+                uint32_t row;
+                VoterRegistry::VoteStatus status = record.wellFormed
+                    ? registry.claimVote(record.voterID, &row)
+                    : VoterRegistry::InvalidChoice;
+                if (status == VoterRegistry::Accepted) {
+                    votes.emplace_back(record.choice);
+                    rows.push_back(row);
+                    continue;
+                }
+                rejected[status]++;
+                rejects << record.line << ',' << record.voterID << ',' << reasonName(status) << '\n';
+            }
+            if (sharded != nullptr) {
+                submitToShards(votes, rows);
+            } else if (!votes.empty()) {
+                voteQueue.push(std::move(votes));
+            }
+        }
+        voteQueue.close();
+    }
+
+    // Sharded check stage: once the claims are durable, splits the accepted
+    // votes by shard
+    void submitToShards(std::vector<std::string>& votes, const std::vector<uint32_t>& rows) {
+        if (votes.empty()) {
+            return;
+        }
+        if (!sharded->syncVoters()) {
+            return;  // the claims may be lost; finish() reports the log failure
+        }
+        std::vector<std::vector<std::string>> perShard(sharded->shardCount());
+        for (std::size_t i = 0; i < votes.size(); ++i) {
+            perShard[sharded->shardOf(rows[i])].push_back(std::move(votes[i]));
+        }
+        for (std::size_t shard = 0; shard < perShard.size(); ++shard) {
+            if (!perShard[shard].empty()) {
+                sharded->submit(shard, std::move(perShard[shard]));
+            }
+        }
+        shardedAccepted += votes.size();
+    }
+
+    // Append stage: builds and hashes the blocks and hands them to the log
+    void appendVotes(uint64_t& accepted) {
+        std::vector<std::string> votes;
+        while (voteQueue.pop(votes)) {
+            blockchain->addBlocks(votes, votesPerBlock);
+            accepted += votes.size();
+            if (!checkpointPath.empty() && blockchain->size() > lastCheckpointHeight + 1000) {
+                lastCheckpointHeight = blockchain->size() - 1;
+                if (!saveCheckpoint(checkpointPath, *blockchain, registry)) {
+                    std::cerr << "Unable to write checkpoint " << checkpointPath << std::endl;
+                }
+            }
+        }
+    }
+
+public:
+    // With a checkpoint path, a checkpoint is written there every 1000
+    // blocks; the blockchain and registry must then be attached to the log
+    BatchImporter(VoterRegistry& registry, Blockchain& blockchain, std::size_t votesPerBlock,
+                  const std::string& checkpointPath = std::string())
+        : registry(registry), blockchain(&blockchain), sharded(nullptr),
+          votesPerBlock(votesPerBlock), checkpointPath(checkpointPath),
+          lastCheckpointHeight(blockchain.size() == 0 ? 0 : blockchain.size() - 1),
+          parsedQueue(8), voteQueue(8) {}
+
+    // Sends the accepted votes to the shards of election instead, which
+    // must be open; it packs its own blocks. No checkpoints are written.
+    BatchImporter(VoterRegistry& registry, ShardedElection& election)
+        : registry(registry), blockchain(nullptr), sharded(&election), votesPerBlock(1),
+          lastCheckpointHeight(0), parsedQueue(8), voteQueue(8) {}
+
+    static const char* reasonName(VoterRegistry::VoteStatus status) {
+        switch (status) {
+        case VoterRegistry::NotRegistered: return "not registered";
+        case VoterRegistry::AlreadyVoted:  return "already voted";
+        case VoterRegistry::InvalidChoice: return "malformed";
+        default:                           return "accepted";
+        }
+    }
+
+    // Imports every record from inputPath ("-" for stdin), writes rejected
+    // records to rejectsPath as line,voterID,reason and prints a summary
+    // with the throughput. Returns false if the input or the log failed.
+    bool run(const std::string& inputPath, const std::string& rejectsPath) {
+        MappedFile input;
+        if (inputPath != "-" && !input.open(inputPath)) {
+            std::cerr << "Error: Could not open batch input " << inputPath << std::endl;
+            return false;
+        }
+        std::ofstream rejects(rejectsPath);
+        rejects << "Line,VoterID,Reason\n";
+
+        auto start = std::chrono::steady_clock::now();
+        uint64_t accepted = 0;
+        std::thread parser([this, &inputPath, &input] {
+            if (inputPath == "-") {
+                parseStdin();
+            } else {
+                parseFile(input);
+            }
+        });
+        std::thread checker([this, &rejects] { checkRecords(rejects); });
+        appendVotes(accepted);
+        parser.join();
+        checker.join();
+        if (sharded != nullptr) {
+            accepted = shardedAccepted;
+        }
+        bool synced = sharded != nullptr ? sharded->finish() : blockchain->sync();
+        double seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        rejects.close();
+        rejectsFailed = !rejects;
+        uint64_t totalRejected = rejected[VoterRegistry::NotRegistered] +
+                                 rejected[VoterRegistry::AlreadyVoted] +
+                                 rejected[VoterRegistry::InvalidChoice];
+        std::cout << "Batch import: " << accepted + totalRejected << " records, " << accepted
+             << " accepted, " << totalRejected << " rejected ("
+             << rejected[VoterRegistry::NotRegistered] << " not registered, "
+             << rejected[VoterRegistry::AlreadyVoted] << " already voted, "
+             << rejected[VoterRegistry::InvalidChoice] << " malformed)" << std::endl;
+        if (totalRejected > 0) {
+            std::cout << "Rejected records written to " << rejectsPath << std::endl;
+        }
+        std::cout << "Appended " << accepted << " votes in " << seconds << " s ("
+             << static_cast<uint64_t>(seconds > 0 ? accepted / seconds : 0) << " votes/s)" << std::endl;
+
+        if (inputFailed) {
+            std::cerr << "Error: Could not read the batch input" << std::endl;
+        }
+        if (rejectsFailed) {
+            std::cerr << "Error: Could not write " << rejectsPath << std::endl;
+        }
+        if (!synced) {
+            std::cerr << "Error: Could not write the chain log" << std::endl;
+        }
+        return !inputFailed && synced;
+    }
+};
+
+#endif  // BATCH_IMPORTER_H
@@ -0,0 +1,915 @@
+/*
+
+Benchmarks for the voting system's hot paths: registry load and lookup,
+vote append, chain verification and tallying. Synthetic registries and
+vote streams are generated in a scratch directory, each path is timed and
+the results are written as JSON so runs can be compared between releases.
+
+    g++ -std=c++17 -O2 -pthread bench/bench.cpp -o bench_voting
+    ./bench_voting --voters 1000000 --votes-per-block 256 --out results.json
+
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../sha256_backend.h"
+#include "../chain_log.h"
+#include "../voter_registry.h"
+#include "../blockchain.h"
+#include "../block_header.h"
+#include "../replication.h"
+#include "../chain_archive.h"
+#include "../vote_ingestor.h"
+#include "../batch_importer.h"
+#include "../recovery.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+// Benchmark settings, from the command line
+struct Config {
+    uint64_t voters = 100000;    // Registry rows to generate
+    uint64_t votes = 0;          // Votes to cast; 0 means one per voter
+    size_t votesPerBlock = 1;    // 1 for a block per vote, otherwise batch blocks
+    unsigned threads = 0;        // For the parallel paths; 0 picks the core count
+    uint64_t seed = 1;
+    string dir = "bench-data";   // Scratch directory for the registry and the log
+    string out;                  // JSON output file; stdout when empty
+};
+
+// Outcome of one benchmark
+struct Result {
+    string name;
+    uint64_t ops = 0;
+    double seconds = 0;
+    double p50Nanos = -1;        // Per-operation latency, when sampled
+    double p99Nanos = -1;
+    long peakRssKb = 0;
+    double compressionsPerOp = -1;  // SHA-256 compression calls, when counted
+};
+
+static double secondsSince(Clock::time_point start) {
+    return chrono::duration<double>(Clock::now() - start).count();
+}
+
+static long peakRssKb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Collects per-operation latencies; keeps every sample up to a cap, then
+// every nth, so long runs stay bounded in memory
+class LatencySampler {
+public:
+    explicit LatencySampler(uint64_t expectedOps) : stride(max<uint64_t>(1, expectedOps / kMaxSamples)) {}
+
+    bool wants(uint64_t op) const { return op % stride == 0; }
+
+    void add(Clock::duration elapsed) {
+        samples.push_back(chrono::duration<double, nano>(elapsed).count());
+    }
+
+    void fill(Result& result) {
+        if (samples.empty()) {
+            return;
+        }
+        sort(samples.begin(), samples.end());
+        result.p50Nanos = samples[samples.size() / 2];
+        result.p99Nanos = samples[min(samples.size() - 1, samples.size() * 99 / 100)];
+    }
+
+private:
+    static constexpr uint64_t kMaxSamples = 1 << 20;
+    uint64_t stride;
+    vector<double> samples;
+};
+
+// Writes a registry CSV with distinct random 8-digit-or-longer voter IDs and
+// returns the IDs in file order. With several counties, row i is in county
+// i % counties.
+static vector<uint64_t> writeRegistry(const string& path, uint64_t voters, mt19937_64& random,
+                                      unsigned counties = 1) {
+    vector<uint64_t> ids(voters);
+    // An odd multiplier is a bijection modulo 2^k, so the IDs stay distinct
+    uint64_t multiplier = (random() | 1) & 0xffffffffULL;
+    for (uint64_t i = 0; i < voters; ++i) {
+        ids[i] = 10000000 + ((i * multiplier) & 0xfffffffffULL);
+    }
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        cerr << "Error: Could not write " << path << endl;
+        exit(1);
+    }
+    static const char* firstNames[] = {"Ian", "Jennifer", "Robert", "Amy", "Sylvia", "Omar"};
+    static const char* lastNames[] = {"Thompson", "Zhang", "Baxter", "Moore", "Stephenson", "Diaz"};
+    fputs("VoterID,FirstName,LastName,DateOfBirth,Address,City,County,State,ZipCode\n", file);
+    char county[32] = "Forrest";
+    for (uint64_t i = 0; i < voters; ++i) {
+        if (counties > 1) {
+            snprintf(county, sizeof(county), "County %u", unsigned(i % counties));
+        }
+        fprintf(file, "%llu,%s,%s,19%02u-%02u-%02u,%u Main Street,Springfield,%s,MS,%05u\n",
+                static_cast<unsigned long long>(ids[i]), firstNames[i % 6], lastNames[(i / 6) % 6],
+                unsigned(40 + i % 60), unsigned(1 + i % 12), unsigned(1 + i % 28),
+                unsigned(1 + i % 9999), county, unsigned(i % 100000));
+    }
+    fclose(file);
+    return ids;
+}
+
+// Memory held per item once everything is loaded
+struct Footprint {
+    double bytesPerVoter = 0;
+    double bytesPerBlock = 0;
+};
+
+static void printJson(ostream& out, const Config& config, const vector<Result>& results,
+                      const Footprint& footprint) {
+    out << "{\n";
+    out << "  \"config\": {\"voters\": " << config.voters << ", \"votes\": " << config.votes
+        << ", \"votes_per_block\": " << config.votesPerBlock << ", \"threads\": " << config.threads
+        << ", \"seed\": " << config.seed << "},\n";
+    out << "  \"sha256_backend\": \"" << picosha2::backend::name(picosha2::backend::active())
+        << "\",\n";
+    out << "  \"bytes_per_voter\": " << footprint.bytesPerVoter << ",\n";
+    out << "  \"bytes_per_block\": " << footprint.bytesPerBlock << ",\n";
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        out << "    {\"name\": \"" << r.name << "\", \"ops\": " << r.ops
+            << ", \"seconds\": " << r.seconds
+            << ", \"ops_per_sec\": " << (r.seconds > 0 ? r.ops / r.seconds : 0);
+        if (r.p50Nanos >= 0) {
+            out << ", \"p50_ns\": " << r.p50Nanos << ", \"p99_ns\": " << r.p99Nanos;
+        }
+        if (r.compressionsPerOp >= 0) {
+            out << ", \"compressions_per_op\": " << r.compressionsPerOp;
+        }
+        out << ", \"peak_rss_kb\": " << r.peakRssKb << "}" << (i + 1 < results.size() ? "," : "")
+            << "\n";
+    }
+    out << "  ],\n";
+    out << "  \"peak_rss_kb\": " << peakRssKb() << "\n";
+    out << "}\n";
+}
+
+static bool parseArgs(int argc, char* argv[], Config& config) {
+    for (int i = 1; i < argc; ++i) {
+        string option = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        string value = argv[++i];
+        if (option == "--voters") {
+            config.voters = strtoull(value.c_str(), nullptr, 10);
+        } else if (option == "--votes") {
+            config.votes = strtoull(value.c_str(), nullptr, 10);
+        } else if (option == "--votes-per-block") {
+            config.votesPerBlock = max<size_t>(1, strtoull(value.c_str(), nullptr, 10));
+        } else if (option == "--threads") {
+            config.threads = static_cast<unsigned>(strtoul(value.c_str(), nullptr, 10));
+        } else if (option == "--seed") {
+            config.seed = strtoull(value.c_str(), nullptr, 10);
+        } else if (option == "--dir") {
+            config.dir = value;
+        } else if (option == "--out") {
+            config.out = value;
+        } else {
+            return false;
+        }
+    }
+    return config.voters > 0;
+}
+
+int main(int argc, char* argv[]) {
+    Config config;
+    if (!parseArgs(argc, argv, config)) {
+        cerr << "Usage: " << argv[0] << " [--voters N] [--votes N] [--votes-per-block N]"
+             << " [--threads N] [--seed N] [--dir DIR] [--out FILE]" << endl;
+        return 1;
+    }
+    if (config.votes == 0 || config.votes > config.voters) {
+        config.votes = config.voters;
+    }
+    if (config.threads == 0) {
+        config.threads = max(1u, thread::hardware_concurrency());
+    }
+
+    // Work inside the scratch directory: the chain writes lasthash.txt to
+    // the current directory
+    ofstream jsonFile;
+    if (!config.out.empty()) {
+        jsonFile.open(config.out);
+        if (!jsonFile) {
+            cerr << "Error: Could not write " << config.out << endl;
+            return 1;
+        }
+    }
+    mkdir(config.dir.c_str(), 0755);
+    if (chdir(config.dir.c_str()) != 0 || system("rm -rf chainlog lasthash.txt replica-* archive* ingest shards") != 0) {
+        cerr << "Error: Could not prepare " << config.dir << endl;
+        return 1;
+    }
+    const string registryPath = "registry.csv";
+    const string logDir = "chainlog";
+
+    mt19937_64 random(config.seed);
+    vector<uint64_t> ids = writeRegistry(registryPath, config.voters, random);
+    // The vote stream: a random subset of the voters, in random order
+    shuffle(ids.begin(), ids.end(), random);
+    ids.resize(config.votes);
+    vector<string> voterIDs(ids.size()), choices(ids.size());
+    for (size_t i = 0; i < ids.size(); ++i) {
+        voterIDs[i] = to_string(ids[i]);
+        choices[i] = to_string(1 + random() % 4);
+    }
+    vector<uint64_t>().swap(ids);
+
+    vector<Result> results;
+    Result result;
+
+    // Registry load: mmap and parallel parse of the CSV
+    VoterRegistry registry;
+    streambuf* console = cout.rdbuf(nullptr);  // The loader reports to stdout
+    Clock::time_point start = Clock::now();
+    registry.loadVoterRegistry(registryPath, config.threads);
+    cout.rdbuf(console);
+    result = Result{"registry_load", config.voters, secondsSince(start), -1, -1, peakRssKb()};
+    results.push_back(result);
+
+    // Registry lookup: checking and marking each voter
+    {
+        LatencySampler sampler(voterIDs.size());
+        start = Clock::now();
+        for (uint64_t i = 0; i < voterIDs.size(); ++i) {
+            if (sampler.wants(i)) {
+                Clock::time_point opStart = Clock::now();
+                registry.claimVote(voterIDs[i]);
+                sampler.add(Clock::now() - opStart);
+            } else {
+                registry.claimVote(voterIDs[i]);
+            }
+        }
+        result = Result{"registry_claim", voterIDs.size(), secondsSince(start), -1, -1, 0};
+        sampler.fill(result);
+        result.peakRssKb = peakRssKb();
+        results.push_back(result);
+    }
+
+    // Concurrent ingestion: N threads (1 to 64) submit overlapping voter IDs
+    // through a VoteIngestor on a fresh registry and a logged chain. Each
+    // thread takes twice its share of the stream, so every voter is
+    // submitted twice, by two threads where there are two. Exactly one
+    // submission per voter must be accepted and each accepted voter must
+    // have exactly one vote on the chain; the vote is the voter ID so the
+    // chain can be checked against the accepted set.
+    for (unsigned threadCount = 1; threadCount <= 64; threadCount *= 2) {
+        const string name = "ingest_threads_" + to_string(threadCount);
+        const uint64_t voters = voterIDs.size();
+        unique_ptr<VoterRegistry> fresh(new VoterRegistry);
+        cout.rdbuf(nullptr);
+        fresh->loadVoterRegistry(registryPath, config.threads);
+        cout.rdbuf(console);
+        Blockchain ingestChain;
+        ChainLog ingestLog;
+        if (system("rm -rf ingest") != 0 || !ingestChain.openIndex("ingest") ||
+            !ingestLog.open("ingest", ChainLog::Options(),
+                            [](uint8_t, const uint8_t*, size_t) { return true; })) {
+            cerr << "Error: Could not open ingest" << endl;
+            return 1;
+        }
+        ingestChain.setTipFile("ingest/lasthash.txt");
+        ingestChain.attachLog(ingestLog);
+        ingestChain.addGenesisBlock();
+        fresh->attachLog(ingestLog);
+
+        vector<vector<uint32_t>> accepted(threadCount);
+        uint64_t share = (voters + threadCount - 1) / threadCount;
+        start = Clock::now();
+        {
+            VoteIngestor ingestor(*fresh, ingestChain, config.votesPerBlock);
+            vector<thread> submitters;
+            for (unsigned t = 0; t < threadCount; ++t) {
+                submitters.emplace_back([&, t] {
+                    for (uint64_t k = 0; k < 2 * share; ++k) {
+                        uint64_t i = (t * share + k) % voters;
+                        if (ingestor.submit(voterIDs[i], voterIDs[i]) == VoterRegistry::Accepted) {
+                            accepted[t].push_back(static_cast<uint32_t>(i));
+                        }
+                    }
+                });
+            }
+            for (thread& submitter : submitters) {
+                submitter.join();
+            }
+            ingestor.flush();
+        }
+        bool synced = ingestChain.sync();
+        result = Result{name, voters, secondsSince(start), -1, -1, peakRssKb()};
+        results.push_back(result);
+
+        vector<uint8_t> acceptedTimes(voters), votedTimes(voters);
+        for (const vector<uint32_t>& indexes : accepted) {
+            for (uint32_t i : indexes) {
+                acceptedTimes[i]++;
+            }
+        }
+        unordered_map<string_view, uint32_t> indexOf;
+        indexOf.reserve(voters);
+        for (uint64_t i = 0; i < voters; ++i) {
+            indexOf.emplace(voterIDs[i], static_cast<uint32_t>(i));
+        }
+        uint64_t strays = 0;
+        for (uint64_t height = 1; height < ingestChain.size(); ++height) {
+            ingestChain.at(height).forEachVote([&](string_view vote) {
+                auto found = indexOf.find(vote);
+                if (found == indexOf.end()) {
+                    ++strays;
+                } else {
+                    votedTimes[found->second]++;
+                }
+            });
+        }
+        for (uint64_t i = 0; i < voters; ++i) {
+            if (acceptedTimes[i] != 1 || votedTimes[i] != 1) {
+                cerr << "Error: " << name << ": voter " << voterIDs[i] << " accepted "
+                     << int(acceptedTimes[i]) << " times, on the chain " << int(votedTimes[i])
+                     << " times" << endl;
+                return 1;
+            }
+        }
+        if (strays > 0 || !synced) {
+            cerr << "Error: " << name << ": " << strays << " unknown votes on the chain"
+                 << (synced ? "" : ", and the log could not be synced") << endl;
+            return 1;
+        }
+    }
+    if (system("rm -rf ingest") != 0) {
+        cerr << "Error: Could not remove ingest" << endl;
+        return 1;
+    }
+
+    // Sharded batch import: the vote stream as a batch file, run through a
+    // BatchImporter into 1 to 8 shard chains on a registry spread over 64
+    // counties, so votes/s can be compared across shard counts on machines
+    // with the cores for it. Every vote must land on exactly one shard and
+    // the root chain must pin every shard's tip.
+    {
+        const string shardRegistryPath = "shard-registry.csv";
+        const string shardVotesPath = "shard-votes.csv";
+        mt19937_64 shardRandom(config.seed);
+        vector<uint64_t> shardIDs = writeRegistry(shardRegistryPath, config.voters, shardRandom, 64);
+        shuffle(shardIDs.begin(), shardIDs.end(), shardRandom);
+        ofstream votesFile(shardVotesPath);
+        votesFile << "VoterID,Choice\n";
+        for (uint64_t i = 0; i < config.votes; ++i) {
+            votesFile << shardIDs[i] << ',' << 1 + shardRandom() % 4 << '\n';
+        }
+        votesFile.close();
+        if (!votesFile) {
+            cerr << "Error: Could not write " << shardVotesPath << endl;
+            return 1;
+        }
+        for (size_t shardCount = 1; shardCount <= 8; shardCount *= 2) {
+            const string name = "shard_ingest_" + to_string(shardCount);
+            VoterRegistry shardRegistry;
+            cout.rdbuf(nullptr);  // The loader and the importer report to stdout
+            shardRegistry.loadVoterRegistry(shardRegistryPath, config.threads);
+            bool imported = false;
+            uint64_t sharded = 0;
+            {
+                if (system("rm -rf shards") != 0) {
+                    cout.rdbuf(console);
+                    return 1;
+                }
+                ShardedElection election(shardRegistry, CandidateList(), shardCount,
+                                         ShardedElection::ByCounty, config.votesPerBlock,
+                                         "shards");
+                if (election.open()) {
+                    BatchImporter importer(shardRegistry, election);
+                    start = Clock::now();
+                    imported = importer.run(shardVotesPath, "shards/rejected.csv");
+                    result = Result{name, config.votes, secondsSince(start), -1, -1, peakRssKb()};
+                    imported = imported && election.verify(config.threads);
+                    for (uint64_t votes : election.votesPerShard()) {
+                        sharded += votes;
+                    }
+                }
+            }
+            cout.rdbuf(console);
+            if (!imported || sharded != config.votes) {
+                cerr << "Error: " << name << ": " << sharded << " of " << config.votes
+                     << " votes reached a shard" << endl;
+                return 1;
+            }
+            results.push_back(result);
+        }
+        if (system("rm -rf shards shard-registry.csv shard-votes.csv") != 0) {
+            cerr << "Error: Could not remove shards" << endl;
+            return 1;
+        }
+    }
+
+    // Registry lookups while deltas are applied on another thread, next to
+    // the same lookups with the registry left alone. Each delta adds and
+    // corrects 1% of the registry; with a single core the rebuild competes
+    // with the lookups for the CPU, which shows in the p99.
+    {
+        uint64_t deltaRows = max<uint64_t>(1, config.voters / 100);
+        vector<string> deltas(4);
+        for (size_t d = 0; d < deltas.size(); ++d) {
+            string& delta = deltas[d];
+            for (uint64_t i = 0; i < deltaRows; ++i) {
+                delta += "add," + to_string(100000000000ULL + d * deltaRows + i) +
+                         ",New,Voter,1990-01-01,1 Main Street,Springfield,Forrest,MS,00001\n";
+                delta += "update," + voterIDs[(d * deltaRows + i) % voterIDs.size()] +
+                         ",Corrected,Voter,1990-01-01,1 Main Street,Springfield,Forrest,MS,00001\n";
+            }
+        }
+        const uint64_t lookups = voterIDs.size();
+        for (int withDeltas = 0; withDeltas < 2; ++withDeltas) {
+            atomic<bool> applying(withDeltas != 0);
+            thread applier;
+            double applySeconds = 0;
+            if (withDeltas) {
+                applier = thread([&] {
+                    Clock::time_point applyStart = Clock::now();
+                    for (const string& delta : deltas) {
+                        registry.applyDelta(delta);
+                    }
+                    applySeconds = secondsSince(applyStart);
+                    applying = false;
+                });
+            }
+            LatencySampler sampler(lookups);
+            Voter voter;
+            uint64_t done = 0;
+            start = Clock::now();
+            // With deltas, keep looking up until the last one is published
+            while (done < lookups || applying) {
+                const string& id = voterIDs[done % voterIDs.size()];
+                if (sampler.wants(done)) {
+                    Clock::time_point opStart = Clock::now();
+                    registry.findVoter(id, voter);
+                    sampler.add(Clock::now() - opStart);
+                } else {
+                    registry.findVoter(id, voter);
+                }
+                ++done;
+            }
+            result = Result{withDeltas ? "registry_find_during_delta" : "registry_find", done,
+                            secondsSince(start), -1, -1, 0};
+            sampler.fill(result);
+            result.peakRssKb = peakRssKb();
+            results.push_back(result);
+            if (withDeltas) {
+                applier.join();
+                result = Result{"registry_delta_apply", deltas.size() * deltaRows * 2,
+                                applySeconds, -1, -1, peakRssKb()};
+                results.push_back(result);
+            }
+        }
+    }
+
+    // Vote append, logged to a chain log as in production; the final sync
+    // is included so persisting is part of the cost
+    unique_ptr<Blockchain> chain(new Blockchain);
+    Blockchain& blockchain = *chain;
+    ChainLog chainLog;
+    if (!blockchain.openIndex(logDir) ||
+        !chainLog.open(logDir, ChainLog::Options(),
+                       [](uint8_t, const uint8_t*, size_t) { return true; })) {
+        cerr << "Error: Could not open " << logDir << endl;
+        return 1;
+    }
+    blockchain.attachLog(chainLog);
+    blockchain.addGenesisBlock();
+    {
+        LatencySampler sampler(voterIDs.size() / config.votesPerBlock);
+        start = Clock::now();
+        if (config.votesPerBlock == 1) {
+            for (uint64_t i = 0; i < choices.size(); ++i) {
+                if (sampler.wants(i)) {
+                    Clock::time_point opStart = Clock::now();
+                    blockchain.addBlock(choices[i]);
+                    sampler.add(Clock::now() - opStart);
+                } else {
+                    blockchain.addBlock(choices[i]);
+                }
+            }
+        } else {
+            vector<string> batch;
+            for (uint64_t i = 0; i < choices.size(); i += config.votesPerBlock) {
+                batch.assign(choices.begin() + i,
+                             choices.begin() + min<uint64_t>(choices.size(), i + config.votesPerBlock));
+                Clock::time_point opStart = Clock::now();
+                blockchain.addBatchBlock(batch);
+                sampler.add(Clock::now() - opStart);
+            }
+        }
+        blockchain.sync();
+        result = Result{config.votesPerBlock == 1 ? "append_single" : "append_batch",
+                        choices.size(), secondsSince(start), -1, -1, 0};
+        sampler.fill(result);
+        result.peakRssKb = peakRssKb();
+        results.push_back(result);
+    }
+
+    // Replication to 1 to 4 followers over a Unix socket, each into its own
+    // chain and log: first catching up on the whole log, then the lag from
+    // a new block being durable on the leader to every follower having it
+    // durable too
+    for (size_t followerCount = 1; followerCount <= 4; ++followerCount) {
+        struct Replica {
+            Blockchain chain;
+            ChainLog log;
+            unique_ptr<replication::Follower> follower;
+            thread runner;
+        };
+        replication::Leader leader(chainLog);
+        if (!leader.listen("unix:replica.sock")) {
+            return 1;
+        }
+        vector<unique_ptr<Replica>> replicas;
+        start = Clock::now();
+        for (size_t i = 0; i < followerCount; ++i) {
+            string dir = "replica-" + to_string(i);
+            if (system(("rm -rf " + dir + " " + dir + "-lasthash.txt").c_str()) != 0) {
+                return 1;
+            }
+            replicas.emplace_back(new Replica());
+            Replica& replica = *replicas.back();
+            replica.chain.setTipFile(dir + "-lasthash.txt");
+            replica.log.open(dir, ChainLog::Options(),
+                             [](uint8_t, const uint8_t*, size_t) { return true; });
+            replica.chain.attachLog(replica.log);
+            replica.follower.reset(new replication::Follower(replica.chain, replica.log, nullptr,
+                                                             dir + "/replica.pos"));
+            if (!replica.follower->connect("unix:replica.sock")) {
+                return 1;
+            }
+            replica.runner = thread([&replica] { replica.follower->run(); });
+        }
+        bool caughtUp = leader.waitForAcks(followerCount, blockchain.size(), chrono::minutes(10));
+        result = Result{"replicate_" + to_string(followerCount) + "_followers",
+                        choices.size() * followerCount, secondsSince(start), -1, -1, peakRssKb()};
+        results.push_back(result);
+
+        const uint64_t rounds = 200;
+        LatencySampler sampler(rounds);
+        vector<string> batch(choices.begin(),
+                             choices.begin() + min<uint64_t>(choices.size(), config.votesPerBlock));
+        start = Clock::now();
+        for (uint64_t i = 0; i < rounds && caughtUp; ++i) {
+            blockchain.addBlocks(batch, config.votesPerBlock);
+            blockchain.sync();
+            Clock::time_point opStart = Clock::now();
+            caughtUp = leader.waitForAcks(followerCount, blockchain.size(), chrono::seconds(10));
+            sampler.add(Clock::now() - opStart);
+        }
+        result = Result{"replication_lag_" + to_string(followerCount) + "_followers", rounds,
+                        secondsSince(start), -1, -1, 0};
+        sampler.fill(result);
+        result.peakRssKb = peakRssKb();
+        results.push_back(result);
+
+        leader.stop();
+        for (unique_ptr<Replica>& replica : replicas) {
+            replica->runner.join();
+            if (!caughtUp || replica->chain.getLastHash() != blockchain.getLastHash()) {
+                cerr << "Error: Replica does not match the chain" << endl;
+                return 1;
+            }
+        }
+    }
+
+    // Tail check against lasthash.txt, as done before every interactive vote
+    {
+        const uint64_t rounds = 1000;
+        LatencySampler sampler(rounds);
+        start = Clock::now();
+        for (uint64_t i = 0; i < rounds; ++i) {
+            Clock::time_point opStart = Clock::now();
+            blockchain.verify();
+            sampler.add(Clock::now() - opStart);
+        }
+        result = Result{"verify_tail", rounds, secondsSince(start), -1, -1, 0};
+        sampler.fill(result);
+        result.peakRssKb = peakRssKb();
+        results.push_back(result);
+    }
+
+    // Full audit: every hash, link and Merkle root, in parallel
+    {
+        size_t badHeight;
+        start = Clock::now();
+        if (!blockchain.verifyFull(config.threads, badHeight)) {
+            cerr << "Error: Generated chain failed verification at block " << badHeight << endl;
+            return 1;
+        }
+        result = Result{"verify_full", blockchain.size(), secondsSince(start), -1, -1, peakRssKb()};
+        results.push_back(result);
+    }
+
+    // Inclusion proofs for a random sample of receipts, as auditors query
+    // them: one at a time by receipt, a block's worth at once, and checked
+    // against the block hash. Every proof must verify, and must stop
+    // verifying once its vote or receipt is altered.
+    {
+        const uint64_t samples = min<uint64_t>(20000, choices.size());
+        vector<Hash256> receipts;
+        vector<uint64_t> heights;
+        receipts.reserve(samples);
+        for (uint64_t i = 0; i < samples; ++i) {
+            uint64_t height = 1 + random() % (blockchain.size() - 1);
+            const Block& block = blockchain.at(height);
+            if (block.isBatch()) {
+                uint32_t index = static_cast<uint32_t>(random() % block.voteCount);
+                receipts.push_back(merkleLeafHash(block.prevHash, index, block.votes()[index]));
+            } else {
+                receipts.push_back(block.hash);
+            }
+            heights.push_back(height);
+        }
+
+        vector<InclusionProof> proofs(receipts.size());
+        LatencySampler sampler(receipts.size());
+        start = Clock::now();
+        for (size_t i = 0; i < receipts.size(); ++i) {
+            Clock::time_point opStart = Clock::now();
+            bool found = blockchain.proveVote(receipts[i], proofs[i]);
+            sampler.add(Clock::now() - opStart);
+            if (!found) {
+                cerr << "Error: No proof for an issued receipt at block " << heights[i] << endl;
+                return 1;
+            }
+        }
+        result = Result{"prove_vote", receipts.size(), secondsSince(start), -1, -1, 0};
+        sampler.fill(result);
+        result.peakRssKb = peakRssKb();
+        results.push_back(result);
+
+        // Counted per proof, so it compares with prove_vote
+        const uint64_t blocks = min<uint64_t>(2000, heights.size());
+        uint64_t blockProofs = 0;
+        start = Clock::now();
+        for (uint64_t i = 0; i < blocks; ++i) {
+            blockProofs += blockchain.proveBlock(heights[i]).size();
+        }
+        result = Result{"prove_block", blockProofs, secondsSince(start), -1, -1, peakRssKb()};
+        results.push_back(result);
+
+        uint64_t rejected = 0;
+        start = Clock::now();
+        for (size_t i = 0; i < proofs.size(); ++i) {
+            rejected += !verifyInclusionProof(proofs[i], receipts[i],
+                                              blockchain.at(proofs[i].height).hash);
+        }
+        result = Result{"verify_inclusion_proof", proofs.size(), secondsSince(start), -1, -1,
+                        peakRssKb()};
+        results.push_back(result);
+        if (rejected > 0) {
+            cerr << "Error: " << rejected << " valid inclusion proofs were rejected" << endl;
+            return 1;
+        }
+
+        uint64_t accepted = 0;
+        for (size_t i = 0; i < proofs.size(); ++i) {
+            const Hash256& blockHash = blockchain.at(proofs[i].height).hash;
+            Hash256 otherReceipt = receipts[i];
+            otherReceipt[i % otherReceipt.size()] ^= 1;
+            InclusionProof otherVote = proofs[i];
+            otherVote.vote += '0';
+            accepted += verifyInclusionProof(proofs[i], otherReceipt, blockHash) +
+                        verifyInclusionProof(otherVote, receipts[i], blockHash);
+        }
+        if (accepted > 0) {
+            cerr << "Error: " << accepted << " tampered inclusion proofs were accepted" << endl;
+            return 1;
+        }
+    }
+
+    // Archive export straight from the log files, and import into a fresh
+    // log with every block re-hashed; zstd segments too in -DVOTING_ZSTD
+    // builds
+    for (int compress = 0; compress <= (archiveZstdAvailable() ? 1 : 0); ++compress) {
+        const string suffix = compress ? "_zstd" : "";
+        uint64_t blocks = 0;
+        start = Clock::now();
+        if (!exportChainLog(logDir, "archive.bca", compress != 0, blocks)) {
+            return 1;
+        }
+        result = Result{"archive_export" + suffix, blocks, secondsSince(start), -1, -1, peakRssKb()};
+        results.push_back(result);
+
+        if (system("rm -rf archive-import") != 0) {
+            return 1;
+        }
+        start = Clock::now();
+        if (!importArchive("archive.bca", "archive-import", blocks) ||
+            blocks != blockchain.size()) {
+            cerr << "Error: Archive import does not match the chain" << endl;
+            return 1;
+        }
+        result = Result{"archive_import" + suffix, blocks, secondsSince(start), -1, -1, peakRssKb()};
+        results.push_back(result);
+    }
+
+    // Chaining single-vote block hashes: as blocks did with hex strings,
+    // hashing the previous digest's hex text and vote through a
+    // stringstream, and as they do now from the raw 32-byte digest
+    {
+        const uint64_t rounds = choices.size();
+        string hexHash(64, '0');
+        start = Clock::now();
+        for (uint64_t i = 0; i < rounds; ++i) {
+            stringstream concat;
+            concat << hexHash << choices[i];
+            hexHash = picosha2::hash256_hex_string(concat.str());
+        }
+        result = Result{"block_hash_hex", rounds, secondsSince(start), -1, -1, peakRssKb()};
+        results.push_back(result);
+
+        Hash256 rawHash{};
+        start = Clock::now();
+        for (uint64_t i = 0; i < rounds; ++i) {
+            rawHash = Block::computeHash(rawHash, choices[i]);
+        }
+        result = Result{"block_hash_raw", rounds, secondsSince(start), -1, -1, peakRssKb()};
+        results.push_back(result);
+        volatile uint8_t sink = uint8_t(hexHash[0]) ^ rawHash[0];
+        (void)sink;
+    }
+
+    // Fixed-layout header hashing, from scratch and from the domain's
+    // midstate
+    {
+        BlockHeaderHasher hasher("bench-election/v1");
+        BlockHeader header;
+        header.timestamp = 1700000000;
+        const uint64_t rounds = config.votes;
+        for (int fromMidstate = 0; fromMidstate < 2; ++fromMidstate) {
+            uint64_t compressions = 0;
+            size_t calls;
+            start = Clock::now();
+            for (uint64_t i = 0; i < rounds; ++i) {
+                header.height = i;
+                header.prevHash = fromMidstate ? hasher.hash(header, &calls)
+                                               : hasher.hashFromScratch(header, &calls);
+                compressions += calls;
+            }
+            result = Result{fromMidstate ? "header_hash_midstate" : "header_hash_full", rounds,
+                            secondsSince(start), -1, -1, peakRssKb()};
+            result.compressionsPerOp = double(compressions) / rounds;
+            results.push_back(result);
+            if (hasher.hash(header) != hasher.hashFromScratch(header)) {
+                cerr << "Error: Midstate header hash does not match" << endl;
+                return 1;
+            }
+        }
+    }
+
+    // Reading the running tally, as checkWinner does
+    {
+        const uint64_t rounds = 100000;
+        LatencySampler sampler(rounds);
+        start = Clock::now();
+        volatile uint64_t sink = 0;
+        for (uint64_t i = 0; i < rounds; ++i) {
+            Clock::time_point opStart = Clock::now();
+            sink = blockchain.currentTally().counts[0];
+            sampler.add(Clock::now() - opStart);
+        }
+        (void)sink;
+        result = Result{"tally_snapshot", rounds, secondsSince(start), -1, -1, 0};
+        sampler.fill(result);
+        result.peakRssKb = peakRssKb();
+        results.push_back(result);
+    }
+
+    // Independent recount from a packed vote column
+    {
+        TallySnapshot recounted;
+        size_t badHeight;
+        start = Clock::now();
+        blockchain.recount(config.threads, false, recounted, badHeight);
+        result = Result{"recount", choices.size(), secondsSince(start), -1, -1, peakRssKb()};
+        results.push_back(result);
+        if (recounted.counts != blockchain.currentTally().counts) {
+            cerr << "Error: Recount does not match the running tally" << endl;
+            return 1;
+        }
+    }
+
+    Footprint footprint;
+    footprint.bytesPerVoter = registry.bytesPerVoter();
+    footprint.bytesPerBlock = blockchain.bytesPerBlock();
+
+    // A checkpoint as the production loop writes one every 1000 blocks,
+    // followed by the longest log suffix that loop leaves behind it, for
+    // the recovery steps below. Taken against a registry that applied no
+    // deltas, as a restart loads one.
+    const string checkpointPath = logDir + "/checkpoint";
+    uint64_t recoveredSize;
+    Hash256 recoveredTip;
+    {
+        VoterRegistry checkpointRegistry;
+        cout.rdbuf(nullptr);
+        checkpointRegistry.loadVoterRegistry(registryPath, config.threads);
+        cout.rdbuf(console);
+        checkpointRegistry.attachLog(chainLog);
+        if (!saveCheckpoint(checkpointPath, blockchain, checkpointRegistry)) {
+            cerr << "Error: Could not write " << checkpointPath << endl;
+            return 1;
+        }
+        vector<string> batch(choices.begin(),
+                             choices.begin() + min<uint64_t>(choices.size(), config.votesPerBlock));
+        for (int i = 0; i < 999; ++i) {
+            blockchain.addBlocks(batch, config.votesPerBlock);
+        }
+        if (!blockchain.sync()) {
+            cerr << "Error: Could not write " << logDir << endl;
+            return 1;
+        }
+        recoveredSize = blockchain.size();
+        recoveredTip = blockchain.getLastHash();
+    }
+
+    // Tearing the chain down, as at the end of an election
+    {
+        uint64_t blocks = blockchain.size();
+        chainLog.close();
+        start = Clock::now();
+        chain.reset();
+        result = Result{"teardown", blocks, secondsSince(start), -1, -1, peakRssKb()};
+        results.push_back(result);
+    }
+
+    // Time to ready after a crash: reopening the log and its indexes as a
+    // restart does, from the checkpoint with only the suffix replayed, and
+    // with the whole log replayed. The registry load is timed on its own
+    // by registry_load.
+    for (int fromCheckpoint = 1; fromCheckpoint >= 0; --fromCheckpoint) {
+        VoterRegistry recoveredRegistry;
+        cout.rdbuf(nullptr);
+        recoveredRegistry.loadVoterRegistry(registryPath, config.threads);
+        cout.rdbuf(console);
+        Blockchain recovered;
+        ChainLog recoveredLog;
+        LogPosition replayFrom;
+        start = Clock::now();
+        bool loaded = recovered.openIndex(logDir) &&
+            (!fromCheckpoint ||
+             loadCheckpoint(checkpointPath, recovered, recoveredRegistry, replayFrom));
+        bool replayed = loaded && recoveredLog.open(logDir, ChainLog::Options(), replayFrom,
+            [&](uint8_t type, const uint8_t* payload, size_t size) {
+                if (type == BlockRecord) {
+                    return recovered.restoreBlock(payload, size, recoveredLog.replayPosition());
+                }
+                if (type == RegistryDeltaRecord) {
+                    LogPosition end = recoveredLog.replayPosition();
+                    end.offset += ChainLog::frameBytes(size);
+                    return recoveredRegistry.restoreDelta(payload, size, end);
+                }
+                return type == VotedRecord && recoveredRegistry.restoreVoted(payload, size);
+            });
+        result = Result{fromCheckpoint ? "recover_checkpoint" : "recover_full_replay",
+                        recovered.size(), secondsSince(start), -1, -1, peakRssKb()};
+        results.push_back(result);
+        if (!replayed || recovered.size() != recoveredSize ||
+            recovered.getLastHash() != recoveredTip) {
+            cerr << "Error: " << result.name << " did not restore the chain" << endl;
+            return 1;
+        }
+    }
+
+    if (config.out.empty()) {
+        printJson(cout, config, results, footprint);
+        return 0;
+    }
+    printJson(jsonFile, config, results, footprint);
+    jsonFile.close();
+    if (!jsonFile) {
+        cerr << "Error: Could not write " << config.out << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,261 @@
+/*
+
+Load test for the kiosk front end (voting --kiosks). Opens many kiosk
+sessions at once, drives each through the prompt sequence with voter IDs
+taken from a registry file, and reports the per-vote latency, from sending
+the candidate choice to receiving the receipt, and the overall throughput.
+
+    g++ -std=c++17 -O2 -pthread bench/kiosk_load.cpp -o kiosk_load
+    ./voting --kiosks unix:/tmp/kiosks.sock &
+    ./kiosk_load --connect unix:/tmp/kiosks.sock --registry voter_registry.csv \
+        --sessions 10000
+
+Each voter ID is used once, so repeated runs against the same election
+need --first-voter to move on to voters who have not voted yet.
+
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "../replication.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+struct Config {
+    string address;
+    string registryPath = "voter_registry.csv";
+    uint64_t sessions = 10000;
+    uint64_t votesPerSession = 1;
+    uint64_t firstVoter = 0;
+    uint32_t candidates = 3;
+    uint64_t seed = 1;
+};
+
+// Where a session is in the prompt sequence
+enum Phase { AwaitingIDPrompt, AwaitingBallot, AwaitingReceipt, Finished };
+
+struct Session {
+    int fd = -1;
+    Phase phase = AwaitingIDPrompt;
+    string received;
+    uint64_t votesLeft = 0;
+    Clock::time_point choiceSent;
+};
+
+static bool parseArguments(int argc, char* argv[], Config& config) {
+    for (int i = 1; i < argc; ++i) {
+        string option = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        string value = argv[++i];
+        if (option == "--connect") {
+            config.address = value;
+        } else if (option == "--registry") {
+            config.registryPath = value;
+        } else if (option == "--sessions") {
+            config.sessions = max<uint64_t>(1, strtoull(value.c_str(), nullptr, 10));
+        } else if (option == "--votes-per-session") {
+            config.votesPerSession = max<uint64_t>(1, strtoull(value.c_str(), nullptr, 10));
+        } else if (option == "--first-voter") {
+            config.firstVoter = strtoull(value.c_str(), nullptr, 10);
+        } else if (option == "--candidates") {
+            config.candidates = max<uint32_t>(1, strtoul(value.c_str(), nullptr, 10));
+        } else if (option == "--seed") {
+            config.seed = strtoull(value.c_str(), nullptr, 10);
+        } else {
+            return false;
+        }
+    }
+    return !config.address.empty();
+}
+
+// Voter IDs from the registry's first column, skipping the header
+static vector<string> readVoterIDs(const string& path) {
+    vector<string> ids;
+    ifstream file(path);
+    string line;
+    getline(file, line);
+    while (getline(file, line)) {
+        string id = line.substr(0, line.find(','));
+        if (!id.empty() && all_of(id.begin(), id.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+            ids.push_back(id);
+        }
+    }
+    return ids;
+}
+
+static bool sendLine(const Session& session, const string& text) {
+    string line = text + "\n";
+    return send(session.fd, line.data(), line.size(), MSG_NOSIGNAL) == ssize_t(line.size());
+}
+
+static double percentile(vector<double>& sorted, double fraction) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[min(sorted.size() - 1, static_cast<size_t>(sorted.size() * fraction))];
+}
+
+int main(int argc, char* argv[]) {
+    Config config;
+    if (!parseArguments(argc, argv, config)) {
+        cerr << "Usage: " << argv[0] << " --connect ADDRESS [--registry FILE] [--sessions N]"
+             << " [--votes-per-session N] [--first-voter N] [--candidates N] [--seed N]" << endl;
+        return 1;
+    }
+    vector<string> voterIDs = readVoterIDs(config.registryPath);
+    uint64_t needed = config.sessions * config.votesPerSession;
+    if (voterIDs.size() < config.firstVoter + needed) {
+        cerr << "Error: " << config.registryPath << " has " << voterIDs.size()
+             << " voters; the run needs " << config.firstVoter + needed << endl;
+        return 1;
+    }
+    uint64_t nextVoter = config.firstVoter;
+
+    // Every session holds a socket
+    struct rlimit files;
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0) {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+    sockaddr_storage storage;
+    socklen_t length;
+    if (!replication::parseAddress(config.address, storage, length)) {
+        cerr << "Error: Bad address " << config.address << endl;
+        return 1;
+    }
+
+    int epoll = epoll_create1(0);
+    vector<Session> sessions(config.sessions);
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < sessions.size(); ++i) {
+        Session& session = sessions[i];
+        session.votesLeft = config.votesPerSession;
+        session.fd = socket(storage.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (session.fd < 0 ||
+            connect(session.fd, reinterpret_cast<sockaddr*>(&storage), length) != 0) {
+            cerr << "Error: Could not open session " << i << ": " << strerror(errno) << endl;
+            return 1;
+        }
+        replication::disableNagle(session.fd, storage);
+        fcntl(session.fd, F_SETFL, fcntl(session.fd, F_GETFL) | O_NONBLOCK);
+        epoll_event event = {};
+        event.events = EPOLLIN | EPOLLET;
+        event.data.u64 = i;
+        epoll_ctl(epoll, EPOLL_CTL_ADD, session.fd, &event);
+    }
+    double connectSeconds = chrono::duration<double>(Clock::now() - start).count();
+
+    mt19937_64 random(config.seed);
+    vector<double> latencies;
+    latencies.reserve(needed);
+    uint64_t rejected = 0, failed = 0, finished = 0;
+    start = Clock::now();
+    vector<epoll_event> events(1024);
+    while (finished < sessions.size()) {
+        int count = epoll_wait(epoll, events.data(), static_cast<int>(events.size()), 10000);
+        if (count <= 0) {
+            cerr << "Error: No progress for 10 s with " << sessions.size() - finished
+                 << " sessions open" << endl;
+            return 1;
+        }
+        for (int e = 0; e < count; ++e) {
+            Session& session = sessions[events[e].data.u64];
+            if (session.phase == Finished) {
+                continue;
+            }
+            char buffer[4096];
+            ssize_t n;
+            bool closed = false;
+            while ((n = recv(session.fd, buffer, sizeof(buffer), 0)) != 0) {
+                if (n < 0) {
+                    closed = errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR;
+                    if (errno != EINTR) {
+                        break;
+                    }
+                    continue;
+                }
+                session.received.append(buffer, static_cast<size_t>(n));
+            }
+            closed = closed || n == 0;
+
+            // Step through every prompt that has arrived in full
+            bool progressed = true;
+            while (progressed && session.phase != Finished) {
+                progressed = false;
+                size_t at;
+                if (session.phase == AwaitingIDPrompt &&
+                    (at = session.received.find("cast a vote: ")) != string::npos) {
+                    session.received.erase(0, at + 13);
+                    if (nextVoter == voterIDs.size() || !sendLine(session, voterIDs[nextVoter++])) {
+                        break;
+                    }
+                    session.phase = AwaitingBallot;
+                    progressed = true;
+                } else if (session.phase == AwaitingBallot &&
+                           (at = session.received.find("-> ")) != string::npos) {
+                    session.received.erase(0, at + 3);
+                    session.choiceSent = Clock::now();
+                    if (!sendLine(session, to_string(1 + random() % config.candidates))) {
+                        break;
+                    }
+                    session.phase = AwaitingReceipt;
+                    progressed = true;
+                } else if (session.phase != AwaitingIDPrompt &&
+                           ((at = session.received.find("not found.\n")) != string::npos ||
+                            (at = session.received.find("already voted.\n")) != string::npos)) {
+                    session.received.erase(0, session.received.find('\n', at) + 1);
+                    ++rejected;
+                    session.phase = AwaitingIDPrompt;
+                    progressed = true;
+                } else if (session.phase == AwaitingReceipt &&
+                           (at = session.received.find("PRESS '0'\n")) != string::npos) {
+                    latencies.push_back(
+                        chrono::duration<double, milli>(Clock::now() - session.choiceSent).count());
+                    session.received.erase(0, at + 10);
+                    bool more = --session.votesLeft > 0;
+                    if (!sendLine(session, more ? "1" : "0")) {
+                        break;
+                    }
+                    session.phase = more ? AwaitingIDPrompt : Finished;
+                    progressed = true;
+                }
+            }
+            if (session.phase == Finished || closed) {
+                if (session.phase != Finished) {
+                    ++failed;
+                    session.phase = Finished;
+                }
+                ::close(session.fd);
+                ++finished;
+            }
+        }
+    }
+    double seconds = chrono::duration<double>(Clock::now() - start).count();
+
+    sort(latencies.begin(), latencies.end());
+    cout << "Sessions: " << sessions.size() << " (connected in " << connectSeconds << " s)\n"
+         << "Votes: " << latencies.size() << " in " << seconds << " s ("
+         << static_cast<uint64_t>(seconds > 0 ? latencies.size() / seconds : 0) << " votes/s)\n"
+         << "Vote latency: p50 " << percentile(latencies, 0.50) << " ms, p99 "
+         << percentile(latencies, 0.99) << " ms, max "
+         << (latencies.empty() ? 0 : latencies.back()) << " ms\n"
+         << "Rejected voter IDs: " << rejected << ", sessions dropped: " << failed << endl;
+    return failed == 0 ? 0 : 1;
+}
@@ -8,231 +8,329 @@ subsequent blocks, making it difficult to tamper with individual votes.
 */
 
 #include <iostream>
-#include <fstream>
-#include <sstream>
 #include <string>
-#include <vector>
-#include <unordered_map>
 #include <algorithm>
-#include "picosha2.h"
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "hash256.h"
+#include "chain_log.h"
+#include "tally.h"
+#include "voter_registry.h"
+#include "blockchain.h"
+#include "recovery.h"
+#include "batch_importer.h"
+#include "chain_archive.h"
+#include "sharded_election.h"
+#include "replication.h"
+#include "registry_delta_watcher.h"
+#ifdef __cpp_impl_coroutine
+#include "kiosk_server.h"
+#endif
+#include "metrics.h"
 
 using namespace std;
-using namespace picosha2;
-
-// Voter class to handle registration and verification
-class Voter {
-public:
-    string voterID;
-    string name;
-
-    // Default constructor
-    Voter() : voterID(""), name("") {}
-
-    // Parameterized constructor for registering new voters
-    Voter(const string& id, const string& name) : voterID(id), name(name) {}
-};
-
-// VoterRegistry class to manage voter registration and verification
-class VoterRegistry {
-private:
-    unordered_map<string, Voter> voterMap; // Stores voter ID and Voter object
-    unordered_map<string, bool> hasVoted;  // Tracks if a voter has already voted
-
-public:
-    // Load voter registry from a specified CSV file
-    void loadVoterRegistry(const string& filePath) {
-        ifstream file(filePath);
-        if (!file.is_open()) {
-            cerr << "Error: Could not open voter registry file: " << filePath << endl;
-            exit(1);  // Exit the program if the file cannot be opened
-        }
 
-        string line, header;
-        getline(file, header); // Skip the header line
-        while (getline(file, line)) {
-            stringstream ss(line);
-            string voterID, firstName, lastName;
-            getline(ss, voterID, ',');
-            getline(ss, firstName, ',');
-            getline(ss, lastName, ',');
-
-            string fullName = firstName + " " + lastName;
-            voterMap[voterID] = Voter(voterID, fullName);
-            hasVoted[voterID] = false; // Initialize as not voted
-        }
-        file.close();
-        cout << "Voter registry loaded successfully from " << filePath << endl;
-    }
+#ifdef __cpp_impl_coroutine
+// Set by SIGINT or SIGTERM while serving kiosks
+static volatile sig_atomic_t stopRequested = 0;
 
-    // Verify if a voter is registered and hasn't voted yet
-    bool verifyVoter(const string& id) {
-        if (voterMap.find(id) == voterMap.end()) {
-            cout << "Voter ID not found." << endl;
-            return false;
-        }
-        if (hasVoted[id]) {
-            cout << "Voter has already voted." << endl;
-            return false;
+static void onStopSignal(int) {
+    stopRequested = 1;
+}
+#endif
+
+// Main function. With --batch FILE (or - for stdin) the voterID,choice
+// records are imported in bulk instead of running the interactive loop;
+// --votes-per-block N packs them into batch blocks of up to N votes.
+// Adding --shards N splits a batch import over N chains under shards/,
+// routing voters by --shard-by county, state or precinct (ZIP code).
+// --leader ADDRESS ships the chain log to followers started with
+// --follow ADDRESS, which keep a replica in their own chainlog/ until the
+// leader goes away; addresses are unix:PATH or HOST:PORT.
+// --registry-deltas PATH (default registry_delta.csv) names the file polled
+// for add/update/remove rows applied to the registry while voting goes on;
+// sharded imports and followers do not poll it.
+// --export FILE writes the blocks in chainlog/ to a binary archive, zstd
+// compressed with --compress in builds with -DVOTING_ZSTD; --import FILE
+// rebuilds chainlog/ from one, verifying every block. An imported chain
+// has no voted marks, so later starts only show it and its result.
+// Builds with -std=c++20 also take --kiosks ADDRESS, which serves the
+// prompts to many kiosks over sockets on --kiosk-threads N threads until
+// SIGINT or SIGTERM, committing their votes in blocks of --votes-per-block.
+// Builds with -DVOTING_METRICS also take --metrics FILE, which writes stage
+// latencies to FILE on SIGUSR1, on exit and every --metrics-interval
+// seconds.
+int main(int argc, char* argv[]) {
+    string batchInput;
+    size_t batchVotesPerBlock = 256;
+    string metricsPath;
+    unsigned metricsInterval = 0;
+    size_t shardCount = 0;
+    ShardedElection::RouteBy shardBy = ShardedElection::ByCounty;
+    string leaderAddress;
+    string followAddress;
+    string registryDeltaPath = "registry_delta.csv";
+    string exportPath;
+    string importPath;
+    bool compressExport = false;
+    string kioskAddress;
+    unsigned kioskThreads = 0;
+    for (int i = 1; i < argc; ++i) {
+        string option = argv[i];
+        if (option == "--batch" && i + 1 < argc) {
+            batchInput = argv[++i];
+        } else if (option == "--votes-per-block" && i + 1 < argc) {
+            batchVotesPerBlock = max<size_t>(1, strtoull(argv[++i], nullptr, 10));
+        } else if (option == "--metrics" && i + 1 < argc) {
+            metricsPath = argv[++i];
+        } else if (option == "--metrics-interval" && i + 1 < argc) {
+            metricsInterval = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+        } else if (option == "--shards" && i + 1 < argc) {
+            shardCount = strtoull(argv[++i], nullptr, 10);
+            if (shardCount < 1 || shardCount > ShardedElection::kMaxShards) {
+                cerr << "Error: --shards takes 1 to " << ShardedElection::kMaxShards << endl;
+                return 1;
+            }
+        } else if (option == "--leader" && i + 1 < argc) {
+            leaderAddress = argv[++i];
+        } else if (option == "--follow" && i + 1 < argc) {
+            followAddress = argv[++i];
+        } else if (option == "--registry-deltas" && i + 1 < argc) {
+            registryDeltaPath = argv[++i];
+        } else if (option == "--export" && i + 1 < argc) {
+            exportPath = argv[++i];
+        } else if (option == "--import" && i + 1 < argc) {
+            importPath = argv[++i];
+        } else if (option == "--compress") {
+            compressExport = true;
+        } else if (option == "--kiosks" && i + 1 < argc) {
+            kioskAddress = argv[++i];
+        } else if (option == "--kiosk-threads" && i + 1 < argc) {
+            kioskThreads = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+        } else if (option == "--shard-by" && i + 1 < argc &&
+                   ShardedElection::parseRouteBy(argv[i + 1], shardBy)) {
+            ++i;
+        } else {
+            cerr << "Usage: " << argv[0] << " [--batch FILE|-] [--votes-per-block N]"
+                 << " [--shards N] [--shard-by county|state|precinct]"
+                 << " [--leader ADDRESS | --follow ADDRESS] [--registry-deltas PATH]"
+                 << " [--export FILE [--compress] | --import FILE]"
+                 << " [--kiosks ADDRESS [--kiosk-threads N]]"
+                 << " [--metrics FILE] [--metrics-interval SECONDS]" << endl;
+            return 1;
         }
-        return true;
     }
 
-    // Mark voter as having voted
-    void markAsVoted(const string& id) {
-        if (voterMap.find(id) != voterMap.end()) {
-            hasVoted[id] = true;
-        }
+#ifdef VOTING_METRICS
+    unique_ptr<metrics::Dumper> metricsDumper;
+    if (!metricsPath.empty()) {
+        metricsDumper.reset(new metrics::Dumper(metricsPath, metricsInterval));
     }
-};
-
-// Block class represents each node in the blockchain
-class Block {
-public:
-    string data;
-    string prevHash;
-    string hash;
-    Block* next;
-
-    // Constructor to initialize each block with data and hash of the previous block
-    Block(const string& data, const string& prevHash) : data(data), prevHash(prevHash), next(nullptr) {
-        calculateHash();
+#else
+    if (!metricsPath.empty()) {
+        cerr << "Warning: built without VOTING_METRICS; --metrics is ignored" << endl;
     }
-
-    // Calculate the hash for the block to ensure immutability
-    void calculateHash() {
-        stringstream concat;
-        concat << prevHash << data;
-        hash = hash256_hex_string(concat.str());
+    (void)metricsInterval;
+#endif
+#ifndef __cpp_impl_coroutine
+    if (!kioskAddress.empty()) {
+        cerr << "Error: built without C++20 coroutines; --kiosks needs -std=c++20" << endl;
+        return 1;
+    }
+    (void)kioskThreads;
+#endif
+
+    if (!exportPath.empty() || !importPath.empty()) {
+        auto start = chrono::steady_clock::now();
+        uint64_t blocks;
+        bool ok = !exportPath.empty()
+            ? exportChainLog("chainlog", exportPath, compressExport, blocks)
+            : importArchive(importPath, "chainlog", blocks);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << (exportPath.empty() ? "Imported " : "Exported ") << blocks << " blocks in "
+             << seconds << " s" << endl;
+        return ok ? 0 : 1;
     }
-};
 
-class Blockchain {
-private:
-    Block* head; // Head of the blockchain
+    // The ballot comes from candidates.txt, one name per line, when present
+    CandidateList candidates;
+    candidates.load("candidates.txt");
 
-public:
-    Blockchain() : head(nullptr) {}
+    Blockchain blockchain(candidates);
+    VoterRegistry voterRegistry;
 
-    // Adds the genesis block to the blockchain
-    void addGenesisBlock() {
-        if (head == nullptr) {
-            head = new Block("0", "0");  // Genesis block with arbitrary data
-            saveToFile(head->hash);
+    // Load the voter registry from the CSV file
+    voterRegistry.loadVoterRegistry("voter_registry.csv");
+
+    if (shardCount > 0) {
+        if (batchInput.empty()) {
+            cerr << "Error: --shards needs --batch" << endl;
+            return 1;
+        }
+        ShardedElection election(voterRegistry, candidates, shardCount, shardBy,
+                                 batchVotesPerBlock, "shards");
+        if (!election.open()) {
+            return 1;
+        }
+        BatchImporter importer(voterRegistry, election);
+        bool imported = importer.run(batchInput, "rejected.csv");
+        vector<uint64_t> votes = election.votesPerShard();
+        for (size_t i = 0; i < votes.size(); ++i) {
+            cout << "Shard " << i << ": " << votes[i] << " votes, "
+                 << election.shardChain(i).size() << " blocks" << endl;
+        }
+        TallySnapshot total = election.currentTally();
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            cout << candidates.name(i) << ": " << total.counts[i] << endl;
         }
+        cout << "NOTA: " << total.counts[candidates.notaBucket()] << endl;
+        cout << "Root chain: " << election.rootChain().size() << " blocks, tip "
+             << toHex(election.rootChain().getLastHash()) << endl;
+        return imported && election.verify() ? 0 : 1;
     }
 
-    // Adds a new block (vote) to the blockchain
-    void addBlock(const string& data) {
-        if (head != nullptr) {
-            Block* last = head;
-            while (last->next != nullptr) {
-                last = last->next;
-            }
-            Block* newBlock = new Block(data, last->hash);
-            last->next = newBlock;
-            saveToFile(newBlock->hash);
-        }
+    // Lookups by height, hash and receipt are served from indexes kept next
+    // to the log
+    if (!blockchain.openIndex("chainlog")) {
+        cerr << "Error: Could not open the chain index in chainlog/" << endl;
+        return 1;
     }
 
-    // Retrieves the hash of the last block
-    string getLastHash() const {
-        if (head == nullptr) {
-            return "f1534392279bddbf9d43dde8701cb5be14b82f76ec6607bf8d6ad557f60f304e";
-        } else {
-            Block* last = head;
-            while (last->next != nullptr) {
-                last = last->next;
+    // Start from the latest checkpoint, if there is one, so only the log
+    // written after it has to be replayed
+    const string checkpointPath = "chainlog/checkpoint";
+    const uint64_t checkpointEveryBlocks = 1000;
+    LogPosition replayFrom;
+    bool fromCheckpoint = loadCheckpoint(checkpointPath, blockchain, voterRegistry, replayFrom);
+
+    // Rebuild the chain and the voted flags from the durable log. Declared
+    // after the blockchain and registry so it is closed before they go away.
+    ChainLog chainLog;
+    uint64_t replayedVotedRecords = 0;
+    bool replayed = chainLog.open("chainlog", ChainLog::Options(), replayFrom,
+        [&](uint8_t type, const uint8_t* payload, size_t size) {
+            if (type == BlockRecord) {
+                return blockchain.restoreBlock(payload, size, chainLog.replayPosition());
             }
-            return last->hash;
+            replayedVotedRecords += type == VotedRecord;
+            if (type == RegistryDeltaRecord) {
+                LogPosition end = chainLog.replayPosition();
+                end.offset += ChainLog::frameBytes(size);
+                return voterRegistry.restoreDelta(payload, size, end);
+            }
+            return type == VotedRecord && voterRegistry.restoreVoted(payload, size);
+        });
+    if (!replayed) {
+        cerr << "Error: Could not open or replay the chain log in chainlog/" << endl;
+        return 1;
+    }
+    blockchain.attachLog(chainLog);
+
+    // Every vote cast here logs its voter's mark first, so votes without a
+    // single mark came from an archive (--import). The voters behind them
+    // are unknown, so such a chain is only shown, never voted on.
+    bool auditOnly = !fromCheckpoint && blockchain.size() > 1 && replayedVotedRecords == 0;
+    if (auditOnly) {
+        cerr << "chainlog/ holds votes but no voted marks, as a chain imported from an archive"
+             << " does; it can be shown but not voted on" << endl;
+        if (!followAddress.empty() || !leaderAddress.empty() || !batchInput.empty() ||
+            !kioskAddress.empty()) {
+            return 1;
         }
     }
 
-    // Verifies blockchain integrity by comparing the last block's hash 
-    bool verify() const {
-        string lastHash = getLastHash();
-        string fileHash;
-        ifstream hashFile("lasthash.txt");
-        if (hashFile.is_open()) {
-            getline(hashFile, fileHash);
-            hashFile.close();
-            return (fileHash == lastHash);
+    if (!followAddress.empty()) {
+        // A replica takes every block and voted record, genesis included,
+        // from the leader's log
+        replication::Follower follower(blockchain, chainLog, &voterRegistry,
+                                       "chainlog/replica.pos");
+        if (!follower.connect(followAddress)) {
+            return 1;
         }
-        return false;
+        uint64_t before = blockchain.size();
+        bool followed = follower.run();
+        cout << "Replicated " << blockchain.size() - before << " blocks; the replica holds "
+             << blockchain.size() << " blocks" << endl;
+        if (blockchain.size() > 0 && !saveCheckpoint(checkpointPath, blockchain, voterRegistry)) {
+            cerr << "Unable to write checkpoint " << checkpointPath << endl;
+        }
+        return followed ? 0 : 1;
     }
+    voterRegistry.attachLog(chainLog);
 
-    // Prints the blockchain to demonstrate reading all blocks 
-    void print() const {
-        Block* current = head;
-        while (current != nullptr) {
-            cout << current->data << "->";
-            current = current->next;
+    blockchain.addGenesisBlock();
+    if (!blockchain.sync()) {
+        cerr << "Error: Could not write the chain log" << endl;
+        return 1;
+    }
+    uint64_t lastCheckpointHeight = blockchain.firstHeight();
+
+    // Declared after the log so it stops shipping before the log closes
+    unique_ptr<replication::Leader> leader;
+    if (!leaderAddress.empty()) {
+        leader.reset(new replication::Leader(chainLog));
+        if (!leader->listen(leaderAddress)) {
+            return 1;
         }
-        cout << "END" << endl;
     }
 
-    // Tallies votes and displays the winner
-    void checkWinner() const {
-        int count1 = 0, count2 = 0, count3 = 0;
-        Block* current = head;
-        while (current != nullptr) {
-            if (current->data == "1") {
-                count1++;
-            } else if (current->data == "2") {
-                count2++;
-            } else if (current->data == "3") {
-                count3++;
-            }
-            current = current->next;
+    // Registry changes are picked up from here on; stopped before the log
+    // closes
+    RegistryDeltaWatcher deltaWatcher(voterRegistry, registryDeltaPath);
+
+#ifdef __cpp_impl_coroutine
+    if (!kioskAddress.empty()) {
+        KioskServer::Options kioskOptions;
+        kioskOptions.threads = kioskThreads;
+        kioskOptions.votesPerBlock = batchVotesPerBlock;
+        kioskOptions.checkpointPath = checkpointPath;
+        kioskOptions.checkpointEveryBlocks = checkpointEveryBlocks;
+        KioskServer server(voterRegistry, blockchain, kioskOptions);
+        if (!server.start(kioskAddress)) {
+            return 1;
         }
-
-        vector<pair<int, string>> candidates = {
-            {count1, "RAHUL SINGH"},
-            {count2, "KOMAL GUPTA"},
-            {count3, "ABHISHEK TOMAR"}
-        };
-
-        sort(candidates.rbegin(), candidates.rend());
-
-        if (candidates.empty() || candidates[0].first == 0) {
-            cout << "No one is the winner" << endl;
-        } else {
-            cout << "Winner is: " << candidates[0].second << endl;
+        signal(SIGINT, onStopSignal);
+        signal(SIGTERM, onStopSignal);
+        cout << "Serving kiosks on " << kioskAddress << endl;
+        while (!stopRequested) {
+            this_thread::sleep_for(chrono::milliseconds(100));
         }
-    }
-
-    // Save the hash of the latest block to a file for verification 
-    void saveToFile(const string& hash) const {
-        ofstream hashFile("lasthash.txt");
-        if (hashFile.is_open()) {
-            hashFile << hash;
-            hashFile.close();
-        } else {
-            cout << "Unable to save hash to file." << endl;
+        server.stop();
+        cout << "Committed " << server.votesCommitted() << " votes from kiosks" << endl;
+        if (blockchain.size() - 1 > lastCheckpointHeight &&
+            !saveCheckpoint(checkpointPath, blockchain, voterRegistry)) {
+            cerr << "Unable to write checkpoint " << checkpointPath << endl;
         }
+        return 0;
     }
-
-    // Destructor to clean up dynamically allocated blocks
-    ~Blockchain() {
-        Block* current = head;
-        while (current != nullptr) {
-            Block* temp = current;
-            current = current->next;
-            delete temp;
+#endif
+
+    if (!batchInput.empty()) {
+        BatchImporter importer(voterRegistry, blockchain, batchVotesPerBlock, checkpointPath);
+        bool imported = importer.run(batchInput, "rejected.csv");
+        if (blockchain.size() - 1 > lastCheckpointHeight &&
+            !saveCheckpoint(checkpointPath, blockchain, voterRegistry)) {
+            cerr << "Unable to write checkpoint " << checkpointPath << endl;
         }
+        if (leader) {
+            // Give connected followers a chance to catch up before exiting
+            size_t connected = 0;
+            for (const replication::Leader::FollowerStatus& status : leader->status()) {
+                connected += status.connected ? 1 : 0;
+            }
+            if (!leader->waitForAcks(connected, blockchain.size(), chrono::seconds(10))) {
+                cerr << "Warning: not every follower has caught up" << endl;
+            }
+        }
+        return imported ? 0 : 1;
     }
-};
-
-// Main function
-int main() {
-    Blockchain blockchain;
-    VoterRegistry voterRegistry;
-
-    // Load the voter registry from the CSV file
-    voterRegistry.loadVoterRegistry("voter_registry.csv");
 
-    blockchain.addGenesisBlock();
-
-    int exit = 5;
+    int exit = auditOnly ? 0 : 5;
     while (exit != 0) {
         if (!blockchain.verify()) {
             cout << "Blockchain is compromised" << endl;
@@ -250,24 +348,50 @@ int main() {
         }
 
         cout << "\nChoose the candidate to vote:\n";
-        cout << "  1. RAHUL SINGH\n";
-        cout << "  2. KOMAL GUPTA\n";
-        cout << "  3. ABHISHEK TOMAR\n";
-        cout << "  4. Any other number to choose NOTA\n";
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            cout << "  " << i + 1 << ". " << candidates.name(i) << "\n";
+        }
+        cout << "  " << candidates.size() + 1 << ". Any other number to choose NOTA\n";
         cout << "-> ";
 
         string input;
         getline(cin, input);
-        blockchain.addBlock(input);
 
-        // Mark the voter as having voted
-        voterRegistry.markAsVoted(voterID);
+        // Claim the voter; the mark is logged ahead of the vote so a crash
+        // can never let the same voter vote twice. The registry may have
+        // changed since the check above, so only a successful claim votes.
+        VoterRegistry::VoteStatus claimed = voterRegistry.claimVote(voterID);
+        if (claimed != VoterRegistry::Accepted) {
+            cout << (claimed == VoterRegistry::NotRegistered ? "Voter ID not found."
+                                                             : "Voter has already voted.")
+                 << endl;
+            continue;
+        }
+        Hash256 receipt = blockchain.addBlock(input);
+        if (!blockchain.sync()) {
+            cout << "Unable to save the vote." << endl;
+            return 1;
+        }
+        cout << "\nYour vote receipt: " << toHex(receipt) << "\n";
+
+        if (blockchain.size() > lastCheckpointHeight + checkpointEveryBlocks) {
+            lastCheckpointHeight = blockchain.size() - 1;
+            if (!saveCheckpoint(checkpointPath, blockchain, voterRegistry)) {
+                cerr << "Unable to write checkpoint " << checkpointPath << endl;
+            }
+        }
 
         cout << "\nTO CONTINUE PRESS ANY NUMBER\n\nTO EXIT PRESS '0'\n";
         cin >> exit;
         cin.ignore();
     }
 
+    // Checkpoint on the way out so the next start replays nothing
+    if (!auditOnly && blockchain.size() - 1 > lastCheckpointHeight &&
+        !saveCheckpoint(checkpointPath, blockchain, voterRegistry)) {
+        cerr << "Unable to write checkpoint " << checkpointPath << endl;
+    }
+
     // Display the order of votes for demonstration 
     cout << "THE ORDER OF THE VOTES IS: ";
     blockchain.print();
@@ -276,6 +400,17 @@ int main() {
     cout << "\nPRESS 1 TO CHECK THE WINNER OR ANY NUMBER TO EXIT: ";
     cin >> temp;
     if (temp == 1) {
+        // Audit every block and recount the ballots before trusting the tally
+        size_t badHeight;
+        TallySnapshot recounted;
+        if (!blockchain.recount(0, true, recounted, badHeight)) {
+            cout << "Blockchain is compromised at block " << badHeight << endl;
+            return 0;
+        }
+        if (recounted.counts != blockchain.tallyAt(recounted.height).counts) {
+            cout << "Running tally does not match the recount" << endl;
+            return 0;
+        }
         blockchain.checkWinner();
     }
 
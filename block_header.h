@@ -0,0 +1,98 @@
+#ifndef BLOCK_HEADER_H
+#define BLOCK_HEADER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include "picosha2.h"
+#include "hash256.h"
+
+// Fixed-layout block header, hashed as
+//   domain[64] | u32 version | u64 height | u64 timestamp | prevHash | payloadHash
+// with integers big endian: 148 bytes in all. The domain names the chain
+// (election ID and format) and is the same for every block, so it fills
+// exactly the first SHA-256 block and its compression can be done once.
+struct BlockHeader {
+    static constexpr std::size_t kDomainBytes = 64;
+    static constexpr std::size_t kFieldBytes = 4 + 8 + 8 + 32 + 32;
+
+    uint32_t version = 1;
+    uint64_t height = 0;
+    uint64_t timestamp = 0;
+    Hash256 prevHash{};
+    Hash256 payloadHash{};  // Hash of the vote data, or a batch's Merkle root
+
+    // Writes the fields after the domain, as hashed
+    void encodeFields(uint8_t* out) const {
+        putBigEndian(out, version, 4);
+        putBigEndian(out + 4, height, 8);
+        putBigEndian(out + 12, timestamp, 8);
+        std::memcpy(out + 20, prevHash.data(), 32);
+        std::memcpy(out + 52, payloadHash.data(), 32);
+    }
+
+private:
+    static void putBigEndian(uint8_t* out, uint64_t value, std::size_t bytes) {
+        for (std::size_t i = 0; i < bytes; ++i) {
+            out[i] = static_cast<uint8_t>(value >> (8 * (bytes - 1 - i)));
+        }
+    }
+};
+
+// Hashes the headers of one chain. The domain is compressed once, when the
+// hasher is built; each header then starts from a copy of that midstate and
+// only compresses its changing fields and the padding, two compression
+// calls instead of three.
+class BlockHeaderHasher {
+public:
+    // The domain is zero padded or truncated to 64 bytes
+    explicit BlockHeaderHasher(std::string_view domain) {
+        std::fill(paddedDomain, paddedDomain + BlockHeader::kDomainBytes, uint8_t(0));
+        std::memcpy(paddedDomain, domain.data(),
+                    std::min(domain.size(), BlockHeader::kDomainBytes));
+        picosha2::hash256_one_by_one prefix;
+        prefix.process(paddedDomain, paddedDomain + BlockHeader::kDomainBytes);
+        midstate = prefix.save_midstate();
+    }
+
+    // Hash of the header, reusing the domain's midstate; compressions, if
+    // given, receives the compression calls this hash made
+    Hash256 hash(const BlockHeader& header, std::size_t* compressions = nullptr) const {
+        uint8_t fields[BlockHeader::kFieldBytes];
+        header.encodeFields(fields);
+        picosha2::hash256_one_by_one hasher(midstate);
+        hasher.process(fields, fields + sizeof(fields));
+        hasher.finish();
+        return digestOf(hasher, midstate.compressions, compressions);
+    }
+
+    // The same hash computed over the whole header from scratch, for
+    // checking the fast path and comparing against it
+    Hash256 hashFromScratch(const BlockHeader& header, std::size_t* compressions = nullptr) const {
+        uint8_t fields[BlockHeader::kFieldBytes];
+        header.encodeFields(fields);
+        picosha2::hash256_one_by_one hasher;
+        hasher.process(paddedDomain, paddedDomain + BlockHeader::kDomainBytes);
+        hasher.process(fields, fields + sizeof(fields));
+        hasher.finish();
+        return digestOf(hasher, 0, compressions);
+    }
+
+private:
+    static Hash256 digestOf(const picosha2::hash256_one_by_one& hasher, std::size_t before,
+                            std::size_t* compressions) {
+        if (compressions != nullptr) {
+            *compressions = hasher.compressions() - before;
+        }
+        Hash256 digest;
+        hasher.get_hash_bytes(digest.begin(), digest.end());
+        return digest;
+    }
+
+    uint8_t paddedDomain[BlockHeader::kDomainBytes];
+    picosha2::hash256_midstate midstate;
+};
+
+#endif  // BLOCK_HEADER_H
@@ -0,0 +1,125 @@
+#ifndef BLOCK_STORE_H
+#define BLOCK_STORE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "arena.h"
+
+// Append-only, index-addressable storage for blockchain blocks.
+//
+// Blocks live in fixed-size chunks that are never reallocated, so a block's
+// address stays valid for the lifetime of the store. Appending, reading the
+// tail and looking up a block by height are all constant time.
+//
+// One thread may append while others read: an element is published only
+// after it is fully constructed, and the chunk directory is replaced rather
+// than resized, so a reader that checked height < size() can always reach
+// the element. Older directories are kept until the store is destroyed.
+//
+// Chunks are carved from an Arena, so growing the store is cheap and
+// destroying it unmaps a few large regions; elements that are trivially
+// destructible are not visited at all.
+template <typename T, std::size_t ChunkBits = 12>
+class BlockStore {
+public:
+    static constexpr std::size_t kChunkSize = std::size_t(1) << ChunkBits;
+
+    BlockStore() : directory(nullptr), directoryCapacity(0), chunkCount(0), count(0) {}
+
+    BlockStore(const BlockStore&) = delete;
+    BlockStore& operator=(const BlockStore&) = delete;
+
+    ~BlockStore() { clear(); }
+
+    // Constructs a new element at the end of the store and returns it
+    template <typename... Args>
+    T& emplace_back(Args&&... args) {
+        std::size_t size = count.load(std::memory_order_relaxed);
+        std::size_t offset = size & (kChunkSize - 1);
+        if (offset == 0 && (size >> ChunkBits) == chunkCount) {
+            addChunk();
+        }
+        Slot* chunk = directory.load(std::memory_order_relaxed)[size >> ChunkBits];
+        T* slot = reinterpret_cast<T*>(&chunk[offset]);
+        new (slot) T(std::forward<Args>(args)...);
+        count.store(size + 1, std::memory_order_release);
+        return *slot;
+    }
+
+    // Element at the given height; the height must be below size()
+    T& operator[](std::size_t height) {
+        Slot* chunk = directory.load(std::memory_order_acquire)[height >> ChunkBits];
+        return *reinterpret_cast<T*>(&chunk[height & (kChunkSize - 1)]);
+    }
+
+    const T& operator[](std::size_t height) const {
+        Slot* chunk = directory.load(std::memory_order_acquire)[height >> ChunkBits];
+        return *reinterpret_cast<const T*>(&chunk[height & (kChunkSize - 1)]);
+    }
+
+    // Most recently appended element; the store must not be empty
+    T& back() { return (*this)[size() - 1]; }
+    const T& back() const { return (*this)[size() - 1]; }
+
+    std::size_t size() const { return count.load(std::memory_order_acquire); }
+    bool empty() const { return size() == 0; }
+
+    // Bytes taken by the chunks allocated so far
+    std::size_t bytes() const { return chunkCount * sizeof(Slot) * kChunkSize; }
+
+    // Destroys every element and releases all chunks; not safe while
+    // other threads are reading
+    void clear() {
+        if (!std::is_trivially_destructible<T>::value) {
+            std::size_t size = count.load(std::memory_order_relaxed);
+            for (std::size_t i = 0; i < size; ++i) {
+                (*this)[i].~T();
+            }
+        }
+        chunks.clear();
+        chunkArena.release();
+        directories.clear();
+        directory.store(nullptr, std::memory_order_relaxed);
+        directoryCapacity = 0;
+        chunkCount = 0;
+        count.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    struct Slot {
+        alignas(T) unsigned char bytes[sizeof(T)];
+    };
+
+    // Allocates the next chunk, first doubling the directory if it is full
+    void addChunk() {
+        if (chunkCount == directoryCapacity) {
+            std::size_t capacity = directoryCapacity == 0 ? 16 : directoryCapacity * 2;
+            std::unique_ptr<Slot*[]> grown(new Slot*[capacity]());
+            for (std::size_t i = 0; i < chunkCount; ++i) {
+                grown[i] = chunks[i];
+            }
+            directory.store(grown.get(), std::memory_order_release);
+            directories.push_back(std::move(grown));
+            directoryCapacity = capacity;
+        }
+        chunks.push_back(static_cast<Slot*>(chunkArena.allocate(sizeof(Slot) * kChunkSize,
+                                                                alignof(Slot))));
+        directory.load(std::memory_order_relaxed)[chunkCount] = chunks.back();
+        ++chunkCount;
+    }
+
+    Arena chunkArena;                                    // Owns the chunks
+    std::vector<Slot*> chunks;                           // Writer only
+    std::vector<std::unique_ptr<Slot*[]>> directories;   // Every directory ever published
+    std::atomic<Slot**> directory;                       // Current chunk directory
+    std::size_t directoryCapacity;
+    std::size_t chunkCount;
+    std::atomic<std::size_t> count;
+};
+
+#endif  // BLOCK_STORE_H
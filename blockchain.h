@@ -0,0 +1,1006 @@
+#ifndef BLOCKCHAIN_H
+#define BLOCKCHAIN_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <sys/stat.h>
+#include "picosha2.h"
+#include "arena.h"
+#include "sha256_backend.h"
+#include "block_store.h"
+#include "hash256.h"
+#include "merkle.h"
+#include "chain_log.h"
+#include "tally.h"
+#include "vote_column.h"
+#include "checkpoint.h"
+#include "chain_index.h"
+#include "metrics.h"
+
+// Block class represents each entry in the blockchain. A single-vote block
+// holds one vote in data; a batch block holds several votes joined by '\n'
+// together with the Merkle root over their records. The data bytes are not
+// owned by the block: the chain keeps them in its payload arena, which
+// leaves Block trivially destructible.
+class Block {
+public:
+    std::string_view data;
+    uint32_t voteCount; // Votes in a batch block, 0 for a single-vote block
+    Hash256 merkleRoot; // Root over the batch's vote records (batch blocks only)
+    Hash256 prevHash;
+    Hash256 hash;
+
+    // Constructor to initialize each block with data and hash of the previous
+    // block; data must outlive the block
+    Block(std::string_view data, const Hash256& prevHash)
+        : data(data), voteCount(0), merkleRoot(), prevHash(prevHash) {
+        calculateHash();
+    }
+
+    // Constructor for a batch block from its votes joined by joinVotes() and
+    // their precomputed Merkle leaves
+    Block(std::string_view joinedVotes, const Hash256& prevHash,
+          const std::vector<Hash256>& leaves)
+        : data(joinedVotes), voteCount(static_cast<uint32_t>(leaves.size())),
+          prevHash(prevHash) {
+        merkleRoot = computeMerkleRoot(leaves);
+        calculateHash();
+    }
+
+    // Copies votes, joined by '\n', into arena: the data of a batch block.
+    // Votes must not contain '\n'.
+    static std::string_view joinVotes(const std::vector<std::string>& votes, Arena& arena) {
+        std::size_t size = votes.empty() ? 0 : votes.size() - 1;
+        for (const std::string& vote : votes) {
+            size += vote.size();
+        }
+        char* joined = static_cast<char*>(arena.allocate(std::max<std::size_t>(size, 1), 1));
+        char* out = joined;
+        for (std::size_t i = 0; i < votes.size(); ++i) {
+            if (i > 0) {
+                *out++ = '\n';
+            }
+            std::memcpy(out, votes[i].data(), votes[i].size());
+            out += votes[i].size();
+        }
+        return std::string_view(joined, size);
+    }
+
+    bool isBatch() const {
+        return voteCount > 0;
+    }
+
+    // Calls visit(string_view) for each vote in the block
+    template <typename Visit>
+    void forEachVote(Visit visit) const {
+        if (!isBatch()) {
+            visit(std::string_view(data));
+            return;
+        }
+        std::size_t start = 0;
+        for (uint32_t i = 0; i < voteCount; ++i) {
+            std::size_t end = data.find('\n', start);
+            if (end == std::string::npos) {
+                end = data.size();
+            }
+            visit(std::string_view(data).substr(start, end - start));
+            start = end + 1;
+        }
+    }
+
+    // The votes of the block, in order
+    std::vector<std::string_view> votes() const {
+        std::vector<std::string_view> result;
+        result.reserve(std::max<uint32_t>(voteCount, 1));
+        forEachVote([&result](std::string_view vote) { result.push_back(vote); });
+        return result;
+    }
+
+    // Appends the bytes hashed into this block's hash: prevHash || data for a
+    // single vote, prevHash || merkleRoot || voteCount (big endian) for a batch
+    void appendHashInput(std::vector<uint8_t>& out) const {
+        out.insert(out.end(), prevHash.begin(), prevHash.end());
+        if (!isBatch()) {
+            out.insert(out.end(), data.begin(), data.end());
+            return;
+        }
+        out.insert(out.end(), merkleRoot.begin(), merkleRoot.end());
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            out.push_back(static_cast<uint8_t>(voteCount >> shift));
+        }
+    }
+
+    // Calculate the hash for the block to ensure immutability
+    void calculateHash() {
+        METRIC_SCOPE(BlockHash);
+        hash = isBatch() ? computeBatchHash(prevHash, merkleRoot, voteCount)
+                         : computeHash(prevHash, data);
+    }
+
+    // Recomputes the Merkle root from the stored votes
+    Hash256 recomputeMerkleRoot() const {
+        return computeMerkleRoot(merkleLeaves(prevHash, votes()));
+    }
+
+    // Hash of the raw previous digest followed by the vote data
+    static Hash256 computeHash(const Hash256& prevHash, std::string_view data) {
+        picosha2::hash256_one_by_one hasher;
+        hasher.process(prevHash.begin(), prevHash.end());
+        hasher.process(data.begin(), data.end());
+        hasher.finish();
+        Hash256 digest;
+        hasher.get_hash_bytes(digest.begin(), digest.end());
+        return digest;
+    }
+
+    // Hash of a batch block: prevHash || merkleRoot || voteCount (big endian)
+    static Hash256 computeBatchHash(const Hash256& prevHash, const Hash256& merkleRoot,
+                                    uint32_t voteCount) {
+        uint8_t input[68];
+        std::memcpy(input, prevHash.data(), 32);
+        std::memcpy(input + 32, merkleRoot.data(), 32);
+        for (int i = 0; i < 4; ++i) {
+            input[64 + i] = static_cast<uint8_t>(voteCount >> (24 - 8 * i));
+        }
+        Hash256 digest;
+        picosha2::backend::hash256(input, sizeof(input), digest.data());
+        return digest;
+    }
+};
+
+// Position of a vote in the chain
+struct VoteLocation {
+    uint64_t height;
+    uint32_t index; // Position inside a batch block, 0 for a single-vote block
+};
+
+// Everything needed to show that a vote receipt belongs to the block with a
+// given hash, without access to the rest of the chain. For a batch block
+// the receipt is the vote's Merkle leaf and siblings climbs to the root in
+// O(log votes) hashes; for a single-vote block the receipt is the block
+// hash itself and siblings is empty.
+struct InclusionProof {
+    uint64_t height;
+    uint32_t index;
+    uint32_t voteCount; // Votes in the block, 0 for a single-vote block
+    std::string vote;
+    Hash256 prevHash;
+    std::vector<Hash256> siblings;
+};
+
+// Checks a proof against the receipt and the hash of the block at
+// proof.height, which the verifier obtains independently
+inline bool verifyInclusionProof(const InclusionProof& proof, const Hash256& receipt,
+                                 const Hash256& blockHash) {
+    if (proof.voteCount == 0) {
+        return proof.siblings.empty() && receipt == blockHash &&
+               Block::computeHash(proof.prevHash, proof.vote) == blockHash;
+    }
+    Hash256 leaf = merkleLeafHash(proof.prevHash, proof.index, proof.vote);
+    Hash256 root;
+    return leaf == receipt &&
+           merkleRootFromPath(leaf, proof.index, proof.voteCount, proof.siblings, root) &&
+           Block::computeBatchHash(proof.prevHash, root, proof.voteCount) == blockHash;
+}
+
+class Blockchain {
+private:
+    Arena payloads;           // Data bytes of every block
+    BlockStore<Block> blocks; // Blocks by height, blocks[0] at baseHeight
+    uint64_t baseHeight = 0;  // 0, or the checkpoint's tip height after restoreCheckpoint()
+    TallySnapshot baseTally;  // Counts as of baseHeight
+    ChainIndex index;         // Height, hash and receipt lookups, including non-resident blocks
+    CandidateList candidates; // Ballot the votes are counted against
+    TallyEngine tally;        // Running counts, one bucket per candidate plus NOTA
+
+    // A logged block whose record is not yet known to be durable
+    struct PendingTip {
+        uint64_t seq;
+        uint64_t height;
+        Hash256 hash;
+    };
+
+    ChainLog* log = nullptr;        // Durable block log; lasthash.txt is written per block without it
+    mutable std::mutex durableLock;      // Guards the fields below, updated by the log's flusher
+    std::deque<PendingTip> unsyncedTips; // Logged blocks awaiting their group commit
+    bool haveDurableTip = false;
+    uint64_t durableHeight = 0;     // Newest block known to be on disk
+    Hash256 durableHash;
+    LogPosition tipLogEnd;          // Log position just past the tip's block record
+    std::string tipFile = "lasthash.txt"; // Where the tip hash is saved for verify()
+
+    // Tip file contents as last written or read, and the stat() result
+    // they belong to
+    mutable std::mutex tipFileLock;
+    mutable bool tipFileKnown = false;
+    mutable struct stat tipFileStat;
+    mutable std::string tipFileContents;
+
+    // Newest block verify() has checked, so the next call starts after it
+    mutable bool verifiedTip = false;
+    mutable std::size_t verifiedHeight = 0;
+    mutable Hash256 verifiedHash;
+
+    // Counts the votes of the newly appended block at height
+    void countBlock(const Block& block, uint64_t height) {
+        tally.beginBlock();
+        block.forEachVote([this](std::string_view vote) { tally.count(candidates.bucketOf(vote)); });
+        tally.endBlock(height);
+    }
+
+    // Appends a single-vote block and indexes its receipt (the block hash).
+    // A replayed block is already in the log, its frame starting at replayed.
+    const Block& appendSingle(const std::string& data, const LogPosition* replayed = nullptr) {
+        METRIC_SCOPE(BlockAppend);
+        Block& newBlock = blocks.emplace_back(payloads.copy(data), getLastHash());
+        uint64_t height = size() - 1;
+        if (height > 0) {  // The genesis block is not a vote
+            countBlock(newBlock, height);
+        }
+        indexBlock(height, logBlock(newBlock, replayed), &newBlock.hash, height > 0 ? 1 : 0);
+        return newBlock;
+    }
+
+    // Appends a batch block and indexes its receipts (the Merkle leaves),
+    // computing the leaves unless they are passed in
+    const Block& appendBatch(const std::vector<std::string>& votes, std::vector<Hash256>* receipts,
+                             const LogPosition* replayed = nullptr,
+                             std::vector<Hash256>* computedLeaves = nullptr) {
+        METRIC_SCOPE(BlockAppend);
+        std::vector<Hash256> leaves;
+        if (computedLeaves != nullptr) {
+            leaves.swap(*computedLeaves);
+        } else {
+            leaves = merkleLeaves(blocks.back().hash, votes);
+        }
+        Block& newBlock = blocks.emplace_back(Block::joinVotes(votes, payloads),
+                                              blocks.back().hash, leaves);
+        uint64_t height = size() - 1;
+        countBlock(newBlock, height);
+        indexBlock(height, logBlock(newBlock, replayed), leaves.data(), leaves.size());
+        if (receipts != nullptr) {
+            receipts->swap(leaves);
+        }
+        return newBlock;
+    }
+
+    // Adds a block to the index unless a previous run already did; an entry
+    // for a different block at that height (from a log tail lost in a
+    // crash) is replaced along with everything after it
+    void indexBlock(uint64_t height, const IndexedBlock& entry, const Hash256* receipts,
+                    std::size_t receiptCount) {
+        if (height < index.size()) {
+            if (index.at(height).hash == entry.hash) {
+                return;
+            }
+            index.truncate(height);
+        }
+        if (!index.add(height, entry, receipts, receiptCount)) {
+            std::cerr << "Unable to index block " << height << std::endl;
+        }
+    }
+
+    // Writes a BlockRecord for a newly appended block and returns where
+    // the record is; a replayed block's record is at replayed already. A
+    // block that is in no log gets recordBytes 0.
+    IndexedBlock logBlock(const Block& block, const LogPosition* replayed) {
+        IndexedBlock entry{block.hash, 0, 0, 0};
+        uint32_t recordBytes = static_cast<uint32_t>(ChainLog::frameBytes(68 + block.data.size()));
+        if (replayed != nullptr) {
+            entry.segment = replayed->segment;
+            entry.recordBytes = recordBytes;
+            entry.offset = replayed->offset;
+            return entry;
+        }
+        if (log == nullptr) {
+            return entry;
+        }
+        std::vector<uint8_t> record;
+        encodeBlockRecord(block, record);
+        std::lock_guard<std::mutex> lock(durableLock);
+        uint64_t seq = log->append(BlockRecord, record.data(), record.size(), &tipLogEnd);
+        unsyncedTips.push_back(PendingTip{seq, size() - 1, block.hash});
+        entry.segment = tipLogEnd.segment;
+        entry.recordBytes = recordBytes;
+        entry.offset = tipLogEnd.offset - recordBytes;
+        return entry;
+    }
+
+    // Calls visit(block) with the block at height: the resident block, or
+    // one read back from the chain log through the index. False if the
+    // block cannot be read or does not hash to its indexed hash.
+    template <typename Visit>
+    bool visitBlock(uint64_t height, Visit visit) const {
+        if (height >= baseHeight && height < size()) {
+            visit(at(height));
+            return true;
+        }
+        if (height >= index.size() || log == nullptr || index.at(height).recordBytes == 0) {
+            return false;
+        }
+        const IndexedBlock& entry = index.at(height);
+        LogPosition position;
+        position.segment = entry.segment;
+        position.offset = entry.offset;
+        uint8_t type;
+        std::vector<uint8_t> record;
+        Hash256 prevHash, hash;
+        std::string data;
+        std::vector<std::string> votes;
+        if (!log->readRecord(position, entry.recordBytes, type, record) || type != BlockRecord ||
+            !decodeBlockRecord(record.data(), record.size(), prevHash, hash, data, votes) ||
+            hash != entry.hash) {
+            return false;
+        }
+        // data holds a batch block's votes already joined
+        Block block = votes.empty() ? Block(data, prevHash)
+                                    : Block(data, prevHash, merkleLeaves(prevHash, votes));
+        if (block.hash != hash) {
+            return false;
+        }
+        visit(block);
+        return true;
+    }
+
+    // Persists the tail hash after an append; with a log attached this
+    // happens once per group commit instead
+    void persistTip() {
+        if (log == nullptr) {
+            saveToFile(blocks.back().hash);
+        }
+    }
+
+    // Group-commit callback: advances the durable tip and records it in
+    // lasthash.txt
+    void onLogDurable(uint64_t seq) {
+        std::lock_guard<std::mutex> lock(durableLock);
+        bool advanced = false;
+        while (!unsyncedTips.empty() && unsyncedTips.front().seq <= seq) {
+            durableHeight = unsyncedTips.front().height;
+            durableHash = unsyncedTips.front().hash;
+            unsyncedTips.pop_front();
+            advanced = true;
+        }
+        if (advanced) {
+            haveDurableTip = true;
+            saveToFile(durableHash);
+        }
+    }
+
+public:
+    // Creates an empty chain whose votes are counted against the ballot
+    explicit Blockchain(const CandidateList& ballot = CandidateList())
+        : baseTally{0, std::vector<uint64_t>(ballot.bucketCount(), 0)}, candidates(ballot),
+          tally(ballot.bucketCount()) {
+        index.open("");
+    }
+
+    // Encodes a block as a BlockRecord payload:
+    //   u32 voteCount | prevHash | hash | data
+    static void encodeBlockRecord(const Block& block, std::vector<uint8_t>& record) {
+        record.resize(4 + 32 + 32);
+        std::memcpy(&record[0], &block.voteCount, 4);
+        std::memcpy(&record[4], block.prevHash.data(), 32);
+        std::memcpy(&record[36], block.hash.data(), 32);
+        record.insert(record.end(), block.data.begin(), block.data.end());
+    }
+
+    // Decodes a BlockRecord payload, splitting a batch block's data into its votes
+    static bool decodeBlockRecord(const uint8_t* payload, std::size_t size, Hash256& prevHash,
+                                  Hash256& hash, std::string& data, std::vector<std::string>& votes) {
+        if (size < 68) {
+            return false;
+        }
+        uint32_t voteCount;
+        std::memcpy(&voteCount, payload, 4);
+        std::memcpy(prevHash.data(), payload + 4, 32);
+        std::memcpy(hash.data(), payload + 36, 32);
+        data.assign(reinterpret_cast<const char*>(payload) + 68, size - 68);
+        votes.clear();
+        std::size_t start = 0;
+        for (uint32_t i = 0; i < voteCount; ++i) {
+            std::size_t end = std::min(data.find('\n', start), data.size());
+            votes.push_back(data.substr(start, end - start));
+            start = end + 1;
+        }
+        return voteCount == 0 || start == data.size() + 1;
+    }
+
+    // Adds the genesis block to the blockchain
+    void addGenesisBlock() {
+        if (blocks.empty()) {
+            appendSingle("0");  // Genesis block with arbitrary data
+            persistTip();
+        }
+    }
+
+    // Adds a new block (vote) to the blockchain and returns the vote receipt
+    Hash256 addBlock(const std::string& data) {
+        if (blocks.empty()) {
+            return Hash256();
+        }
+        const Block& newBlock = appendSingle(data);
+        persistTip();
+        return newBlock.hash;
+    }
+
+    // Adds a batch block holding several votes under one Merkle root and
+    // returns each vote's receipt
+    std::vector<Hash256> addBatchBlock(const std::vector<std::string>& votes) {
+        std::vector<Hash256> receipts;
+        if (!blocks.empty() && !votes.empty()) {
+            appendBatch(votes, &receipts);
+            persistTip();
+        }
+        return receipts;
+    }
+
+    // Appends votes and saves the resulting tail hash once. With
+    // votesPerBlock above 1 the votes are packed into batch blocks of up to
+    // that many votes; otherwise every vote gets its own block.
+    void addBlocks(const std::vector<std::string>& votes, std::size_t votesPerBlock = 1) {
+        if (blocks.empty() || votes.empty()) {
+            return;
+        }
+        if (votesPerBlock <= 1) {
+            for (const std::string& data : votes) {
+                appendSingle(data);
+            }
+        } else {
+            std::vector<std::string> batch;
+            for (std::size_t start = 0; start < votes.size(); start += votesPerBlock) {
+                std::size_t end = std::min(votes.size(), start + votesPerBlock);
+                batch.assign(votes.begin() + start, votes.begin() + end);
+                appendBatch(batch, nullptr);
+            }
+        }
+        persistTip();
+    }
+
+    // Re-appends a BlockRecord while replaying the chain log, given the
+    // position of its frame; fails if the record does not extend the chain
+    // or its hash does not recompute. A batch block cannot be the genesis
+    // block.
+    bool restoreBlock(const uint8_t* payload, std::size_t size, const LogPosition& record) {
+        Hash256 prevHash, hash;
+        std::string data;
+        std::vector<std::string> votes;
+        if (log != nullptr || !decodeBlockRecord(payload, size, prevHash, hash, data, votes) ||
+            prevHash != getLastHash() || (blocks.empty() && !votes.empty())) {
+            return false;
+        }
+        if (votes.empty()) {
+            appendSingle(data, &record);
+        } else {
+            appendBatch(votes, nullptr, &record);
+        }
+        return blocks.back().hash == hash;
+    }
+
+    // Appends a block shipped by a replication leader as a BlockRecord
+    // payload. Fails, appending nothing, unless the block links to this
+    // chain's tip and hashes to the hash it carries.
+    bool appendRecord(const uint8_t* payload, std::size_t size) {
+        Hash256 prevHash, hash;
+        std::string data;
+        std::vector<std::string> votes;
+        if (!decodeBlockRecord(payload, size, prevHash, hash, data, votes) ||
+            prevHash != getLastHash() || (blocks.empty() && !votes.empty())) {
+            return false;
+        }
+        if (votes.empty()) {
+            if (Block::computeHash(prevHash, data) != hash) {
+                return false;
+            }
+            appendSingle(data);
+        } else {
+            std::vector<Hash256> leaves = merkleLeaves(prevHash, votes);
+            if (Block::computeBatchHash(prevHash, computeMerkleRoot(leaves),
+                                        static_cast<uint32_t>(votes.size())) != hash) {
+                return false;
+            }
+            appendBatch(votes, nullptr, nullptr, &leaves);
+        }
+        persistTip();
+        return true;
+    }
+
+    // Starts an empty chain from a checkpoint: its tip block becomes the
+    // first resident block, at the checkpoint's height, and the tally resumes
+    // from the checkpoint's counts. Blocks below that height stay in the log
+    // only, found through the index, which must already cover the tip.
+    // Call before replaying the log suffix after the checkpoint.
+    bool restoreCheckpoint(uint64_t height, const uint8_t* tipRecord, std::size_t tipSize,
+                           const std::vector<uint64_t>& counts, const LogPosition& logEnd) {
+        Hash256 prevHash, hash;
+        std::string data;
+        std::vector<std::string> votes;
+        if (!blocks.empty() || log != nullptr || counts.size() != candidates.bucketCount() ||
+            !decodeBlockRecord(tipRecord, tipSize, prevHash, hash, data, votes) ||
+            height >= index.size() || index.at(height).hash != hash) {
+            return false;
+        }
+        std::vector<Hash256> leaves = merkleLeaves(prevHash, votes);
+        Block& base = votes.empty()
+            ? blocks.emplace_back(payloads.copy(data), prevHash)
+            : blocks.emplace_back(Block::joinVotes(votes, payloads), prevHash, leaves);
+        if (base.hash != hash) {
+            blocks.clear();
+            payloads.release();
+            return false;
+        }
+        baseHeight = height;
+        baseTally = TallySnapshot{height, counts};
+        tally.restore(baseTally);
+        tipLogEnd = logEnd;
+        return true;
+    }
+
+    // Captures the tip, its tally and its log position for a checkpoint.
+    // Call from the thread that appends blocks, with a log attached.
+    bool captureCheckpoint(CheckpointData& data) const {
+        if (blocks.empty() || log == nullptr) {
+            return false;
+        }
+        data.height = size() - 1;
+        data.counts = tally.current().counts;
+        encodeBlockRecord(blocks.back(), data.tipBlock);
+        index.flush();
+        std::lock_guard<std::mutex> lock(durableLock);
+        data.logEnd = tipLogEnd;
+        return true;
+    }
+
+    // Keeps the indexes in directory, reusing what an earlier run stored
+    // there; call on an empty chain, before restoring a checkpoint or
+    // replaying the log. Without it the indexes live in memory.
+    bool openIndex(const std::string& directory) {
+        return blocks.empty() && index.open(directory);
+    }
+
+    // Saves the tip hash to path instead of lasthash.txt, so several chains
+    // can share a working directory; call before adding blocks
+    void setTipFile(const std::string& path) {
+        tipFile = path;
+    }
+
+    // Newest block known to be on disk; false until the log has made one
+    // durable. Safe to call while another thread appends.
+    bool durableTip(uint64_t& height, Hash256& hash) const {
+        std::lock_guard<std::mutex> lock(durableLock);
+        height = durableHeight;
+        hash = durableHash;
+        return haveDurableTip;
+    }
+
+    // Heights the index covers, including ones indexed by earlier runs
+    uint64_t indexedHeights() const {
+        return index.size();
+    }
+
+    // Logs every block appended from now on to chainLog and moves the
+    // lasthash.txt update to the log's group commits. Call after replaying
+    // the log; the ChainLog must be closed before this Blockchain is destroyed.
+    void attachLog(ChainLog& chainLog) {
+        // Drop index entries for blocks a torn log tail lost
+        index.truncate(size());
+        {
+            std::lock_guard<std::mutex> lock(durableLock);
+            log = &chainLog;
+            // Replayed blocks were not logged again, so the tip's record
+            // ends at or before the end of the log
+            tipLogEnd = chainLog.end();
+            if (!blocks.empty()) {
+                // Everything replayed is already on disk
+                haveDurableTip = true;
+                durableHeight = size() - 1;
+                durableHash = blocks.back().hash;
+                saveToFile(durableHash);
+            }
+        }
+        chainLog.setDurableCallback([this](uint64_t seq) { onLogDurable(seq); });
+    }
+
+    // Blocks until every appended block is durable; always true without a log
+    bool sync() {
+        return log == nullptr || log->sync();
+    }
+
+    // Finds the vote a receipt was issued for
+    bool findReceipt(const Hash256& receipt, VoteLocation& location) const {
+        bool found = false;
+        index.forEachReceiptCandidate(receipt, [&](uint64_t height, uint32_t position) {
+            visitBlock(height, [&](const Block& block) {
+                found = block.isBatch()
+                    ? position < block.voteCount &&
+                      merkleLeafHash(block.prevHash, position, block.votes()[position]) == receipt
+                    : block.hash == receipt;
+            });
+            if (found) {
+                location = VoteLocation{height, position};
+            }
+            return !found;
+        });
+        return found;
+    }
+
+    // Finds the height of the block with the given hash
+    bool findBlock(const Hash256& hash, uint64_t& height) const {
+        return index.findHeight(hash, height);
+    }
+
+    // Builds the inclusion proof for a vote receipt; returns false if the
+    // receipt was never issued by this chain
+    bool proveVote(const Hash256& receipt, InclusionProof& proof) const {
+        VoteLocation location;
+        if (!findReceipt(receipt, location)) {
+            return false;
+        }
+        return visitBlock(location.height, [&](const Block& block) {
+            if (!block.isBatch()) {
+                proof = InclusionProof{location.height, 0, 0, std::string(block.data),
+                                       block.prevHash, {}};
+                return;
+            }
+            std::vector<std::string_view> votes = block.votes();
+            MerkleTree tree(merkleLeaves(block.prevHash, votes));
+            proof = InclusionProof{location.height, location.index, block.voteCount,
+                                   std::string(votes[location.index]), block.prevHash,
+                                   tree.path(location.index)};
+        });
+    }
+
+    // Builds the proofs for every vote in the block at height, sharing one
+    // Merkle tree; for bulk audits, group receipts by height and use this
+    std::vector<InclusionProof> proveBlock(std::size_t height) const {
+        std::vector<InclusionProof> proofs;
+        visitBlock(height, [&](const Block& block) {
+            if (!block.isBatch()) {
+                proofs.push_back(InclusionProof{height, 0, 0, std::string(block.data),
+                                                block.prevHash, {}});
+                return;
+            }
+            std::vector<std::string_view> votes = block.votes();
+            MerkleTree tree(merkleLeaves(block.prevHash, votes));
+            proofs.reserve(votes.size());
+            for (uint32_t i = 0; i < votes.size(); ++i) {
+                proofs.push_back(InclusionProof{height, i, block.voteCount, std::string(votes[i]),
+                                                block.prevHash, tree.path(i)});
+            }
+        });
+        return proofs;
+    }
+
+    // Number of blocks in the chain, including the genesis block
+    std::size_t size() const {
+        return baseHeight + blocks.size();
+    }
+
+    // Lowest height held in memory: 0, or the height of the checkpoint the
+    // chain was restored from
+    std::size_t firstHeight() const {
+        return baseHeight;
+    }
+
+    // Approximate bytes held per resident block: its slot in the block
+    // store plus its data, excluding the receipt index and tally
+    double bytesPerBlock() const {
+        if (blocks.empty()) {
+            return 0;
+        }
+        return double(blocks.bytes() + payloads.bytesUsed()) / blocks.size();
+    }
+
+    // Retrieves the block at the given height (genesis is height 0), which
+    // must be at least firstHeight()
+    const Block& at(std::size_t height) const {
+        return blocks[height - baseHeight];
+    }
+
+    // Retrieves the hash of the last block (all zeroes for an empty chain)
+    Hash256 getLastHash() const {
+        if (blocks.empty()) {
+            return Hash256();
+        }
+        return blocks.back().hash;
+    }
+
+    // Tamper-evidence check, cheap enough to run before every vote. Blocks
+    // appended since the last call are re-hashed and checked to link to
+    // the tip verified then, which must itself be unchanged; the durable
+    // tip's hash is then compared with lasthash.txt. The file is only
+    // re-read when stat() shows it was replaced or modified since this
+    // chain last wrote or read it. Call from the appending thread;
+    // verifyFull() remains the full audit.
+    bool verify() const {
+        if (blocks.empty() || !verifyAppended()) {
+            return false;
+        }
+        Hash256 tipHash;
+        if (log == nullptr) {
+            tipHash = getLastHash();
+        } else {
+            std::lock_guard<std::mutex> lock(durableLock);
+            if (!haveDurableTip || at(durableHeight).hash != durableHash) {
+                return false;
+            }
+            tipHash = durableHash;
+        }
+        return tipFileMatches(toHex(tipHash));
+    }
+
+    // Recomputes every block hash and checks every prevHash link, splitting the
+    // chain into one contiguous slice per thread (0 picks the core count).
+    // Returns true if the chain is intact; otherwise firstBadHeight is set to
+    // the lowest height whose hash or link does not match. Only blocks from
+    // firstHeight() on are checked; a restored checkpoint's tip is trusted
+    // to link to the blocks below it.
+    bool verifyFull(unsigned threads, std::size_t& firstBadHeight) const {
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        std::size_t total = size();
+        std::size_t sliceSize = std::max<std::size_t>(1, (blocks.size() + threads - 1) / threads);
+        std::atomic<std::size_t> firstBad(SIZE_MAX);
+
+        std::vector<std::thread> workers;
+        for (std::size_t begin = baseHeight; begin < total; begin += sliceSize) {
+            std::size_t end = std::min(total, begin + sliceSize);
+            workers.emplace_back([this, begin, end, &firstBad] {
+                verifySlice(begin, end, firstBad);
+            });
+        }
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+
+        firstBadHeight = firstBad.load();
+        return firstBadHeight == SIZE_MAX;
+    }
+
+    // Prints the blockchain to demonstrate reading all blocks held in memory
+    void print() const {
+        for (std::size_t i = 0; i < blocks.size(); ++i) {
+            blocks[i].forEachVote([](std::string_view vote) { std::cout << vote << "->"; });
+        }
+        std::cout << "END" << std::endl;
+    }
+
+    // The ballot votes are counted against
+    const CandidateList& ballot() const {
+        return candidates;
+    }
+
+    // Vote counts as of the newest block; cheap enough to call while votes
+    // are being appended
+    TallySnapshot currentTally() const {
+        return tally.current();
+    }
+
+    // Vote counts as of the block at height, which must be below size() and
+    // at least firstHeight(). Only the blocks after the nearest tally
+    // checkpoint are counted, so this is also safe while votes are being
+    // appended.
+    TallySnapshot tallyAt(uint64_t height) const {
+        TallySnapshot snapshot = tally.current();
+        if (snapshot.height == height) {
+            return snapshot;
+        }
+        snapshot = tally.checkpointAtOrBefore(height);
+        for (uint64_t h = snapshot.height + 1; h <= height; ++h) {
+            at(h).forEachVote([&](std::string_view vote) {
+                snapshot.counts[candidates.bucketOf(vote)]++;
+            });
+        }
+        snapshot.height = height;
+        return snapshot;
+    }
+
+    // Packs the ballots of every block after firstHeight() into a column
+    // (the genesis block is not a vote; a restored checkpoint's tip is
+    // already in its counts), one slice of the chain per thread (0 picks the
+    // core count). The ballot may have at most VoteColumn::kMaxBuckets buckets.
+    VoteColumn exportVotes(unsigned threads = 0) const {
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        std::size_t total = blocks.size();
+        VoteColumn column;
+        column.firstHeight = baseHeight;
+        column.ballotStart.resize(total + 1);
+        column.blockHashes.resize(total);
+        uint64_t ballots = 0;
+        for (std::size_t i = 0; i < total; ++i) {
+            column.ballotStart[i] = ballots;
+            ballots += i == 0 ? 0 : std::max<uint32_t>(blocks[i].voteCount, 1);
+        }
+        column.ballotStart[total] = ballots;
+        column.resize(candidates.bucketCount(), ballots);
+
+        std::size_t sliceSize = std::max<std::size_t>(1, (total + threads - 1) / threads);
+        std::vector<std::thread> workers;
+        for (std::size_t begin = 0; begin < total; begin += sliceSize) {
+            std::size_t end = std::min(total, begin + sliceSize);
+            workers.emplace_back([this, begin, end, &column] {
+                for (std::size_t i = begin; i < end; ++i) {
+                    column.blockHashes[i] = blocks[i].hash;
+                    if (i == 0) {
+                        continue;
+                    }
+                    uint64_t ballot = column.ballotStart[i];
+                    blocks[i].forEachVote([&](std::string_view vote) {
+                        column.set(ballot++, candidates.bucketOf(vote));
+                    });
+                }
+            });
+        }
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        return column;
+    }
+
+    // Recounts every ballot from the blocks themselves, without the running
+    // tally, and optionally re-verifies every block hash first. Returns
+    // false if verification fails, with firstBadHeight set as in verifyFull.
+    // Ballots up to a restored checkpoint are taken from its counts.
+    bool recount(unsigned threads, bool verifyHashes, TallySnapshot& result,
+                 std::size_t& firstBadHeight) const {
+        firstBadHeight = SIZE_MAX;
+        if (verifyHashes && !verifyFull(threads, firstBadHeight)) {
+            return false;
+        }
+        VoteColumn column = exportVotes(threads);
+        result.height = size() == 0 ? 0 : size() - 1;
+        result.counts = histogramColumn(column, threads);
+        for (std::size_t i = 0; i < result.counts.size(); ++i) {
+            result.counts[i] += baseTally.counts[i];
+        }
+        return true;
+    }
+
+    // Displays the winner from the running tally; NOTA votes are counted but
+    // cannot win
+    void checkWinner() const {
+        TallySnapshot snapshot = tally.current();
+        std::vector<std::pair<uint64_t, std::string>> standings;
+        for (std::size_t i = 0; i < candidates.size(); ++i) {
+            standings.emplace_back(snapshot.counts[i], candidates.name(i));
+        }
+
+        std::sort(standings.rbegin(), standings.rend());
+
+        if (standings.empty() || standings[0].first == 0) {
+            std::cout << "No one is the winner" << std::endl;
+        } else {
+            std::cout << "Winner is: " << standings[0].second << std::endl;
+        }
+    }
+
+private:
+    // Verifies blocks [begin, end) in batches so independent hashes can share
+    // the multi-buffer SHA-256 backend, and lowers firstBad on a mismatch.
+    // Stops early once a lower slice has already reported a bad block.
+    void verifySlice(std::size_t begin, std::size_t end, std::atomic<std::size_t>& firstBad) const {
+        const std::size_t batchSize = 64;
+        std::vector<uint8_t> messages;
+        std::vector<std::size_t> offsets(batchSize), lengths(batchSize);
+        std::vector<const uint8_t*> pointers(batchSize);
+        std::vector<uint8_t> digests(batchSize * 32);
+
+        for (std::size_t start = begin; start < end; start += batchSize) {
+            if (firstBad.load(std::memory_order_relaxed) < start) {
+                return;
+            }
+            std::size_t count = std::min(batchSize, end - start);
+            messages.clear();
+            for (std::size_t i = 0; i < count; ++i) {
+                offsets[i] = messages.size();
+                at(start + i).appendHashInput(messages);
+                lengths[i] = messages.size() - offsets[i];
+            }
+            for (std::size_t i = 0; i < count; ++i) {
+                pointers[i] = messages.data() + offsets[i];
+            }
+            picosha2::backend::hash256_many(pointers.data(), lengths.data(), count, digests.data());
+
+            for (std::size_t i = 0; i < count; ++i) {
+                std::size_t height = start + i;
+                const Block& block = at(height);
+                const Hash256 expectedPrev = height == 0 ? Hash256()
+                                           : height == baseHeight ? block.prevHash
+                                                                  : at(height - 1).hash;
+                if (block.prevHash != expectedPrev ||
+                    std::memcmp(block.hash.data(), &digests[32 * i], 32) != 0 ||
+                    (block.isBatch() && block.recomputeMerkleRoot() != block.merkleRoot)) {
+                    std::size_t current = firstBad.load();
+                    while (height < current && !firstBad.compare_exchange_weak(current, height)) {
+                    }
+                    return;
+                }
+            }
+        }
+    }
+
+    // Checks the blocks appended since the last successful call, the
+    // first time every block from firstHeight() on
+    bool verifyAppended() const {
+        std::size_t begin = baseHeight;
+        if (verifiedTip) {
+            if (at(verifiedHeight).hash != verifiedHash) {
+                verifiedTip = false;
+                return false;
+            }
+            begin = verifiedHeight + 1;
+        }
+        std::atomic<std::size_t> firstBad(SIZE_MAX);
+        verifySlice(begin, size(), firstBad);
+        if (firstBad.load() != SIZE_MAX) {
+            return false;
+        }
+        verifiedTip = true;
+        verifiedHeight = size() - 1;
+        verifiedHash = blocks.back().hash;
+        return true;
+    }
+
+    // What identifies one version of the tip file
+    static bool sameFile(const struct stat& a, const struct stat& b) {
+        return a.st_dev == b.st_dev && a.st_ino == b.st_ino && a.st_size == b.st_size &&
+               a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec &&
+               a.st_ctim.tv_sec == b.st_ctim.tv_sec && a.st_ctim.tv_nsec == b.st_ctim.tv_nsec;
+    }
+
+    // Whether the tip file holds expected, reading it only if it changed
+    // since its contents were last seen. The change time is compared too,
+    // as it cannot be set back the way the modification time can.
+    bool tipFileMatches(const std::string& expected) const {
+        struct stat before;
+        if (stat(tipFile.c_str(), &before) != 0) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(tipFileLock);
+        if (!tipFileKnown || !sameFile(before, tipFileStat)) {
+            std::ifstream hashFile(tipFile);
+            std::string contents;
+            std::getline(hashFile, contents);
+            struct stat after;
+            tipFileKnown = hashFile.is_open() && stat(tipFile.c_str(), &after) == 0 &&
+                           sameFile(before, after);
+            tipFileStat = before;
+            tipFileContents = contents;
+        }
+        return tipFileContents == expected;
+    }
+
+public:
+    // Save the hash of the latest block to a file for verification; what
+    // was written is remembered, so verify() need not read it back
+    void saveToFile(const Hash256& hash) const {
+        METRIC_SCOPE(LastHashWrite);
+        std::ofstream hashFile(tipFile);
+        if (hashFile.is_open()) {
+            hashFile << toHex(hash);
+            hashFile.close();
+        } else {
+            std::cout << "Unable to save hash to file." << std::endl;
+            return;
+        }
+        std::lock_guard<std::mutex> lock(tipFileLock);
+        tipFileKnown = static_cast<bool>(hashFile) && stat(tipFile.c_str(), &tipFileStat) == 0;
+        tipFileContents = toHex(hash);
+    }
+};
+
+#endif  // BLOCKCHAIN_H
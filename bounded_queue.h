@@ -0,0 +1,64 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+// Blocking FIFO with a fixed capacity, linking the stages of a pipeline.
+// A full queue makes the producer wait, so a slow stage throttles the
+// stages before it instead of letting work pile up in memory.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(std::size_t capacity) : capacity(capacity), closed(false) {}
+
+    // Waits for room and appends item; returns false if the queue was closed
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(stateLock);
+        notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+        if (closed) {
+            return false;
+        }
+        items.push_back(std::move(item));
+        lock.unlock();
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // Waits for an item; returns false once the queue is closed and drained
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(stateLock);
+        notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        lock.unlock();
+        notFull.notify_one();
+        return true;
+    }
+
+    // Ends the stream: pending items can still be popped, pushes fail
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(stateLock);
+            closed = true;
+        }
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+
+private:
+    std::size_t capacity;
+    bool closed;
+    std::mutex stateLock;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::deque<T> items;
+};
+
+#endif  // BOUNDED_QUEUE_H
@@ -0,0 +1,525 @@
+#ifndef CHAIN_ARCHIVE_H
+#define CHAIN_ARCHIVE_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "blockchain.h"
+#include "chain_log.h"
+#include "hash256.h"
+#include "merkle.h"
+#ifdef VOTING_ZSTD
+#include <zstd.h>
+#endif
+
+// Compact binary archive of a chain, for cold storage and for handing the
+// chain to observers. It holds blocks only; the voted marks and registry
+// deltas in the chain log stay behind.
+//
+// The file is a stream, written and read front to back:
+//   ArchiveHeader
+//   segments, each an ArchiveSegment followed by storedBytes bytes
+//   an ArchiveSegment of zeroes, then an ArchiveTrailer
+// All integers are little endian. A segment holds about 1 MiB of blocks,
+// compressed with zstd as a whole when the header has kArchiveZstd. Each
+// block in it is
+//   varint voteCount | varint dataBytes | data | hash (32 raw bytes)
+// with voteCount 0 for a single-vote block and a batch block's votes
+// joined by '\n' as in the chain. Varints are LEB128. Previous hashes and
+// Merkle roots are not stored: a reader recomputes them, and a block whose
+// recomputed hash differs from its stored one is damaged.
+struct ArchiveHeader {
+    char magic[8];          // "BCVARCH" and a NUL
+    uint16_t version;
+    uint16_t flags;         // kArchiveZstd
+    uint32_t reserved;
+    uint64_t firstHeight;   // Height of the first block
+    uint8_t prevHash[32];   // Hash the first block links to; zeroes for genesis
+};
+
+struct ArchiveSegment {
+    uint32_t rawBytes;      // Encoded blocks before compression
+    uint32_t storedBytes;   // Bytes following in the file
+    uint32_t blockCount;
+    uint32_t checksum;      // CRC-32C of the stored bytes
+};
+
+struct ArchiveTrailer {
+    uint64_t blockCount;    // Blocks in the archive
+    uint8_t tipHash[32];    // Hash of the last block
+    uint32_t checksum;      // CRC-32C of the two fields above
+    uint32_t reserved;
+};
+
+static_assert(sizeof(ArchiveHeader) == 56, "ArchiveHeader layout");
+static_assert(sizeof(ArchiveSegment) == 16, "ArchiveSegment layout");
+static_assert(sizeof(ArchiveTrailer) == 48, "ArchiveTrailer layout");
+
+constexpr uint16_t kArchiveVersion = 1;
+constexpr uint16_t kArchiveZstd = 1;
+constexpr char kArchiveMagic[8] = {'B', 'C', 'V', 'A', 'R', 'C', 'H', '\0'};
+
+// Whether this build can write and read zstd-compressed archives
+inline bool archiveZstdAvailable() {
+#ifdef VOTING_ZSTD
+    return true;
+#else
+    return false;
+#endif
+}
+
+inline void putVarint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+// Decodes a varint at in, advancing it; false if it runs past end or
+// overflows 64 bits
+inline bool getVarint(const uint8_t*& in, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && in < end; shift += 7) {
+        uint8_t byte = *in++;
+        value |= uint64_t(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return shift < 63 || byte <= 1;
+        }
+    }
+    return false;
+}
+
+// Writes an archive block by block. The archive is built under path.tmp
+// and renamed into place by finish(), so a reader never sees a partial
+// one; memory use is one segment.
+class ArchiveWriter {
+public:
+    static constexpr std::size_t kSegmentBytes = 1 << 20;
+
+    ArchiveWriter() : fd(-1), compressed(false), segmentBlocks(0), blockCount(0), written(0) {}
+
+    ArchiveWriter(const ArchiveWriter&) = delete;
+    ArchiveWriter& operator=(const ArchiveWriter&) = delete;
+
+    // Drops an archive that was never finished
+    ~ArchiveWriter() {
+        if (fd >= 0) {
+            ::close(fd);
+            std::remove(temporary.c_str());
+        }
+    }
+
+    // Starts an archive whose first block is at firstHeight and links to
+    // prevHash; compress needs a build with VOTING_ZSTD
+    bool open(const std::string& archivePath, uint64_t firstHeight, const Hash256& prevHash,
+              bool compress) {
+        if (compress && !archiveZstdAvailable()) {
+            std::cerr << "Error: built without VOTING_ZSTD; cannot compress the archive"
+                      << std::endl;
+            return false;
+        }
+        path = archivePath;
+        temporary = path + ".tmp";
+        fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            std::cerr << "Error: Could not create " << temporary << std::endl;
+            return false;
+        }
+        compressed = compress;
+        tip = prevHash;
+        ArchiveHeader header = {};
+        std::memcpy(header.magic, kArchiveMagic, sizeof(header.magic));
+        header.version = kArchiveVersion;
+        header.flags = compress ? kArchiveZstd : 0;
+        header.firstHeight = firstHeight;
+        std::memcpy(header.prevHash, prevHash.data(), 32);
+        return writeAll(&header, sizeof(header));
+    }
+
+    // Appends the next block, which must link to the previous one
+    bool add(uint32_t voteCount, std::string_view data, const Hash256& hash) {
+        putVarint(raw, voteCount);
+        putVarint(raw, data.size());
+        raw.insert(raw.end(), data.begin(), data.end());
+        raw.insert(raw.end(), hash.begin(), hash.end());
+        tip = hash;
+        ++segmentBlocks;
+        ++blockCount;
+        return raw.size() < kSegmentBytes || flushSegment();
+    }
+
+    // Writes the last segment and the trailer, makes the archive durable
+    // and moves it to its path
+    bool finish() {
+        ArchiveSegment end = {};
+        ArchiveTrailer trailer = {};
+        trailer.blockCount = blockCount;
+        std::memcpy(trailer.tipHash, tip.data(), 32);
+        trailer.checksum = crc32c(reinterpret_cast<const uint8_t*>(&trailer),
+                                  offsetof(ArchiveTrailer, checksum));
+        bool ok = flushSegment() && writeAll(&end, sizeof(end)) &&
+                  writeAll(&trailer, sizeof(trailer)) && fsync(fd) == 0;
+        ::close(fd);
+        fd = -1;
+        if (!ok || std::rename(temporary.c_str(), path.c_str()) != 0) {
+            std::cerr << "Error: Could not write " << path << std::endl;
+            std::remove(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t blocks() const { return blockCount; }
+
+    // Bytes written to the file so far
+    uint64_t bytes() const { return written; }
+
+private:
+    bool flushSegment() {
+        if (segmentBlocks == 0) {
+            return true;
+        }
+        ArchiveSegment segment = {};
+        segment.rawBytes = static_cast<uint32_t>(raw.size());
+        segment.blockCount = segmentBlocks;
+        const std::vector<uint8_t>* out = &raw;
+#ifdef VOTING_ZSTD
+        if (compressed) {
+            stored.resize(ZSTD_compressBound(raw.size()));
+            std::size_t size = ZSTD_compress(stored.data(), stored.size(), raw.data(), raw.size(),
+                                             kZstdLevel);
+            if (ZSTD_isError(size)) {
+                std::cerr << "Error: zstd: " << ZSTD_getErrorName(size) << std::endl;
+                return false;
+            }
+            stored.resize(size);
+            out = &stored;
+        }
+#endif
+        segment.storedBytes = static_cast<uint32_t>(out->size());
+        segment.checksum = crc32c(out->data(), out->size());
+        bool ok = writeAll(&segment, sizeof(segment)) && writeAll(out->data(), out->size());
+        raw.clear();
+        segmentBlocks = 0;
+        return ok;
+    }
+
+    bool writeAll(const void* data, std::size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        std::size_t done = 0;
+        while (done < size) {
+            ssize_t n = ::write(fd, bytes + done, size - done);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                std::cerr << "Error: Could not write " << temporary << std::endl;
+                return false;
+            }
+            done += static_cast<std::size_t>(n);
+        }
+        written += size;
+        return true;
+    }
+
+    static constexpr int kZstdLevel = 3;
+
+    std::string path;
+    std::string temporary;
+    int fd;
+    bool compressed;
+    std::vector<uint8_t> raw;     // Encoded blocks of the open segment
+    std::vector<uint8_t> stored;  // The segment compressed
+    uint32_t segmentBlocks;
+    uint64_t blockCount;
+    uint64_t written;
+    Hash256 tip;
+};
+
+// Streams the blocks out of an archive, verifying each one on the way:
+// every block is rebuilt from its data and the previous block's hash, so
+// a block that hashes to its stored hash also links to the one before.
+// Memory use is one segment, compressed and uncompressed.
+class ArchiveReader {
+public:
+    static constexpr std::size_t kMaxSegmentBytes = 64 << 20; // Larger segments are rejected
+
+    ArchiveReader() : fd(-1), header() {}
+
+    ArchiveReader(const ArchiveReader&) = delete;
+    ArchiveReader& operator=(const ArchiveReader&) = delete;
+
+    ~ArchiveReader() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    // Opens the archive at path and checks its header
+    bool open(const std::string& archivePath) {
+        path = archivePath;
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "Error: Could not open " << path << std::endl;
+            return false;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        if (!readAll(&header, sizeof(header)) ||
+            std::memcmp(header.magic, kArchiveMagic, sizeof(header.magic)) != 0) {
+            std::cerr << "Error: " << path << " is not a chain archive" << std::endl;
+            return false;
+        }
+        if (header.version != kArchiveVersion || (header.flags & ~kArchiveZstd) != 0) {
+            std::cerr << "Error: " << path << " is archive version " << header.version
+                      << ", which this build cannot read" << std::endl;
+            return false;
+        }
+        if ((header.flags & kArchiveZstd) != 0 && !archiveZstdAvailable()) {
+            std::cerr << "Error: " << path << " is zstd-compressed; rebuild with VOTING_ZSTD"
+                      << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t firstHeight() const { return header.firstHeight; }
+
+    Hash256 firstPrevHash() const {
+        Hash256 hash;
+        std::memcpy(hash.data(), header.prevHash, 32);
+        return hash;
+    }
+
+    bool compressed() const { return (header.flags & kArchiveZstd) != 0; }
+
+    // Calls visit(height, block) for each block in order, stopping if it
+    // returns false. Returns true once every block and the trailer have
+    // been checked; on damage it stops, before visiting the bad block, with
+    // a message on stderr.
+    template <typename Visit>
+    bool read(Visit visit) {
+        Hash256 prevHash = firstPrevHash();
+        uint64_t height = header.firstHeight;
+        std::vector<std::string_view> votes;
+        while (true) {
+            ArchiveSegment segment;
+            if (!readAll(&segment, sizeof(segment))) {
+                return fail("ends without its trailer");
+            }
+            if (segment.blockCount == 0) {
+                break;
+            }
+            if (segment.rawBytes > kMaxSegmentBytes || segment.storedBytes > kMaxSegmentBytes ||
+                (!compressed() && segment.storedBytes != segment.rawBytes)) {
+                return fail("has a damaged segment header");
+            }
+            stored.resize(segment.storedBytes);
+            if (!readAll(stored.data(), stored.size())) {
+                return fail("ends in the middle of a segment");
+            }
+            if (crc32c(stored.data(), stored.size()) != segment.checksum) {
+                return fail("has a segment that fails its checksum");
+            }
+            const std::vector<uint8_t>* raw = &stored;
+#ifdef VOTING_ZSTD
+            if (compressed()) {
+                decompressed.resize(segment.rawBytes);
+                std::size_t size = ZSTD_decompress(decompressed.data(), decompressed.size(),
+                                                   stored.data(), stored.size());
+                if (ZSTD_isError(size) || size != segment.rawBytes) {
+                    return fail("has a segment that does not decompress");
+                }
+                raw = &decompressed;
+            }
+#endif
+            const uint8_t* in = raw->data();
+            const uint8_t* end = in + raw->size();
+            for (uint32_t i = 0; i < segment.blockCount; ++i) {
+                uint64_t voteCount, dataBytes;
+                if (!getVarint(in, end, voteCount) || !getVarint(in, end, dataBytes) ||
+                    voteCount > UINT32_MAX || dataBytes > uint64_t(end - in) ||
+                    uint64_t(end - in) - dataBytes < 32) {
+                    return fail("has a truncated block", height);
+                }
+                std::string_view data(reinterpret_cast<const char*>(in), dataBytes);
+                Hash256 hash;
+                std::memcpy(hash.data(), in + dataBytes, 32);
+                in += dataBytes + 32;
+                if (voteCount > 0 && !splitVotes(data, voteCount, votes)) {
+                    return fail("has a batch block with the wrong vote count", height);
+                }
+                Block block = voteCount == 0
+                    ? Block(data, prevHash)
+                    : Block(data, prevHash, merkleLeaves(prevHash, votes));
+                if (block.hash != hash) {
+                    return fail("has a block that does not match its hash", height);
+                }
+                if (!visit(height, static_cast<const Block&>(block))) {
+                    return false;
+                }
+                prevHash = hash;
+                ++height;
+            }
+            if (in != end) {
+                return fail("has trailing bytes in a segment", height);
+            }
+        }
+        ArchiveTrailer trailer;
+        if (!readAll(&trailer, sizeof(trailer)) ||
+            crc32c(reinterpret_cast<const uint8_t*>(&trailer),
+                   offsetof(ArchiveTrailer, checksum)) != trailer.checksum) {
+            return fail("has a damaged trailer");
+        }
+        if (trailer.blockCount != height - header.firstHeight ||
+            std::memcmp(trailer.tipHash, prevHash.data(), 32) != 0) {
+            return fail("does not hold the blocks its trailer lists");
+        }
+        return true;
+    }
+
+private:
+    // Splits a batch block's data into its votes; false unless there are
+    // exactly voteCount
+    static bool splitVotes(std::string_view data, uint64_t voteCount,
+                           std::vector<std::string_view>& votes) {
+        votes.clear();
+        std::size_t start = 0;
+        for (uint64_t i = 0; i + 1 < voteCount; ++i) {
+            std::size_t end = data.find('\n', start);
+            if (end == std::string_view::npos) {
+                return false;
+            }
+            votes.push_back(data.substr(start, end - start));
+            start = end + 1;
+        }
+        votes.push_back(data.substr(start));
+        return votes.back().find('\n') == std::string_view::npos;
+    }
+
+    bool fail(const char* problem, uint64_t height = UINT64_MAX) const {
+        std::cerr << "Error: " << path << ' ' << problem;
+        if (height != UINT64_MAX) {
+            std::cerr << " at height " << height;
+        }
+        std::cerr << std::endl;
+        return false;
+    }
+
+    bool readAll(void* data, std::size_t size) {
+        uint8_t* bytes = static_cast<uint8_t*>(data);
+        std::size_t done = 0;
+        while (done < size) {
+            ssize_t n = ::read(fd, bytes + done, size - done);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            done += static_cast<std::size_t>(n);
+        }
+        return true;
+    }
+
+    std::string path;
+    int fd;
+    ArchiveHeader header;
+    std::vector<uint8_t> stored;        // The segment as read
+    std::vector<uint8_t> decompressed;  // The segment uncompressed
+};
+
+// Writes every block in the chain log in logDirectory to a new archive at
+// path. The log is only read, so it may belong to a running election.
+inline bool exportChainLog(const std::string& logDirectory, const std::string& path,
+                           bool compress, uint64_t& blocks) {
+    ArchiveWriter writer;
+    if (!writer.open(path, 0, Hash256(), compress)) {
+        return false;
+    }
+    Hash256 tip = Hash256();
+    Hash256 prevHash, hash;
+    std::string data;
+    std::vector<std::string> votes;
+    bool scanned = ChainLog::scan(logDirectory,
+        [&](uint8_t type, const uint8_t* payload, std::size_t size) {
+            if (type != BlockRecord) {
+                return true;
+            }
+            if (!Blockchain::decodeBlockRecord(payload, size, prevHash, hash, data, votes) ||
+                prevHash != tip) {
+                std::cerr << "Error: Block " << writer.blocks() << " in " << logDirectory
+                          << " does not extend the chain" << std::endl;
+                return false;
+            }
+            tip = hash;
+            return writer.add(static_cast<uint32_t>(votes.size()), data, hash);
+        });
+    blocks = writer.blocks();
+    return scanned && writer.finish();
+}
+
+// Rebuilds a chain log in logDirectory, which must not hold one yet, from
+// the archive at path, verifying every block before it is logged. At most
+// a few segments' worth of records wait for the log to make them durable,
+// so memory use does not grow with the chain. If the archive turns out to
+// be damaged, the blocks before the damage stay in the log.
+inline bool importArchive(const std::string& path, const std::string& logDirectory,
+                          uint64_t& blocks) {
+    blocks = 0;
+    ArchiveReader reader;
+    if (!reader.open(path)) {
+        return false;
+    }
+    if (reader.firstHeight() != 0) {
+        std::cerr << "Error: " << path << " starts at height " << reader.firstHeight()
+                  << "; only an archive from the genesis block can be imported" << std::endl;
+        return false;
+    }
+    ChainLog log;
+    bool empty = true;
+    if (!log.open(logDirectory, ChainLog::Options(),
+                  [&empty](uint8_t, const uint8_t*, std::size_t) {
+                      empty = false;
+                      return true;
+                  }) ||
+        !empty) {
+        std::cerr << "Error: " << logDirectory << " already holds a chain log" << std::endl;
+        return false;
+    }
+    const std::size_t windowBytes = 4 * ArchiveWriter::kSegmentBytes;
+    std::size_t unsyncedBytes = 0;
+    uint64_t previousWindow = 0;  // Last record of the window before the open one
+    std::vector<uint8_t> record;
+    bool read = reader.read([&](uint64_t, const Block& block) {
+        Blockchain::encodeBlockRecord(block, record);
+        uint64_t seq = log.append(BlockRecord, record.data(), record.size());
+        ++blocks;
+        unsyncedBytes += record.size();
+        if (unsyncedBytes >= windowBytes) {
+            // Let the log catch up to the window before last
+            if (previousWindow != 0 && !log.waitDurable(previousWindow)) {
+                return false;
+            }
+            previousWindow = seq;
+            unsyncedBytes = 0;
+        }
+        return true;
+    });
+    if (!log.sync()) {
+        std::cerr << "Error: Could not write the chain log in " << logDirectory << std::endl;
+        return false;
+    }
+    return read;
+}
+
+#endif  // CHAIN_ARCHIVE_H
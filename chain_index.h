@@ -0,0 +1,433 @@
+#ifndef CHAIN_INDEX_H
+#define CHAIN_INDEX_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "hash256.h"
+
+// A read-write mapping that can grow: backed by a file when opened with a
+// path, by anonymous memory otherwise. Growing may move the mapping, so
+// pointers into data() are only good until the next resize().
+class GrowableMapping {
+public:
+    GrowableMapping() : fd(-1), base(nullptr), length(0) {}
+
+    GrowableMapping(const GrowableMapping&) = delete;
+    GrowableMapping& operator=(const GrowableMapping&) = delete;
+
+    ~GrowableMapping() { close(); }
+
+    // Maps the file at path, creating it if needed, or anonymous memory if
+    // path is empty; at least minimumBytes are mapped
+    bool open(const std::string& path, std::size_t minimumBytes) {
+        close();
+        filePath = path;
+        std::size_t existing = 0;
+        if (!path.empty()) {
+            fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+            struct stat info;
+            if (fd < 0 || fstat(fd, &info) != 0) {
+                close();
+                return false;
+            }
+            existing = static_cast<std::size_t>(info.st_size);
+        }
+        return resize(existing > minimumBytes ? existing : minimumBytes);
+    }
+
+    // Grows (or shrinks) the mapping to bytes; new bytes read as zero
+    bool resize(std::size_t bytes) {
+        if (fd >= 0 && ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+            return false;
+        }
+        void* mapped;
+        if (base == nullptr) {
+            mapped = fd >= 0 ? mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                             : mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        } else {
+            mapped = mremap(base, length, bytes, MREMAP_MAYMOVE);
+        }
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        base = static_cast<char*>(mapped);
+        length = bytes;
+        return true;
+    }
+
+    // Starts writing dirty pages back to the file
+    void flush() const {
+        if (fd >= 0 && base != nullptr) {
+            msync(base, length, MS_ASYNC);
+        }
+    }
+
+    // Writes the mapping back to the file and waits until it is on disk
+    bool sync() const {
+        return fd < 0 || (msync(base, length, MS_SYNC) == 0 && fsync(fd) == 0);
+    }
+
+    // Renames the backing file to path, replacing any file there, and
+    // makes the rename durable
+    bool moveTo(const std::string& path) {
+        if (fd < 0 || std::rename(filePath.c_str(), path.c_str()) != 0) {
+            return false;
+        }
+        filePath = path;
+        std::string directory = path.substr(0, path.find_last_of('/') + 1);
+        int dirFd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY);
+        if (dirFd >= 0) {
+            fsync(dirFd);
+            ::close(dirFd);
+        }
+        return true;
+    }
+
+    void swap(GrowableMapping& other) {
+        std::swap(fd, other.fd);
+        std::swap(base, other.base);
+        std::swap(length, other.length);
+        std::swap(filePath, other.filePath);
+    }
+
+    // Backing file, empty for anonymous memory
+    const std::string& path() const { return filePath; }
+
+    void close() {
+        if (base != nullptr) {
+            munmap(base, length);
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        fd = -1;
+        base = nullptr;
+        length = 0;
+        filePath.clear();
+    }
+
+    char* data() { return base; }
+    const char* data() const { return base; }
+    std::size_t size() const { return length; }
+
+private:
+    int fd;
+    char* base;
+    std::size_t length;
+    std::string filePath;
+};
+
+// Where a block's record sits in the chain log, and its hash
+struct IndexedBlock {
+    Hash256 hash;
+    uint32_t segment;     // Log segment holding the block record
+    uint32_t recordBytes; // Framed size of the record
+    uint64_t offset;      // Offset of the record's frame in the segment
+};
+
+// Secondary indexes over the chain for read traffic, kept in three files
+// that are used straight from a shared mapping and survive restarts:
+//   heights.idx   IndexedBlock per height, in height order
+//   hashes.idx    block hash -> height
+//   receipts.idx  vote receipt -> height and position in the block
+// Each file starts with a 64-byte header. The two maps are open-addressing
+// tables keyed by the first eight bytes of the hash, at most half full;
+// a key match is only a candidate, which the caller confirms against the
+// full hash. A map's header records the heights it may hold entries for;
+// open() cuts all three files back to the heights both maps agree on, so a
+// crash between updating one file and the next loses indexed heights
+// instead of leaving stray map entries.
+// Maps are rehashed into a new file that is renamed over the old one.
+//
+// Blocks are added in height order by the appending thread. Lookups may
+// not run concurrently with add() or truncate().
+class ChainIndex {
+public:
+    // A receipt table entry
+    struct ReceiptSlot {
+        uint64_t key;
+        uint64_t height;
+        uint32_t index;  // Position inside a batch block, 0 for a single-vote block
+        uint32_t reserved;
+    };
+
+    // Opens the index files in directory, creating them if needed; an empty
+    // directory keeps the indexes in memory. False if a file cannot be
+    // mapped or is not an index of this version.
+    bool open(const std::string& directory) {
+        if (!directory.empty()) {
+            mkdir(directory.c_str(), 0755);
+        }
+        std::string prefix = directory.empty() ? std::string() : directory + "/";
+        if (!openFile(heights, directory.empty() ? "" : prefix + "heights.idx", kHeightsMagic,
+                      sizeof(IndexedBlock), 0) ||
+            !openFile(hashes, directory.empty() ? "" : prefix + "hashes.idx", kHashesMagic,
+                      sizeof(HashSlot), kInitialSlots) ||
+            !openFile(receipts, directory.empty() ? "" : prefix + "receipts.idx",
+                      kReceiptsMagic, sizeof(ReceiptSlot), kInitialSlots)) {
+            return false;
+        }
+        uint64_t count = header(heights).count;
+        if (header(hashes).heights == count && header(receipts).heights == count) {
+            return true;
+        }
+        // Left mid-update: keep the heights both maps cover, drop the rest
+        count = std::min(count, std::min(header(hashes).heights, header(receipts).heights));
+        header(heights).count = count;
+        return rebuild(hashes, count) && rebuild(receipts, count);
+    }
+
+    // Heights indexed so far: every height below this one
+    uint64_t size() const { return isOpen() ? header(heights).count : 0; }
+
+    bool isOpen() const { return heights.size() != 0; }
+
+    // Indexes the block at height, which must be size(), with the receipts
+    // of its votes: its own hash for a single-vote block, its Merkle leaves
+    // for a batch block, nothing for the genesis block
+    bool add(uint64_t height, const IndexedBlock& block, const Hash256* voteReceipts,
+             std::size_t receiptCount) {
+        if (height != size() || !reserve(receipts, receiptCount) || !reserve(hashes, 1)) {
+            return false;
+        }
+        std::size_t needed = kHeaderBytes + (height + 1) * sizeof(IndexedBlock);
+        if (needed > heights.size() && !heights.resize(std::max(needed, 2 * heights.size()))) {
+            return false;
+        }
+        // The maps claim the height before taking its entries, so open()
+        // drops a half-inserted height instead of keeping its entries
+        header(hashes).heights = height + 1;
+        header(receipts).heights = height + 1;
+        insertHash(keyOf(block.hash), height);
+        for (std::size_t i = 0; i < receiptCount; ++i) {
+            insertReceipt(ReceiptSlot{keyOf(voteReceipts[i]), height, uint32_t(i), 0});
+        }
+        // The height entry goes last: a block is only indexed once it is counted
+        std::memcpy(heights.data() + kHeaderBytes + height * sizeof(IndexedBlock), &block,
+                    sizeof(block));
+        header(heights).count = height + 1;
+        return true;
+    }
+
+    // The entry for an indexed height
+    const IndexedBlock& at(uint64_t height) const {
+        return reinterpret_cast<const IndexedBlock*>(heights.data() + kHeaderBytes)[height];
+    }
+
+    // Height of the block with hash
+    bool findHeight(const Hash256& hash, uint64_t& height) const {
+        bool found = false;
+        probe(hashes, keyOf(hash), [&](const char* slot) {
+            const HashSlot& entry = *reinterpret_cast<const HashSlot*>(slot);
+            if (entry.height < size() && at(entry.height).hash == hash) {
+                height = entry.height;
+                found = true;
+            }
+            return !found;
+        });
+        return found;
+    }
+
+    // Calls visit(height, index) for each vote whose receipt shares the
+    // first eight bytes of receipt, until visit returns false
+    template <typename Visit>
+    void forEachReceiptCandidate(const Hash256& receipt, Visit visit) const {
+        probe(receipts, keyOf(receipt), [&](const char* slot) {
+            const ReceiptSlot& entry = *reinterpret_cast<const ReceiptSlot*>(slot);
+            return entry.height >= size() || visit(entry.height, entry.index);
+        });
+    }
+
+    // Forgets every height from count on, e.g. blocks lost from a torn log
+    // tail; the maps are rebuilt without their entries
+    bool truncate(uint64_t count) {
+        if (count >= size()) {
+            return true;
+        }
+        if (!rebuild(hashes, count) || !rebuild(receipts, count)) {
+            return false;
+        }
+        header(heights).count = count;
+        return true;
+    }
+
+    // Starts writing the indexes back to their files
+    void flush() const {
+        heights.flush();
+        hashes.flush();
+        receipts.flush();
+    }
+
+private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t entryBytes;
+        uint64_t count;    // Heights, or occupied slots of a table
+        uint64_t slots;    // Table capacity, a power of two; 0 for heights.idx
+        uint64_t heights;  // Heights a table holds the entries of; 0 for heights.idx
+        uint8_t reserved[24];
+    };
+
+    struct HashSlot {
+        uint64_t key;
+        uint64_t height;
+    };
+
+    static constexpr std::size_t kHeaderBytes = 64;
+    static constexpr uint32_t kVersion = 1;
+    static constexpr uint64_t kInitialSlots = 1024;
+    static constexpr char kHeightsMagic[8] = {'B', 'C', 'V', 'H', 'G', 'T', 'S', '\0'};
+    static constexpr char kHashesMagic[8] = {'B', 'C', 'V', 'H', 'S', 'H', 'S', '\0'};
+    static constexpr char kReceiptsMagic[8] = {'B', 'C', 'V', 'R', 'C', 'P', 'T', '\0'};
+
+    static_assert(sizeof(Header) == kHeaderBytes, "index header layout");
+
+    // Table key of a hash; 0 marks an empty slot, so it is never used
+    static uint64_t keyOf(const Hash256& hash) {
+        uint64_t key;
+        std::memcpy(&key, hash.data(), sizeof(key));
+        return key == 0 ? 1 : key;
+    }
+
+    static Header& header(GrowableMapping& file) {
+        return *reinterpret_cast<Header*>(file.data());
+    }
+    static const Header& header(const GrowableMapping& file) {
+        return *reinterpret_cast<const Header*>(file.data());
+    }
+
+    static bool openFile(GrowableMapping& file, const std::string& path, const char* magic,
+                         uint32_t entryBytes, uint64_t slots) {
+        if (!file.open(path, kHeaderBytes + slots * entryBytes)) {
+            return false;
+        }
+        Header& head = header(file);
+        if (head.magic[0] == '\0') {  // new file
+            std::memcpy(head.magic, magic, sizeof(head.magic));
+            head.version = kVersion;
+            head.entryBytes = entryBytes;
+            head.count = 0;
+            head.slots = slots;
+            head.heights = 0;
+        }
+        uint64_t capacity = head.slots != 0 ? head.slots
+                                            : (file.size() - kHeaderBytes) / entryBytes;
+        return std::memcmp(head.magic, magic, sizeof(head.magic)) == 0 &&
+               head.version == kVersion && head.entryBytes == entryBytes &&
+               (head.slots & (head.slots - 1)) == 0 &&
+               file.size() >= kHeaderBytes + capacity * entryBytes && head.count <= capacity;
+    }
+
+    // Visits the occupied slots from key's home slot up to the first empty
+    // one, calling visit(slot) on each whose key matches until it returns false
+    template <typename Visit>
+    static void probe(const GrowableMapping& table, uint64_t key, Visit visit) {
+        const Header& head = header(table);
+        const char* slots = table.data() + kHeaderBytes;
+        uint64_t mask = head.slots - 1;
+        for (uint64_t i = mix(key) & mask;; i = (i + 1) & mask) {
+            const char* slot = slots + i * head.entryBytes;
+            uint64_t slotKey;
+            std::memcpy(&slotKey, slot, sizeof(slotKey));
+            if (slotKey == 0 || (slotKey == key && !visit(slot))) {
+                return;
+            }
+        }
+    }
+
+    static uint64_t mix(uint64_t key) {
+        return key * 0x9E3779B97F4A7C15ULL >> 16;  // the key is already random
+    }
+
+    static void insert(GrowableMapping& table, const void* entry) {
+        Header& head = header(table);
+        uint64_t key;
+        std::memcpy(&key, entry, sizeof(key));
+        char* slots = table.data() + kHeaderBytes;
+        uint64_t mask = head.slots - 1;
+        uint64_t i = mix(key) & mask;
+        while (std::memcmp(slots + i * head.entryBytes, "\0\0\0\0\0\0\0\0", 8) != 0) {
+            i = (i + 1) & mask;
+        }
+        std::memcpy(slots + i * head.entryBytes, entry, head.entryBytes);
+        ++head.count;
+    }
+
+    void insertHash(uint64_t key, uint64_t height) {
+        HashSlot slot{key, height};
+        insert(hashes, &slot);
+    }
+
+    void insertReceipt(const ReceiptSlot& slot) {
+        insert(receipts, &slot);
+    }
+
+    // Makes room for extra more entries, keeping the table at most half full
+    static bool reserve(GrowableMapping& table, std::size_t extra) {
+        Header& head = header(table);
+        uint64_t slots = head.slots;
+        while (2 * (head.count + extra) > slots) {
+            slots *= 2;
+        }
+        return slots == head.slots || rehash(table, slots, UINT64_MAX);
+    }
+
+    // Drops the entries for heights from count on
+    static bool rebuild(GrowableMapping& table, uint64_t count) {
+        return rehash(table, header(table).slots, count);
+    }
+
+    // Reinserts the entries below height limit into a table of slots
+    // slots. A file-backed table is built in PATH.tmp, synced and renamed
+    // over the old file, so a crash leaves one table or the other whole.
+    static bool rehash(GrowableMapping& table, uint64_t slots, uint64_t limit) {
+        std::string temporary = table.path().empty() ? std::string() : table.path() + ".tmp";
+        if (!temporary.empty()) {
+            std::remove(temporary.c_str());
+        }
+        GrowableMapping rebuilt;
+        if (!rebuilt.open(temporary, kHeaderBytes + slots * header(table).entryBytes)) {
+            return false;
+        }
+        const Header& head = header(table);
+        Header& next = header(rebuilt);
+        std::memcpy(&next, &head, sizeof(Header));
+        next.slots = slots;
+        next.count = 0;
+        next.heights = std::min(head.heights, limit);
+        const char* old = table.data() + kHeaderBytes;
+        for (uint64_t i = 0; i < head.slots; ++i) {
+            const char* slot = old + i * head.entryBytes;
+            uint64_t key, height;
+            std::memcpy(&key, slot, sizeof(key));
+            std::memcpy(&height, slot + 8, sizeof(height));
+            if (key != 0 && height < limit) {
+                insert(rebuilt, slot);
+            }
+        }
+        if (!temporary.empty() && (!rebuilt.sync() || !rebuilt.moveTo(table.path()))) {
+            std::remove(temporary.c_str());
+            return false;
+        }
+        table.swap(rebuilt);
+        return true;
+    }
+
+    GrowableMapping heights;
+    GrowableMapping hashes;
+    GrowableMapping receipts;
+};
+
+#endif  // CHAIN_INDEX_H
@@ -0,0 +1,512 @@
+#ifndef CHAIN_LOG_H
+#define CHAIN_LOG_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mapped_file.h"
+
+// CRC-32C (Castagnoli), used to detect torn or corrupted log records
+inline uint32_t crc32c(const uint8_t* data, std::size_t size, uint32_t crc = 0) {
+    static const struct Table {
+        uint32_t entries[256];
+        Table() {
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t value = i;
+                for (int bit = 0; bit < 8; ++bit) {
+                    value = (value >> 1) ^ (0x82F63B78u & (0u - (value & 1)));
+                }
+                entries[i] = value;
+            }
+        }
+    } table;
+    crc = ~crc;
+    for (std::size_t i = 0; i < size; ++i) {
+        crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// Record types the voting system writes to the chain log
+enum LogRecordType : uint8_t {
+    BlockRecord = 1, // An appended block
+    VotedRecord = 2, // A voter marked as voted; logged before the voter's block
+    RegistryDeltaRecord = 3  // A registry delta; logged before it takes effect
+};
+
+// A point in the log: the byte offset just past a record in a segment
+struct LogPosition {
+    uint32_t segment = 0;
+    uint64_t offset = 0;
+};
+
+// Durable, append-only log of typed records, split into numbered segment
+// files (chain-000000.log, chain-000001.log, ...) inside one directory.
+//
+// Each record is framed as
+//   u32 length | u32 crc32c | u8 type | payload
+// where length counts the type byte and the payload, and the checksum
+// covers the same bytes. Appends only copy the record into memory; a
+// background thread group-commits everything appended within the
+// durability window with one write and one fdatasync per segment touched.
+class ChainLog {
+public:
+    struct Options {
+        unsigned durabilityWindowMicros = 2000; // Longest an append waits for fdatasync
+        std::size_t maxPendingBytes = 4 << 20;  // Flush early once this much is buffered
+        std::size_t segmentBytes = 64 << 20;    // Start a new segment past this size
+    };
+
+    // Called after every group commit with the highest durable sequence number
+    typedef std::function<void(uint64_t)> DurableCallback;
+
+    ChainLog()
+        : fd(-1), openSegmentNumber(0), segment(0), segmentSize(0), nextSeq(1), durableSeq(0),
+          failed(false), stopping(false), syncRequested(false), pendingBytes(0) {}
+
+    ChainLog(const ChainLog&) = delete;
+    ChainLog& operator=(const ChainLog&) = delete;
+
+    // Commits anything still buffered and closes the log
+    ~ChainLog() { close(); }
+
+    // Opens or creates the log in directory and replays every intact record
+    // in order through visit(type, data, size). A torn record at the end of
+    // the last segment (a crash mid-write) is cut off; damage anywhere else,
+    // or visit returning false, fails the open.
+    template <typename Visit>
+    bool open(const std::string& directory, const Options& logOptions, Visit visit) {
+        return open(directory, logOptions, LogPosition(), visit);
+    }
+
+    // Same, but replays only the records after from, which must be a
+    // position this log returned from append() and has made durable
+    template <typename Visit>
+    bool open(const std::string& directory, const Options& logOptions, const LogPosition& from,
+              Visit visit) {
+        close();
+        dir = directory;
+        options = logOptions;
+        mkdir(dir.c_str(), 0755);
+        segmentSize = 0;
+
+        std::vector<uint32_t> segments = listSegments();
+        if ((from.segment > 0 || from.offset > 0) &&
+            !std::binary_search(segments.begin(), segments.end(), from.segment)) {
+            std::cerr << "Chain log segment " << segmentPath(from.segment) << " is missing"
+                      << std::endl;
+            return false;
+        }
+        for (std::size_t i = 0; i < segments.size(); ++i) {
+            if (segments[i] < from.segment) {
+                continue;
+            }
+            bool last = i + 1 == segments.size();
+            uint64_t start = segments[i] == from.segment ? from.offset : 0;
+            if (!replaySegment(segments[i], last, start, visit)) {
+                return false;
+            }
+        }
+        segment = segments.empty() ? 0 : segments.back();
+        if (!openSegment(segment)) {
+            return false;
+        }
+        durablePosition.segment = segment;
+        durablePosition.offset = segmentSize;
+        failed = false;
+        stopping = false;
+        flusher = std::thread([this] { run(); });
+        return true;
+    }
+
+    // Reads every intact record of the log in directory through
+    // visit(type, data, size) without opening it for appending, so nothing
+    // is cut off and the log may be in use by another process; a record
+    // still being written at the end is not visited
+    template <typename Visit>
+    static bool scan(const std::string& directory, Visit visit) {
+        ChainLog reader;
+        reader.dir = directory;
+        std::vector<uint32_t> segments = reader.listSegments();
+        for (std::size_t i = 0; i < segments.size(); ++i) {
+            if (!reader.replaySegment(segments[i], i + 1 == segments.size(), 0, visit, false)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Commits anything still buffered and stops the flusher thread
+    void close() {
+        if (flusher.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(stateLock);
+                stopping = true;
+            }
+            workReady.notify_one();
+            flusher.join();
+        }
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    void setDurableCallback(DurableCallback callback) {
+        std::lock_guard<std::mutex> lock(stateLock);
+        onDurable = std::move(callback);
+    }
+
+    // Buffers a record and returns its sequence number; the record becomes
+    // durable within the durability window. If end is given it receives the
+    // position just past the record. Once the log has failed the record is
+    // dropped, and waitDurable reports it as never made durable.
+    uint64_t append(uint8_t type, const void* payload, std::size_t size,
+                    LogPosition* end = nullptr) {
+        uint8_t header[kHeaderBytes];
+        uint32_t length = static_cast<uint32_t>(size + 1);
+        uint32_t crc = crc32c(&type, 1);
+        crc = crc32c(static_cast<const uint8_t*>(payload), size, crc);
+        std::memcpy(header, &length, 4);
+        std::memcpy(header + 4, &crc, 4);
+        header[8] = type;
+
+        std::unique_lock<std::mutex> lock(stateLock);
+        if (failed) {
+            if (end != nullptr) {
+                end->segment = segment;
+                end->offset = segmentSize;
+            }
+            return nextSeq++;
+        }
+        if (segmentSize > 0 && segmentSize + sizeof(header) + size > options.segmentBytes) {
+            ++segment;
+            segmentSize = 0;
+        }
+        if (pending.empty() || pending.back().first != segment) {
+            pending.emplace_back(segment, std::vector<uint8_t>());
+        }
+        std::vector<uint8_t>& buffer = pending.back().second;
+        buffer.insert(buffer.end(), header, header + sizeof(header));
+        buffer.insert(buffer.end(), static_cast<const uint8_t*>(payload),
+                      static_cast<const uint8_t*>(payload) + size);
+        segmentSize += sizeof(header) + size;
+        pendingBytes += sizeof(header) + size;
+        if (end != nullptr) {
+            end->segment = segment;
+            end->offset = segmentSize;
+        }
+        bool wake = pendingBytes == sizeof(header) + size || pendingBytes >= options.maxPendingBytes;
+        uint64_t seq = nextSeq++;
+        lock.unlock();
+        if (wake) {
+            workReady.notify_one();
+        }
+        return seq;
+    }
+
+    // Blocks until the record with the given sequence number is durable;
+    // returns false if the log hit an I/O error first. Nothing becomes
+    // durable after an error, so every later record gets false as well.
+    bool waitDurable(uint64_t seq) {
+        std::unique_lock<std::mutex> lock(stateLock);
+        durable.wait(lock, [this, seq] { return durableSeq >= seq || failed; });
+        return durableSeq >= seq;
+    }
+
+    // Commits everything appended so far without waiting out the window
+    bool sync() {
+        uint64_t last;
+        {
+            std::lock_guard<std::mutex> lock(stateLock);
+            last = nextSeq - 1;
+            syncRequested = last > durableSeq;
+        }
+        workReady.notify_one();
+        return waitDurable(last);
+    }
+
+    // Position just past the last record appended or replayed so far
+    LogPosition end() const {
+        std::lock_guard<std::mutex> lock(stateLock);
+        LogPosition position;
+        position.segment = segment;
+        position.offset = segmentSize;
+        return position;
+    }
+
+    bool ok() const {
+        std::lock_guard<std::mutex> lock(stateLock);
+        return !failed;
+    }
+
+    // Sequence number of the last record appended so far
+    uint64_t lastSequence() const {
+        std::lock_guard<std::mutex> lock(stateLock);
+        return nextSeq - 1;
+    }
+
+    // Position just past the last record known to be on disk. Everything
+    // before it in its segment, and all earlier segments, can be read from
+    // the segment files.
+    LogPosition durableEnd() const {
+        std::lock_guard<std::mutex> lock(stateLock);
+        return durablePosition;
+    }
+
+    // Waits up to timeout for the durable end to move past after; returns
+    // whether it has
+    bool waitDurablePast(const LogPosition& after, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(stateLock);
+        return durable.wait_for(lock, timeout, [this, &after] {
+            return durablePosition.segment != after.segment ||
+                   durablePosition.offset != after.offset;
+        });
+    }
+
+    // Opens a segment file for reading; -1 if it does not exist
+    int openSegmentForReading(uint32_t number) const {
+        return ::open(segmentPath(number).c_str(), O_RDONLY);
+    }
+
+    // While open() replays, where the frame of the record being visited
+    // starts
+    LogPosition replayPosition() const {
+        return replaying;
+    }
+
+    // Framed size of a record with a payload of size bytes
+    static std::size_t frameBytes(std::size_t size) {
+        return kHeaderBytes + size;
+    }
+
+    // Reads back the durable record whose frame starts at position and is
+    // frameBytes long; false if it is not on disk intact
+    bool readRecord(const LogPosition& position, std::size_t frameBytes, uint8_t& type,
+                    std::vector<uint8_t>& payload) const {
+        if (frameBytes <= kHeaderBytes) {
+            return false;
+        }
+        std::vector<uint8_t> frame(frameBytes);
+        int file = ::open(segmentPath(position.segment).c_str(), O_RDONLY);
+        if (file < 0) {
+            return false;
+        }
+        ssize_t read = pread(file, frame.data(), frameBytes, static_cast<off_t>(position.offset));
+        ::close(file);
+        uint32_t length, crc;
+        std::memcpy(&length, &frame[0], 4);
+        std::memcpy(&crc, &frame[4], 4);
+        if (read != static_cast<ssize_t>(frameBytes) || length != frameBytes - 8 ||
+            crc32c(&frame[8], length) != crc) {
+            return false;
+        }
+        type = frame[8];
+        payload.assign(frame.begin() + kHeaderBytes, frame.end());
+        return true;
+    }
+
+private:
+    static constexpr std::size_t kHeaderBytes = 9;
+
+    std::string segmentPath(uint32_t number) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "chain-%06u.log", number);
+        return dir + "/" + name;
+    }
+
+    std::vector<uint32_t> listSegments() const {
+        std::vector<uint32_t> segments;
+        DIR* handle = opendir(dir.c_str());
+        if (handle == nullptr) {
+            return segments;
+        }
+        while (dirent* entry = readdir(handle)) {
+            unsigned number;
+            char tail;
+            if (std::sscanf(entry->d_name, "chain-%6u.lo%c", &number, &tail) == 2 && tail == 'g') {
+                segments.push_back(number);
+            }
+        }
+        closedir(handle);
+        std::sort(segments.begin(), segments.end());
+        return segments;
+    }
+
+    // Replays the records of one segment from start on, cutting a torn
+    // last record off the last segment if repair is set
+    template <typename Visit>
+    bool replaySegment(uint32_t number, bool last, uint64_t start, Visit& visit,
+                       bool repair = true) {
+        std::string path = segmentPath(number);
+        MappedFile file;
+        if (!file.open(path)) {
+            return false;
+        }
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(file.data());
+        std::size_t size = file.size();
+        if (start > size) {
+            std::cerr << "Chain log segment " << path << " ends before offset " << start
+                      << std::endl;
+            return false;
+        }
+
+        std::size_t offset = static_cast<std::size_t>(start);
+        while (offset + kHeaderBytes <= size) {
+            uint32_t length, crc;
+            std::memcpy(&length, bytes + offset, 4);
+            std::memcpy(&crc, bytes + offset + 4, 4);
+            if (length == 0 || length > size - offset - 8 ||
+                crc32c(bytes + offset + 8, length) != crc) {
+                break;
+            }
+            replaying.segment = number;
+            replaying.offset = offset;
+            if (!visit(bytes[offset + 8], bytes + offset + 9, std::size_t(length - 1))) {
+                std::cerr << "Chain log record rejected in " << path << " at offset " << offset
+                          << std::endl;
+                return false;
+            }
+            offset += 8 + length;
+        }
+        file.close();
+        if (offset != size) {
+            if (!last) {
+                std::cerr << "Chain log segment " << path << " is damaged at offset " << offset
+                          << std::endl;
+                return false;
+            }
+            // torn write from a crash: drop the partial record
+            if (repair && truncate(path.c_str(), static_cast<off_t>(offset)) != 0) {
+                return false;
+            }
+        }
+        segmentSize = offset;
+        return true;
+    }
+
+    bool openSegment(uint32_t number) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        fd = ::open(segmentPath(number).c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        // make the new directory entry itself durable
+        int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if (dirFd >= 0) {
+            fsync(dirFd);
+            ::close(dirFd);
+        }
+        openSegmentNumber = number;
+        return true;
+    }
+
+    bool writeAll(const std::vector<uint8_t>& bytes) {
+        std::size_t written = 0;
+        while (written < bytes.size()) {
+            ssize_t n = ::write(fd, bytes.data() + written, bytes.size() - written);
+            if (n < 0) {
+                return false;
+            }
+            written += static_cast<std::size_t>(n);
+        }
+        return true;
+    }
+
+    // Flusher loop: waits for the first pending record, lets the durability
+    // window fill, then writes and syncs the whole group at once. After the
+    // first failed group it writes nothing more: a failed write may leave a
+    // torn frame, and replay stops there, so nothing past it could be read
+    // back even if a later write succeeded.
+    void run() {
+        std::unique_lock<std::mutex> lock(stateLock);
+        while (true) {
+            workReady.wait(lock, [this] { return stopping || !pending.empty(); });
+            if (pending.empty()) {
+                return;
+            }
+            auto deadline = std::chrono::steady_clock::now() +
+                            std::chrono::microseconds(options.durabilityWindowMicros);
+            workReady.wait_until(lock, deadline, [this] {
+                return stopping || syncRequested || pendingBytes >= options.maxPendingBytes;
+            });
+            std::vector<std::pair<uint32_t, std::vector<uint8_t>>> group;
+            group.swap(pending);
+            pendingBytes = 0;
+            syncRequested = false;
+            if (failed) {
+                continue;
+            }
+            uint64_t groupEnd = nextSeq - 1;
+            LogPosition groupEndPosition;
+            groupEndPosition.segment = segment;
+            groupEndPosition.offset = segmentSize;
+            lock.unlock();
+
+            bool written = true;
+            for (auto& part : group) {
+                if (part.first != openSegmentNumber) {
+                    written = written && fdatasync(fd) == 0 && openSegment(part.first);
+                }
+                written = written && writeAll(part.second);
+            }
+            written = written && fdatasync(fd) == 0;
+
+            lock.lock();
+            if (!written) {
+                failed = true;
+                std::cerr << "Unable to write chain log in " << dir << std::endl;
+            } else {
+                durableSeq = groupEnd;
+                durablePosition = groupEndPosition;
+                if (onDurable) {
+                    DurableCallback callback = onDurable;
+                    lock.unlock();
+                    callback(groupEnd);
+                    lock.lock();
+                }
+            }
+            durable.notify_all();
+        }
+    }
+
+    std::string dir;
+    Options options;
+    int fd;
+    uint32_t openSegmentNumber; // Segment fd refers to
+    uint32_t segment;        // Segment the next append goes to
+    std::size_t segmentSize; // Bytes assigned to that segment so far
+    LogPosition replaying;   // Frame of the record being replayed
+
+    mutable std::mutex stateLock;
+    std::condition_variable workReady;
+    std::condition_variable durable;
+    uint64_t nextSeq;
+    uint64_t durableSeq;
+    LogPosition durablePosition; // End of the last group commit
+    bool failed;
+    bool stopping;
+    bool syncRequested;
+    std::size_t pendingBytes;
+    std::vector<std::pair<uint32_t, std::vector<uint8_t>>> pending;
+    DurableCallback onDurable;
+    std::thread flusher;
+};
+
+#endif  // CHAIN_LOG_H
@@ -0,0 +1,230 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "chain_log.h"
+#include "mapped_file.h"
+
+// On-disk snapshot of everything a restart needs besides the log suffix:
+// the chain tip, the tally counts as of the tip, the registry deltas
+// logged before the tip and the registry's voted flags, together with the
+// log position just past the tip's block record.
+//
+// The file is laid out so it can be used straight from a read-only mapping:
+//   CheckpointHeader
+//   u64 counts[bucketCount]
+//   u64 votedWords[(voterCount + 63) / 64]
+//   tip block record (the chain log's BlockRecord payload)
+//   deltaCount times: u64 size | the delta's bytes (deltaBytes in all)
+// All integers are little endian. The header's checksum is a CRC-32C over
+// the header up to the checksum field followed by the rest of the file.
+struct CheckpointHeader {
+    char magic[8];          // "BCVCKPT" and a NUL
+    uint32_t version;
+    uint32_t headerBytes;
+    uint64_t height;        // Height of the tip block
+    uint32_t logSegment;    // Log position just past the tip's block record
+    uint32_t reserved;
+    uint64_t logOffset;
+    uint64_t bucketCount;
+    uint64_t voterCount;    // Registry rows the voted flags cover
+    uint64_t registryBytes; // Size of the registry file the rows came from
+    uint64_t tipBlockBytes;
+    uint64_t fileVoterCount; // Rows of the registry file, before the deltas
+    uint64_t deltaCount;
+    uint64_t deltaBytes;
+    uint32_t checksum;
+    uint32_t reserved2;
+};
+
+// Checkpoint contents as captured from a running election
+struct CheckpointData {
+    uint64_t height = 0;
+    LogPosition logEnd;
+    std::vector<uint64_t> counts;
+    uint64_t voterCount = 0;
+    uint64_t registryBytes = 0;
+    uint64_t fileVoterCount = 0;
+    std::vector<uint64_t> votedWords;
+    std::vector<uint8_t> tipBlock;
+    std::vector<std::string> deltas; // Registry deltas in the order they were applied
+};
+
+// Read-only view of a checkpoint file, validated and mapped by open()
+class CheckpointFile {
+public:
+    static constexpr uint32_t kVersion = 2;
+
+    CheckpointFile() : header(nullptr) {}
+
+    // Maps and validates the checkpoint at path; false if it is missing,
+    // truncated, from another version or fails its checksum
+    bool open(const std::string& path) {
+        header = nullptr;
+        if (!file.open(path) || file.size() < sizeof(CheckpointHeader)) {
+            return false;
+        }
+        const CheckpointHeader* candidate = reinterpret_cast<const CheckpointHeader*>(file.data());
+        if (std::memcmp(candidate->magic, kMagic, sizeof(kMagic)) != 0 ||
+            candidate->version != kVersion || candidate->headerBytes != sizeof(CheckpointHeader) ||
+            candidate->bucketCount > (1 << 16) || candidate->voterCount > (uint64_t(1) << 40)) {
+            return false;
+        }
+        uint64_t expected = sizeof(CheckpointHeader) + 8 * candidate->bucketCount +
+                            8 * ((candidate->voterCount + 63) / 64) + candidate->tipBlockBytes;
+        if (candidate->tipBlockBytes > file.size() || candidate->deltaBytes > file.size() ||
+            file.size() - candidate->deltaBytes != expected ||
+            checksumOf(file.data(), file.size()) != candidate->checksum) {
+            return false;
+        }
+        header = candidate;
+        // Every delta must fit the delta section exactly
+        std::vector<std::string_view> all = deltas();
+        std::size_t framed = 0;
+        for (std::string_view delta : all) {
+            framed += 8 + delta.size();
+        }
+        if (all.size() != header->deltaCount || framed != header->deltaBytes) {
+            header = nullptr;
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t height() const { return header->height; }
+    LogPosition logEnd() const {
+        LogPosition position;
+        position.segment = header->logSegment;
+        position.offset = header->logOffset;
+        return position;
+    }
+    uint64_t voterCount() const { return header->voterCount; }
+    uint64_t registryBytes() const { return header->registryBytes; }
+    uint64_t fileVoterCount() const { return header->fileVoterCount; }
+
+    std::vector<uint64_t> counts() const {
+        const uint64_t* begin = reinterpret_cast<const uint64_t*>(file.data() + sizeof(CheckpointHeader));
+        return std::vector<uint64_t>(begin, begin + header->bucketCount);
+    }
+
+    // The voted flags, one bit per registry row, straight from the mapping
+    const uint64_t* votedWords() const {
+        return reinterpret_cast<const uint64_t*>(file.data() + sizeof(CheckpointHeader) +
+                                                 8 * header->bucketCount);
+    }
+
+    const uint8_t* tipBlock() const {
+        return reinterpret_cast<const uint8_t*>(votedWords() + (header->voterCount + 63) / 64);
+    }
+    std::size_t tipBlockBytes() const { return header->tipBlockBytes; }
+
+    // The registry deltas, in the order they are to be applied; stops at
+    // the first one that does not fit the file
+    std::vector<std::string_view> deltas() const {
+        std::vector<std::string_view> result;
+        const char* in = reinterpret_cast<const char*>(tipBlock()) + header->tipBlockBytes;
+        const char* end = file.data() + file.size();
+        while (result.size() < header->deltaCount && end - in >= 8) {
+            uint64_t size;
+            std::memcpy(&size, in, 8);
+            in += 8;
+            if (size > uint64_t(end - in)) {
+                break;
+            }
+            result.emplace_back(in, static_cast<std::size_t>(size));
+            in += size;
+        }
+        return result;
+    }
+
+    // Writes data to path atomically: the new file is synced and renamed
+    // over the old one, so a crash leaves either checkpoint intact
+    static bool write(const std::string& path, const CheckpointData& data) {
+        CheckpointHeader head;
+        std::memset(&head, 0, sizeof(head));
+        std::memcpy(head.magic, kMagic, sizeof(kMagic));
+        head.version = kVersion;
+        head.headerBytes = sizeof(CheckpointHeader);
+        head.height = data.height;
+        head.logSegment = data.logEnd.segment;
+        head.logOffset = data.logEnd.offset;
+        head.bucketCount = data.counts.size();
+        head.voterCount = data.voterCount;
+        head.registryBytes = data.registryBytes;
+        head.tipBlockBytes = data.tipBlock.size();
+        head.fileVoterCount = data.fileVoterCount;
+        head.deltaCount = data.deltas.size();
+
+        std::vector<uint8_t> bytes(sizeof(head));
+        append(bytes, data.counts.data(), 8 * data.counts.size());
+        append(bytes, data.votedWords.data(), 8 * data.votedWords.size());
+        append(bytes, data.tipBlock.data(), data.tipBlock.size());
+        std::size_t deltasStart = bytes.size();
+        for (const std::string& delta : data.deltas) {
+            uint64_t size = delta.size();
+            append(bytes, &size, 8);
+            append(bytes, delta.data(), delta.size());
+        }
+        head.deltaBytes = bytes.size() - deltasStart;
+        std::memcpy(bytes.data(), &head, sizeof(head));
+        head.checksum = checksumOf(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        std::memcpy(bytes.data(), &head, sizeof(head));
+
+        std::string temporary = path + ".tmp";
+        int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        std::size_t written = 0;
+        while (written < bytes.size()) {
+            ssize_t n = ::write(fd, bytes.data() + written, bytes.size() - written);
+            if (n < 0) {
+                break;
+            }
+            written += static_cast<std::size_t>(n);
+        }
+        bool ok = written == bytes.size() && fsync(fd) == 0;
+        ::close(fd);
+        if (!ok || std::rename(temporary.c_str(), path.c_str()) != 0) {
+            std::remove(temporary.c_str());
+            return false;
+        }
+        // make the rename itself durable
+        std::string directory = path.substr(0, path.find_last_of('/') + 1);
+        int dirFd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY);
+        if (dirFd >= 0) {
+            fsync(dirFd);
+            ::close(dirFd);
+        }
+        return true;
+    }
+
+private:
+    static constexpr char kMagic[8] = {'B', 'C', 'V', 'C', 'K', 'P', 'T', '\0'};
+
+    static void append(std::vector<uint8_t>& out, const void* data, std::size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        out.insert(out.end(), bytes, bytes + size);
+    }
+
+    // CRC over the header fields before the checksum, then everything after
+    // the header
+    static uint32_t checksumOf(const char* bytes, std::size_t size) {
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(bytes);
+        uint32_t crc = crc32c(data, offsetof(CheckpointHeader, checksum));
+        return crc32c(data + sizeof(CheckpointHeader), size - sizeof(CheckpointHeader), crc);
+    }
+
+    MappedFile file;
+    const CheckpointHeader* header;
+};
+
+#endif  // CHECKPOINT_H
@@ -0,0 +1,22 @@
+#ifndef HASH256_H
+#define HASH256_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+// Raw SHA-256 digest; hex encoding is only produced for display and export
+typedef std::array<uint8_t, 32> Hash256;
+
+// Encodes a digest as a 64-character lowercase hex string
+inline std::string toHex(const Hash256& digest) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex(digest.size() * 2, '0');
+    for (std::size_t i = 0; i < digest.size(); ++i) {
+        hex[2 * i] = digits[digest[i] >> 4];
+        hex[2 * i + 1] = digits[digest[i] & 0x0f];
+    }
+    return hex;
+}
+
+#endif  // HASH256_H
@@ -0,0 +1,595 @@
+#ifndef KIOSK_SERVER_H
+#define KIOSK_SERVER_H
+
+#if !defined(__cpp_impl_coroutine)
+#error "kiosk_server.h needs C++20 coroutines; build with -std=c++20"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <coroutine>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "blockchain.h"
+#include "recovery.h"
+#include "replication.h"
+#include "voter_registry.h"
+
+// Serves the interactive prompt sequence (voter ID, candidate choice,
+// continue or exit) to many kiosks at once over stream sockets, one
+// plain-text session per connection.
+//
+// Each session is a C++20 coroutine. A small pool of worker threads runs
+// them, each worker with its own epoll instance; a session belongs to the
+// worker that accepted it and suspends whenever it waits for its kiosk, so
+// an idle connection costs a socket and a coroutine frame. Votes are handed
+// to a single committer thread, which claims the voters, packs the votes
+// of every waiting session into batch blocks, syncs the log once for the
+// lot and then resumes the sessions with their receipts.
+class KioskServer {
+public:
+    struct Options {
+        unsigned threads = 0;            // Worker threads; 0 picks the core count
+        std::size_t votesPerBlock = 256; // Largest batch block the committer builds
+        std::string checkpointPath;      // Checkpoint every checkpointEveryBlocks if set
+        uint64_t checkpointEveryBlocks = 1000;
+    };
+
+    // The chain must already be attached to the log and hold its genesis
+    // block; while the server runs only its committer appends to it
+    KioskServer(VoterRegistry& registry, Blockchain& blockchain, const Options& options)
+        : registry(registry), blockchain(blockchain), options(options), listener(-1),
+          stopping(false), committerStopping(false), compromised(false), committed(0),
+          lastCheckpointHeight(blockchain.size() - 1) {
+        const CandidateList& candidates = blockchain.ballot();
+        ballot = "\nChoose the candidate to vote:\n";
+        for (std::size_t i = 0; i < candidates.size(); ++i) {
+            ballot += "  " + std::to_string(i + 1) + ". " + candidates.name(i) + "\n";
+        }
+        ballot += "  " + std::to_string(candidates.size() + 1) +
+                  ". Any other number to choose NOTA\n-> ";
+    }
+
+    KioskServer(const KioskServer&) = delete;
+    KioskServer& operator=(const KioskServer&) = delete;
+
+    ~KioskServer() { stop(); }
+
+    // Starts serving kiosks at address ("unix:PATH" or "HOST:PORT"). The
+    // open file limit is raised to its hard limit, as every kiosk holds a
+    // descriptor, and SIGPIPE is ignored so a kiosk going away fails a send
+    // instead of the process.
+    bool start(const std::string& address) {
+        sockaddr_storage storage;
+        socklen_t length;
+        if (!replication::parseAddress(address, storage, length)) {
+            std::cerr << "Error: Bad kiosk address " << address << std::endl;
+            return false;
+        }
+        if (storage.ss_family == AF_UNIX) {
+            socketPath = reinterpret_cast<sockaddr_un*>(&storage)->sun_path;
+            ::unlink(socketPath.c_str());
+        }
+        listener = ::socket(storage.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int on = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&storage), length) != 0 ||
+            ::listen(listener, SOMAXCONN) != 0) {
+            std::cerr << "Error: Could not listen on " << address << ": " << std::strerror(errno)
+                      << std::endl;
+            return false;
+        }
+        tcp = storage.ss_family == AF_INET;
+        struct rlimit files;
+        if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+            files.rlim_cur = files.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &files);
+        }
+        std::signal(SIGPIPE, SIG_IGN);
+
+        unsigned threads = options.threads != 0
+            ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned i = 0; i < threads; ++i) {
+            workers.emplace_back(new Worker());
+            Worker& worker = *workers.back();
+            worker.epoll = epoll_create1(EPOLL_CLOEXEC);
+            worker.wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.ptr = &worker.wake;
+            epoll_ctl(worker.epoll, EPOLL_CTL_ADD, worker.wake, &event);
+            // Every worker accepts; EPOLLEXCLUSIVE wakes one per connection
+            event.events = EPOLLIN | EPOLLEXCLUSIVE;
+            event.data.ptr = &listener;
+            epoll_ctl(worker.epoll, EPOLL_CTL_ADD, listener, &event);
+            worker.thread = std::thread([this, &worker] { run(worker); });
+        }
+        committer = std::thread([this] { commitVotes(); });
+        return true;
+    }
+
+    // Stops accepting and serving kiosks. Votes already handed to the
+    // committer are still appended; sessions waiting on anything else are
+    // dropped with their connections.
+    void stop() {
+        if (stopping.exchange(true)) {
+            return;
+        }
+        for (std::unique_ptr<Worker>& worker : workers) {
+            uint64_t one = 1;
+            ssize_t ignored = ::write(worker->wake, &one, sizeof(one));
+            (void)ignored;
+        }
+        for (std::unique_ptr<Worker>& worker : workers) {
+            if (worker->thread.joinable()) {
+                worker->thread.join();
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(pendingLock);
+            committerStopping = true;
+        }
+        pendingReady.notify_one();
+        if (committer.joinable()) {
+            committer.join();
+        }
+        for (std::unique_ptr<Worker>& worker : workers) {
+            for (auto& entry : worker->connections) {
+                if (entry.second->session) {
+                    entry.second->session.destroy();
+                }
+                ::close(entry.first);
+            }
+            ::close(worker->epoll);
+            ::close(worker->wake);
+        }
+        workers.clear();
+        if (listener >= 0) {
+            ::close(listener);
+            listener = -1;
+        }
+        if (!socketPath.empty()) {
+            ::unlink(socketPath.c_str());
+        }
+    }
+
+    // Votes appended and made durable since start()
+    uint64_t votesCommitted() const {
+        return committed.load();
+    }
+
+private:
+    struct Worker;
+
+    // One kiosk connection, owned by the worker that accepted it
+    struct Connection {
+        int fd;
+        Worker* worker;
+        std::string input;               // Received bytes not yet returned as lines
+        std::string output;              // Bytes a send is still waiting to write
+        std::coroutine_handle<> session; // The session, whenever it is suspended
+        bool waitingToRead = false;
+        bool waitingToWrite = false;
+        bool closed = false;
+        std::string* line = nullptr;     // Where a waiting receive puts its line
+        bool* ok = nullptr;              // Where a waiting receive or send puts its outcome
+    };
+
+    struct Worker {
+        int epoll = -1;
+        int wake = -1;                   // eventfd: sessions to resume are ready
+        std::thread thread;
+        std::mutex readyLock;
+        std::vector<std::coroutine_handle<>> ready; // Sessions whose votes are committed
+        std::unordered_map<int, std::unique_ptr<Connection>> connections;
+        std::vector<std::unique_ptr<Connection>> retired; // Freed after the current events
+    };
+
+    // Coroutine type of a session: it starts at once and frees itself when
+    // it finishes; stop() destroys sessions still suspended
+    struct Session {
+        struct promise_type {
+            Session get_return_object() { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+    };
+
+    // Outcome of a vote handed to the committer
+    struct CommitResult {
+        VoterRegistry::VoteStatus status = VoterRegistry::InvalidChoice;
+        bool saved = false;      // The vote's block is durable
+        Hash256 receipt;
+    };
+
+    struct PendingVote {
+        std::string_view voterID;  // Both live in the suspended session
+        std::string_view choice;
+        Connection* connection;
+        CommitResult* result;
+    };
+
+    enum LineStatus { LineReady, LineWait, LineClosed };
+
+    static constexpr std::size_t kMaxLineBytes = 256;
+
+    // Takes the next line from the connection's input, reading the socket
+    // until one is complete or it would block. Lines are trimmed of
+    // whitespace, as the console prompts read them with cin.
+    static LineStatus nextLine(Connection& connection, std::string& line) {
+        while (true) {
+            std::size_t newline = connection.input.find('\n');
+            if (newline != std::string::npos) {
+                std::string_view text(connection.input.data(), newline);
+                std::size_t first = text.find_first_not_of(" \t\r");
+                std::size_t last = text.find_last_not_of(" \t\r");
+                line.assign(first == std::string_view::npos
+                                ? std::string_view() : text.substr(first, last - first + 1));
+                connection.input.erase(0, newline + 1);
+                return LineReady;
+            }
+            if (connection.input.size() > kMaxLineBytes) {
+                return LineClosed;
+            }
+            char buffer[512];
+            ssize_t n = ::recv(connection.fd, buffer, sizeof(buffer), 0);
+            if (n > 0) {
+                connection.input.append(buffer, static_cast<std::size_t>(n));
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else {
+                return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? LineWait : LineClosed;
+            }
+        }
+    }
+
+    // Writes as much of the connection's output as the socket takes; false
+    // if the kiosk has gone
+    static bool flushOutput(Connection& connection) {
+        while (!connection.output.empty()) {
+            ssize_t n = ::send(connection.fd, connection.output.data(), connection.output.size(),
+                               MSG_NOSIGNAL);
+            if (n > 0) {
+                connection.output.erase(0, static_cast<std::size_t>(n));
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else {
+                return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+            }
+        }
+        return true;
+    }
+
+    // co_await receive(connection, line): the kiosk's next line, or false
+    // once it has disconnected or sent an overlong line
+    struct Receive {
+        Connection& connection;
+        std::string& line;
+        bool ok = false;
+
+        bool await_ready() {
+            LineStatus status = nextLine(connection, line);
+            ok = status == LineReady;
+            return status != LineWait;
+        }
+        void await_suspend(std::coroutine_handle<> session) {
+            connection.session = session;
+            connection.waitingToRead = true;
+            connection.line = &line;
+            connection.ok = &ok;
+        }
+        bool await_resume() const { return ok; }
+    };
+
+    // co_await send(connection, text): false if the kiosk has gone
+    struct Send {
+        Connection& connection;
+        bool ok = false;
+
+        Send(Connection& connection, std::string_view text) : connection(connection) {
+            connection.output.append(text);
+        }
+        bool await_ready() {
+            ok = flushOutput(connection);
+            return !ok || connection.output.empty();
+        }
+        void await_suspend(std::coroutine_handle<> session) {
+            connection.session = session;
+            connection.waitingToWrite = true;
+            connection.ok = &ok;
+        }
+        bool await_resume() const { return ok; }
+    };
+
+    // co_await checkVoter(id): the registry check before the ballot. It
+    // completes without suspending, as lookups are lock-free and in memory.
+    struct CheckVoter {
+        VoterRegistry& registry;
+        std::string_view voterID;
+
+        bool await_ready() const { return true; }
+        void await_suspend(std::coroutine_handle<>) const {}
+        VoterRegistry::VoteStatus await_resume() const { return registry.checkVoter(voterID); }
+    };
+
+    // co_await commitVote(...): suspends until the committer has claimed
+    // the voter and, if accepted, made the vote's block durable
+    struct CommitVote {
+        KioskServer& server;
+        Connection& connection;
+        std::string_view voterID;
+        std::string_view choice;
+        CommitResult result;
+
+        bool await_ready() const { return false; }
+        void await_suspend(std::coroutine_handle<> session) {
+            connection.session = session;
+            server.submit(PendingVote{voterID, choice, &connection, &result});
+        }
+        CommitResult await_resume() const { return result; }
+    };
+
+    // One kiosk's prompt sequence, as in the console loop
+    Session serve(Connection& connection) {
+        std::string voterID, choice, answer;
+        while (true) {
+            if (!co_await Send(connection, "\nEnter your Voter ID to cast a vote: ") ||
+                !co_await Receive{connection, voterID}) {
+                break;
+            }
+            VoterRegistry::VoteStatus status = co_await CheckVoter{registry, voterID};
+            if (status != VoterRegistry::Accepted) {
+                if (!co_await Send(connection, status == VoterRegistry::NotRegistered
+                                                   ? "Voter ID not found.\n"
+                                                   : "Voter has already voted.\n")) {
+                    break;
+                }
+                continue;
+            }
+            if (!co_await Send(connection, ballot) || !co_await Receive{connection, choice}) {
+                break;
+            }
+            CommitResult result = co_await CommitVote{*this, connection, voterID, choice, {}};
+            if (result.status != VoterRegistry::Accepted) {
+                // another kiosk took the voter first, or the chain is compromised
+                const char* message = compromised ? "Blockchain is compromised\n"
+                                                  : "Voter has already voted.\n";
+                if (!co_await Send(connection, message) || compromised) {
+                    break;
+                }
+                continue;
+            }
+            if (!result.saved) {
+                co_await Send(connection, "Unable to save the vote.\n");
+                break;
+            }
+            std::string receipt = "\nYour vote receipt: " + toHex(result.receipt) + "\n" +
+                                  "\nTO CONTINUE PRESS ANY NUMBER\n\nTO EXIT PRESS '0'\n";
+            if (!co_await Send(connection, receipt) || !co_await Receive{connection, answer} ||
+                answer == "0") {
+                break;
+            }
+        }
+        retire(connection);
+    }
+
+    // Closes a connection whose session is finishing; it is freed once the
+    // worker is done with the current batch of events
+    void retire(Connection& connection) {
+        Worker& worker = *connection.worker;
+        connection.closed = true;
+        connection.session = nullptr;
+        epoll_ctl(worker.epoll, EPOLL_CTL_DEL, connection.fd, nullptr);
+        ::close(connection.fd);
+        auto entry = worker.connections.find(connection.fd);
+        worker.retired.push_back(std::move(entry->second));
+        worker.connections.erase(entry);
+    }
+
+    void acceptKiosks(Worker& worker) {
+        while (!stopping) {
+            int fd = ::accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EMFILE || errno == ENFILE) {
+                    std::cerr << "Warning: Out of file descriptors for kiosks" << std::endl;
+                }
+                return;  // EAGAIN once the backlog is empty
+            }
+            if (tcp) {
+                int on = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            }
+            std::unique_ptr<Connection> connection(new Connection());
+            connection->fd = fd;
+            connection->worker = &worker;
+            epoll_event event = {};
+            event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            event.data.ptr = connection.get();
+            epoll_ctl(worker.epoll, EPOLL_CTL_ADD, fd, &event);
+            Connection& added = *connection;
+            worker.connections.emplace(fd, std::move(connection));
+            serve(added);
+        }
+    }
+
+    // Resumes the session waiting on a socket once its line is complete or
+    // its output written
+    static void onSocketEvent(Connection& connection, uint32_t events) {
+        if (connection.waitingToRead) {
+            LineStatus status = nextLine(connection, *connection.line);
+            if (status != LineWait) {
+                connection.waitingToRead = false;
+                *connection.ok = status == LineReady;
+                connection.session.resume();
+            }
+        } else if (connection.waitingToWrite && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+            bool ok = flushOutput(connection);
+            if (!ok || connection.output.empty()) {
+                connection.waitingToWrite = false;
+                *connection.ok = ok;
+                connection.session.resume();
+            }
+        }
+    }
+
+    void run(Worker& worker) {
+        epoll_event events[256];
+        while (!stopping) {
+            int count = epoll_wait(worker.epoll, events, 256, -1);
+            for (int i = 0; i < count && !stopping; ++i) {
+                void* tag = events[i].data.ptr;
+                if (tag == &listener) {
+                    acceptKiosks(worker);
+                } else if (tag == &worker.wake) {
+                    uint64_t value;
+                    ssize_t ignored = ::read(worker.wake, &value, sizeof(value));
+                    (void)ignored;
+                    std::vector<std::coroutine_handle<>> ready;
+                    {
+                        std::lock_guard<std::mutex> lock(worker.readyLock);
+                        ready.swap(worker.ready);
+                    }
+                    for (std::coroutine_handle<> session : ready) {
+                        session.resume();
+                    }
+                } else {
+                    Connection& connection = *static_cast<Connection*>(tag);
+                    if (!connection.closed) {
+                        onSocketEvent(connection, events[i].events);
+                    }
+                }
+            }
+            worker.retired.clear();
+        }
+    }
+
+    void submit(const PendingVote& vote) {
+        {
+            std::lock_guard<std::mutex> lock(pendingLock);
+            pending.push_back(vote);
+        }
+        pendingReady.notify_one();
+    }
+
+    // Committer thread: takes every vote waiting, claims the voters,
+    // appends the accepted votes in batch blocks and syncs the log once,
+    // then hands the results back to the sessions' workers
+    void commitVotes() {
+        std::vector<PendingVote> votes;
+        std::vector<std::string> accepted;
+        std::vector<CommitResult*> acceptedResults;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(pendingLock);
+                pendingReady.wait(lock, [this] { return !pending.empty() || committerStopping; });
+                if (pending.empty()) {
+                    return;
+                }
+                votes.swap(pending);
+            }
+            if (!compromised && !blockchain.verify()) {
+                std::cerr << "Blockchain is compromised; no more votes are accepted" << std::endl;
+                compromised = true;
+            }
+            accepted.clear();
+            acceptedResults.clear();
+            for (const PendingVote& vote : votes) {
+                // Claimed, and logged, ahead of the vote as in the console loop
+                vote.result->status = compromised ? VoterRegistry::InvalidChoice
+                                                  : registry.claimVote(vote.voterID);
+                if (vote.result->status == VoterRegistry::Accepted) {
+                    accepted.emplace_back(vote.choice);
+                    acceptedResults.push_back(vote.result);
+                }
+            }
+            appendAccepted(accepted, acceptedResults);
+            bool saved = blockchain.sync();
+            for (CommitResult* result : acceptedResults) {
+                result->saved = saved;
+            }
+            committed += saved ? accepted.size() : 0;
+            if (!options.checkpointPath.empty() &&
+                blockchain.size() > lastCheckpointHeight + options.checkpointEveryBlocks) {
+                lastCheckpointHeight = blockchain.size() - 1;
+                if (!saveCheckpoint(options.checkpointPath, blockchain, registry)) {
+                    std::cerr << "Unable to write checkpoint " << options.checkpointPath
+                              << std::endl;
+                }
+            }
+            for (const PendingVote& vote : votes) {
+                Worker& worker = *vote.connection->worker;
+                std::lock_guard<std::mutex> lock(worker.readyLock);
+                worker.ready.push_back(vote.connection->session);
+            }
+            for (std::unique_ptr<Worker>& worker : workers) {
+                uint64_t one = 1;
+                ssize_t ignored = ::write(worker->wake, &one, sizeof(one));
+                (void)ignored;
+            }
+            votes.clear();
+        }
+    }
+
+    // Packs the accepted votes into blocks of up to votesPerBlock, filling
+    // in each vote's receipt
+    void appendAccepted(const std::vector<std::string>& accepted,
+                        const std::vector<CommitResult*>& results) {
+        if (options.votesPerBlock <= 1) {
+            for (std::size_t i = 0; i < accepted.size(); ++i) {
+                results[i]->receipt = blockchain.addBlock(accepted[i]);
+            }
+            return;
+        }
+        std::vector<std::string> batch;
+        for (std::size_t start = 0; start < accepted.size(); start += options.votesPerBlock) {
+            std::size_t end = std::min(accepted.size(), start + options.votesPerBlock);
+            batch.assign(accepted.begin() + start, accepted.begin() + end);
+            std::vector<Hash256> receipts = blockchain.addBatchBlock(batch);
+            for (std::size_t i = start; i < end; ++i) {
+                results[i]->receipt = receipts[i - start];
+            }
+        }
+    }
+
+    VoterRegistry& registry;
+    Blockchain& blockchain;
+    Options options;
+    std::string ballot;      // The ballot prompt, built once
+    int listener;
+    bool tcp = false;
+    std::string socketPath;  // Unix socket to remove on stop
+    std::atomic<bool> stopping;
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    std::thread committer;
+    std::mutex pendingLock;
+    std::condition_variable pendingReady;
+    std::vector<PendingVote> pending;
+    bool committerStopping;
+    std::atomic<bool> compromised;
+    std::atomic<uint64_t> committed;
+    uint64_t lastCheckpointHeight;
+};
+
+#endif  // KIOSK_SERVER_H
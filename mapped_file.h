@@ -0,0 +1,67 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only memory mapping of a whole file. The mapping stays valid until
+// the object is destroyed or another file is opened, so string_views into
+// data() can be kept for as long as the MappedFile lives.
+class MappedFile {
+public:
+    MappedFile() : base(nullptr), length(0) {}
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() { close(); }
+
+    // Maps the file at path, replacing any previous mapping
+    bool open(const std::string& path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            ::close(fd);
+            return false;
+        }
+        length = static_cast<std::size_t>(info.st_size);
+        if (length > 0) {
+            void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                ::close(fd);
+                length = 0;
+                return false;
+            }
+            base = static_cast<const char*>(mapped);
+            // the loaders read front to back
+            madvise(mapped, length, MADV_SEQUENTIAL);
+        }
+        ::close(fd);
+        return true;
+    }
+
+    void close() {
+        if (base != nullptr) {
+            munmap(const_cast<char*>(base), length);
+        }
+        base = nullptr;
+        length = 0;
+    }
+
+    const char* data() const { return base; }
+    std::size_t size() const { return length; }
+
+private:
+    const char* base;
+    std::size_t length;
+};
+
+#endif  // MAPPED_FILE_H
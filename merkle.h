@@ -0,0 +1,170 @@
+#ifndef MERKLE_H
+#define MERKLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+#include "hash256.h"
+#include "sha256_backend.h"
+
+// Merkle trees over the vote records of a batch block.
+//
+// Leaves and inner nodes are domain separated (0x00 / 0x01 prefix) so an
+// inner node can never be passed off as a vote. A leaf also commits to the
+// previous block hash and the vote's position in the batch, which makes
+// every leaf hash unique across the chain; it doubles as the vote receipt.
+// A node without a sibling is promoted to the next level unchanged.
+
+// Bytes hashed for a leaf: 0x00 || prevHash || index (big endian) || vote
+inline void appendMerkleLeafInput(std::vector<uint8_t>& out, const Hash256& prevHash,
+                                  uint32_t index, std::string_view vote) {
+    out.push_back(0x00);
+    out.insert(out.end(), prevHash.begin(), prevHash.end());
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<uint8_t>(index >> shift));
+    }
+    out.insert(out.end(), vote.begin(), vote.end());
+}
+
+inline Hash256 merkleLeafHash(const Hash256& prevHash, uint32_t index, std::string_view vote) {
+    std::vector<uint8_t> input;
+    input.reserve(37 + vote.size());
+    appendMerkleLeafInput(input, prevHash, index, vote);
+    Hash256 digest;
+    picosha2::backend::hash256(input.data(), input.size(), digest.data());
+    return digest;
+}
+
+inline Hash256 merkleNodeHash(const Hash256& left, const Hash256& right) {
+    uint8_t input[65];
+    input[0] = 0x01;
+    std::memcpy(input + 1, left.data(), 32);
+    std::memcpy(input + 33, right.data(), 32);
+    Hash256 digest;
+    picosha2::backend::hash256(input, sizeof(input), digest.data());
+    return digest;
+}
+
+// Hashes a batch of leaf inputs laid out back to back; lengths[i] is the
+// size of input i
+inline void hashMerkleInputs(const std::vector<uint8_t>& inputs,
+                             const std::vector<std::size_t>& lengths, Hash256* out) {
+    std::vector<const uint8_t*> pointers(lengths.size());
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < lengths.size(); ++i) {
+        pointers[i] = inputs.data() + offset;
+        offset += lengths[i];
+    }
+    picosha2::backend::hash256_many(pointers.data(), lengths.data(), lengths.size(),
+                                    out->data());
+}
+
+// Replaces level with its parent level
+inline void merkleParentLevel(std::vector<Hash256>& level) {
+    std::size_t pairs = level.size() / 2;
+    std::vector<uint8_t> inputs(pairs * 65);
+    for (std::size_t i = 0; i < pairs; ++i) {
+        uint8_t* input = &inputs[i * 65];
+        input[0] = 0x01;
+        std::memcpy(input + 1, level[2 * i].data(), 32);
+        std::memcpy(input + 33, level[2 * i + 1].data(), 32);
+    }
+    std::vector<Hash256> parents(pairs + level.size() % 2);
+    hashMerkleInputs(inputs, std::vector<std::size_t>(pairs, 65), parents.data());
+    if (level.size() % 2 != 0) {
+        parents.back() = level.back();
+    }
+    level.swap(parents);
+}
+
+// Leaf hashes of a batch of votes that follows the block with prevHash
+template <typename Votes>
+std::vector<Hash256> merkleLeaves(const Hash256& prevHash, const Votes& votes) {
+    std::vector<uint8_t> inputs;
+    std::vector<std::size_t> lengths;
+    lengths.reserve(votes.size());
+    uint32_t index = 0;
+    for (const auto& vote : votes) {
+        std::size_t before = inputs.size();
+        appendMerkleLeafInput(inputs, prevHash, index++, vote);
+        lengths.push_back(inputs.size() - before);
+    }
+    std::vector<Hash256> leaves(lengths.size());
+    hashMerkleInputs(inputs, lengths, leaves.data());
+    return leaves;
+}
+
+// Root over the given leaves; all zeroes when there are none
+inline Hash256 computeMerkleRoot(std::vector<Hash256> level) {
+    if (level.empty()) {
+        return Hash256();
+    }
+    while (level.size() > 1) {
+        merkleParentLevel(level);
+    }
+    return level[0];
+}
+
+// All levels of a Merkle tree, kept so several proofs can share one build
+class MerkleTree {
+public:
+    explicit MerkleTree(std::vector<Hash256> leaves) {
+        levels.push_back(std::move(leaves));
+        while (levels.back().size() > 1) {
+            std::vector<Hash256> next = levels.back();
+            merkleParentLevel(next);
+            levels.push_back(std::move(next));
+        }
+    }
+
+    Hash256 root() const { return levels.back().empty() ? Hash256() : levels.back()[0]; }
+
+    std::size_t leafCount() const { return levels.front().size(); }
+
+    const Hash256& leaf(std::size_t index) const { return levels.front()[index]; }
+
+    // Sibling hashes from the leaf up to the root; promoted levels add nothing
+    std::vector<Hash256> path(std::size_t index) const {
+        std::vector<Hash256> siblings;
+        for (std::size_t level = 0; level + 1 < levels.size(); ++level) {
+            std::size_t sibling = index ^ 1;
+            if (sibling < levels[level].size()) {
+                siblings.push_back(levels[level][sibling]);
+            }
+            index /= 2;
+        }
+        return siblings;
+    }
+
+private:
+    std::vector<std::vector<Hash256>> levels;
+};
+
+// Folds a leaf and its sibling path back up to the root of a tree with
+// leafCount leaves; returns false if the path has the wrong length
+inline bool merkleRootFromPath(Hash256 node, std::size_t index, std::size_t leafCount,
+                               const std::vector<Hash256>& siblings, Hash256& root) {
+    if (index >= leafCount) {
+        return false;
+    }
+    std::size_t used = 0;
+    for (std::size_t width = leafCount; width > 1; width = (width + 1) / 2, index /= 2) {
+        if (index % 2 == 1) {
+            if (used == siblings.size()) {
+                return false;
+            }
+            node = merkleNodeHash(siblings[used++], node);
+        } else if (index + 1 < width) {
+            if (used == siblings.size()) {
+                return false;
+            }
+            node = merkleNodeHash(node, siblings[used++]);
+        }
+    }
+    root = node;
+    return used == siblings.size();
+}
+
+#endif  // MERKLE_H
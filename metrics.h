@@ -0,0 +1,312 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+// Latency metrics for the stages of casting a vote. Built with
+// -DVOTING_METRICS, METRIC_SCOPE(stage) times the rest of the enclosing
+// block into the calling thread's histogram for that stage; without it the
+// macro expands to nothing and none of the code below is compiled.
+//
+// Each thread records into its own counters, so timing a stage costs two
+// clock reads and a few uncontended stores. A dump sums every thread's
+// histograms and writes them in the Prometheus text format.
+
+#ifdef VOTING_METRICS
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace metrics {
+
+// Timed stages of a vote
+enum Stage {
+    RegistryLookup,  // Voter ID to registry row
+    BlockHash,       // SHA-256 of a new block in Block::calculateHash
+    BlockAppend,     // Appending a block at the chain tail
+    LastHashWrite,   // Rewriting lasthash.txt
+    kStageCount
+};
+
+inline const char* stageName(Stage stage) {
+    static const char* const names[kStageCount] = {
+        "registry_lookup", "block_hash", "block_append", "lasthash_write"};
+    return names[stage];
+}
+
+// Log-linear latency buckets in the style of an HDR histogram: values below
+// 8 ns get a bucket each, then every power of two is split into 8 buckets,
+// so a bucket's width is at most 1/8 of its lower bound. Latencies of 2^40
+// ns (about 18 minutes) and up share a last, overflow bucket.
+constexpr unsigned kSubBuckets = 8;
+constexpr unsigned kMaxExponent = 40;
+constexpr std::size_t kBucketCount = (kMaxExponent - 2) * kSubBuckets + 1;
+
+inline std::size_t bucketOf(uint64_t nanos) {
+    if (nanos < kSubBuckets) {
+        return static_cast<std::size_t>(nanos);
+    }
+    unsigned exponent = 63 - static_cast<unsigned>(__builtin_clzll(nanos));
+    if (exponent >= kMaxExponent) {
+        return kBucketCount - 1;
+    }
+    uint64_t sub = (nanos >> (exponent - 3)) & (kSubBuckets - 1);
+    return (exponent - 2) * kSubBuckets + static_cast<std::size_t>(sub);
+}
+
+// Largest latency, in nanoseconds, counted in bucket (below the overflow
+// bucket)
+inline uint64_t bucketMax(std::size_t bucket) {
+    if (bucket < kSubBuckets) {
+        return bucket;
+    }
+    unsigned exponent = static_cast<unsigned>(bucket / kSubBuckets) + 2;
+    uint64_t sub = bucket % kSubBuckets;
+    return ((kSubBuckets + sub + 1) << (exponent - 3)) - 1;
+}
+
+// One thread's histograms. Only the owning thread writes them; the atomics
+// let a dump read them at the same time without tearing.
+struct ThreadHistograms {
+    std::atomic<uint64_t> counts[kStageCount][kBucketCount];
+    std::atomic<uint64_t> sumNanos[kStageCount];
+
+    ThreadHistograms() {
+        for (std::size_t stage = 0; stage < kStageCount; ++stage) {
+            for (std::size_t bucket = 0; bucket < kBucketCount; ++bucket) {
+                counts[stage][bucket].store(0, std::memory_order_relaxed);
+            }
+            sumNanos[stage].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void record(Stage stage, uint64_t nanos) {
+        std::atomic<uint64_t>& count = counts[stage][bucketOf(nanos)];
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        sumNanos[stage].store(sumNanos[stage].load(std::memory_order_relaxed) + nanos,
+                              std::memory_order_relaxed);
+    }
+};
+
+// Totals across threads, as written by a dump
+struct Totals {
+    std::vector<uint64_t> counts = std::vector<uint64_t>(kStageCount * kBucketCount, 0);
+    uint64_t sumNanos[kStageCount] = {};
+
+    void add(const ThreadHistograms& thread) {
+        for (std::size_t stage = 0; stage < kStageCount; ++stage) {
+            for (std::size_t bucket = 0; bucket < kBucketCount; ++bucket) {
+                counts[stage * kBucketCount + bucket] +=
+                    thread.counts[stage][bucket].load(std::memory_order_relaxed);
+            }
+            sumNanos[stage] += thread.sumNanos[stage].load(std::memory_order_relaxed);
+        }
+    }
+};
+
+// Every live thread's histograms, plus the totals of threads that exited
+class Registry {
+public:
+    static Registry& instance() {
+        static Registry registry;
+        return registry;
+    }
+
+    void add(ThreadHistograms* thread) {
+        std::lock_guard<std::mutex> lock(registryLock);
+        threads.push_back(thread);
+    }
+
+    // Folds an exiting thread's histograms into the retired totals
+    void retire(ThreadHistograms* thread) {
+        std::lock_guard<std::mutex> lock(registryLock);
+        retired.add(*thread);
+        for (std::size_t i = 0; i < threads.size(); ++i) {
+            if (threads[i] == thread) {
+                threads[i] = threads.back();
+                threads.pop_back();
+                break;
+            }
+        }
+    }
+
+    Totals collect() {
+        std::lock_guard<std::mutex> lock(registryLock);
+        Totals totals = retired;
+        for (const ThreadHistograms* thread : threads) {
+            totals.add(*thread);
+        }
+        return totals;
+    }
+
+private:
+    std::mutex registryLock;
+    std::vector<ThreadHistograms*> threads;
+    Totals retired;
+};
+
+// Owns the calling thread's histograms for the lifetime of the thread
+class ThreadSlot {
+public:
+    ThreadSlot() : histograms(new ThreadHistograms) { Registry::instance().add(histograms.get()); }
+    ~ThreadSlot() { Registry::instance().retire(histograms.get()); }
+
+    ThreadHistograms& get() { return *histograms; }
+
+private:
+    std::unique_ptr<ThreadHistograms> histograms;
+};
+
+inline ThreadHistograms& threadHistograms() {
+    static thread_local ThreadSlot slot;
+    return slot.get();
+}
+
+// Times its own lifetime into a stage's histogram
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Stage stage) : stage(stage), start(std::chrono::steady_clock::now()) {}
+
+    ~ScopedTimer() {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        threadHistograms().record(stage, static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    Stage stage;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Writes the metrics in the Prometheus text exposition format, one
+// histogram per stage in seconds. Only buckets whose cumulative count
+// changes are listed; the overflow bucket only shows in +Inf.
+inline void writePrometheus(std::ostream& out) {
+    Totals totals = Registry::instance().collect();
+    for (std::size_t stage = 0; stage < kStageCount; ++stage) {
+        std::string name = std::string("voting_") + stageName(Stage(stage)) + "_seconds";
+        out << "# HELP " << name << " Latency of the " << stageName(Stage(stage))
+            << " stage.\n";
+        out << "# TYPE " << name << " histogram\n";
+        uint64_t cumulative = 0;
+        char limit[32];
+        for (std::size_t bucket = 0; bucket < kBucketCount; ++bucket) {
+            uint64_t count = totals.counts[stage * kBucketCount + bucket];
+            if (count == 0) {
+                continue;
+            }
+            cumulative += count;
+            if (bucket == kBucketCount - 1) {
+                break;
+            }
+            std::snprintf(limit, sizeof(limit), "%.9g", bucketMax(bucket) * 1e-9);
+            out << name << "_bucket{le=\"" << limit << "\"} " << cumulative << "\n";
+        }
+        out << name << "_bucket{le=\"+Inf\"} " << cumulative << "\n";
+        std::snprintf(limit, sizeof(limit), "%.9g", totals.sumNanos[stage] * 1e-9);
+        out << name << "_sum " << limit << "\n";
+        out << name << "_count " << cumulative << "\n";
+    }
+}
+
+// Writes the metrics to path, replacing it atomically so a scraper never
+// reads a half-written file
+inline bool dumpPrometheus(const std::string& path) {
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary);
+        writePrometheus(file);
+        if (!file.flush()) {
+            return false;
+        }
+    }
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+// Set by SIGUSR1; the dumper thread picks it up
+inline volatile std::sig_atomic_t& dumpRequested() {
+    static volatile std::sig_atomic_t requested = 0;
+    return requested;
+}
+
+inline void onDumpSignal(int) {
+    dumpRequested() = 1;
+}
+
+// Background thread writing the metrics file every intervalSeconds (0 for
+// never), whenever the process gets SIGUSR1, and once more when stopped
+class Dumper {
+public:
+    Dumper(const std::string& path, unsigned intervalSeconds)
+        : path(path), interval(intervalSeconds), stopping(false) {
+        std::signal(SIGUSR1, onDumpSignal);
+        worker = std::thread([this] { run(); });
+    }
+
+    ~Dumper() {
+        {
+            std::lock_guard<std::mutex> lock(stateLock);
+            stopping = true;
+        }
+        wake.notify_all();
+        worker.join();
+        dumpPrometheus(path);
+    }
+
+    Dumper(const Dumper&) = delete;
+    Dumper& operator=(const Dumper&) = delete;
+
+private:
+    void run() {
+        // A signal handler cannot notify a condition variable, so poll
+        // for signals a few times a second
+        const auto poll = std::chrono::milliseconds(200);
+        auto nextDump = std::chrono::steady_clock::now() + std::chrono::seconds(interval);
+        std::unique_lock<std::mutex> lock(stateLock);
+        while (!wake.wait_for(lock, poll, [this] { return stopping; })) {
+            auto now = std::chrono::steady_clock::now();
+            bool timerDue = interval > 0 && now >= nextDump;
+            if (dumpRequested() || timerDue) {
+                dumpRequested() = 0;
+                nextDump = now + std::chrono::seconds(interval);
+                lock.unlock();
+                dumpPrometheus(path);
+                lock.lock();
+            }
+        }
+    }
+
+    std::string path;
+    unsigned interval;
+    bool stopping;
+    std::mutex stateLock;
+    std::condition_variable wake;
+    std::thread worker;
+};
+
+}  // namespace metrics
+
+#define METRIC_CONCAT_(a, b) a##b
+#define METRIC_CONCAT(a, b) METRIC_CONCAT_(a, b)
+#define METRIC_SCOPE(stage) \
+    ::metrics::ScopedTimer METRIC_CONCAT(metricTimer, __LINE__)(::metrics::stage)
+
+#else
+
+#define METRIC_SCOPE(stage) do {} while (0)
+
+#endif  // VOTING_METRICS
+
+#endif  // METRICS_H
@@ -139,6 +139,24 @@ void hash256_block(RaIter1 message_digest, RaIter2 first, RaIter2 last) {
     }
 }
 
+inline void compress_scalar(word_t* message_digest, const byte_t* blocks,
+                            std::size_t block_count) {
+    for (std::size_t i = 0; i < block_count; ++i) {
+        hash256_block(message_digest, blocks + 64 * i, blocks + 64 * (i + 1));
+    }
+}
+
+// Compresses block_count consecutive 64-byte blocks into message_digest.
+// Defaults to the portable code above; sha256_backend.h swaps in a
+// CPU-specific implementation at startup.
+typedef void (*block_compressor_t)(word_t* message_digest, const byte_t* blocks,
+                                   std::size_t block_count);
+
+inline block_compressor_t& block_compressor() {
+    static block_compressor_t compressor = &compress_scalar;
+    return compressor;
+}
+
 }  // namespace detail
 
 template <typename InIter>
@@ -179,12 +197,27 @@ std::string bytes_to_hex_string(const InContainer& bytes) {
     return hex_str;
 }
 
+// Everything a hash256_one_by_one has accumulated so far. Saved after a
+// prefix that many messages share, it lets each message skip compressing
+// the prefix again.
+struct hash256_midstate {
+    word_t h[8];
+    byte_t buffer[64];
+    std::size_t buffer_size;
+    word_t data_length_digits[4];
+    std::size_t compressions;
+};
+
 class hash256_one_by_one {
    public:
     hash256_one_by_one() { init(); }
 
+    // Starts a new message from a saved midstate
+    explicit hash256_one_by_one(const hash256_midstate& state) { restore_midstate(state); }
+
     void init() {
-        buffer_.clear();
+        buffer_size_ = 0;
+        compressions_ = 0;
         std::fill(data_length_digits_, data_length_digits_ + 4, word_t(0));
         std::copy(detail::initial_message_digest,
                   detail::initial_message_digest + 8, h_);
@@ -193,34 +226,68 @@ class hash256_one_by_one {
     template <typename RaIter>
     void process(RaIter first, RaIter last) {
         add_to_data_length(static_cast<word_t>(std::distance(first, last)));
-        std::copy(first, last, std::back_inserter(buffer_));
-        std::size_t i = 0;
-        for (; i + 64 <= buffer_.size(); i += 64) {
-            detail::hash256_block(h_, buffer_.begin() + i,
-                                  buffer_.begin() + i + 64);
+        // buffer partial blocks in place so hashing never touches the heap
+        while (first != last) {
+            std::size_t take = std::min<std::size_t>(
+                64 - buffer_size_, static_cast<std::size_t>(std::distance(first, last)));
+            for (std::size_t i = 0; i < take; ++i, ++first) {
+                buffer_[buffer_size_ + i] = static_cast<byte_t>(*first);
+            }
+            buffer_size_ += take;
+            if (buffer_size_ == 64) {
+                detail::block_compressor()(h_, buffer_, 1);
+                ++compressions_;
+                buffer_size_ = 0;
+            }
         }
-        buffer_.erase(buffer_.begin(), buffer_.begin() + i);
     }
 
     void finish() {
         byte_t temp[64];
         std::fill(temp, temp + 64, byte_t(0));
-        std::size_t remains = buffer_.size();
-        std::copy(buffer_.begin(), buffer_.end(), temp);
+        std::size_t remains = buffer_size_;
+        std::copy(buffer_, buffer_ + buffer_size_, temp);
         temp[remains] = 0x80;
 
         if (remains > 55) {
             std::fill(temp + remains + 1, temp + 64, byte_t(0));
-            detail::hash256_block(h_, temp, temp + 64);
+            detail::block_compressor()(h_, temp, 1);
+            ++compressions_;
             std::fill(temp, temp + 64 - 4, byte_t(0));
         } else {
             std::fill(temp + remains + 1, temp + 64 - 4, byte_t(0));
         }
 
         write_data_bit_length(&(temp[56]));
-        detail::hash256_block(h_, temp, temp + 64);
+        detail::block_compressor()(h_, temp, 1);
+        ++compressions_;
+    }
+
+    // Captures the state after the bytes processed so far; call before
+    // finish()
+    hash256_midstate save_midstate() const {
+        hash256_midstate state;
+        std::copy(h_, h_ + 8, state.h);
+        std::copy(buffer_, buffer_ + 64, state.buffer);
+        state.buffer_size = buffer_size_;
+        std::copy(data_length_digits_, data_length_digits_ + 4, state.data_length_digits);
+        state.compressions = compressions_;
+        return state;
+    }
+
+    // Continues from a saved state as if its bytes had just been processed
+    void restore_midstate(const hash256_midstate& state) {
+        std::copy(state.h, state.h + 8, h_);
+        std::copy(state.buffer, state.buffer + 64, buffer_);
+        buffer_size_ = state.buffer_size;
+        std::copy(state.data_length_digits, state.data_length_digits + 4, data_length_digits_);
+        compressions_ = state.compressions;
     }
 
+    // Compression function calls made since init(), including those of a
+    // restored midstate
+    std::size_t compressions() const { return compressions_; }
+
     template <typename OutIter>
     void get_hash_bytes(OutIter first, OutIter last) const {
         for (const word_t* iter = h_; iter != h_ + 8; ++iter) {
@@ -266,9 +333,11 @@ class hash256_one_by_one {
             (*begin++) = static_cast<byte_t>(data_bit_length_digits[i]);
         }
     }
-    std::vector<byte_t> buffer_;
+    byte_t buffer_[64];
+    std::size_t buffer_size_;
     word_t data_length_digits_[4];  // as 64bit integer (16bit x 4 integer)
     word_t h_[8];
+    std::size_t compressions_;
 };
 
 inline void get_hash_hex_string(const hash256_one_by_one& hasher,
@@ -0,0 +1,72 @@
+#ifndef RECOVERY_H
+#define RECOVERY_H
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include "blockchain.h"
+#include "checkpoint.h"
+#include "voter_registry.h"
+
+// Writes a checkpoint of the chain tip, its tally, the registry deltas
+// logged before the tip and the voted flags to path. Call from the thread
+// that appends blocks, with the blockchain and the registry attached to
+// the chain log.
+inline bool saveCheckpoint(const std::string& path, Blockchain& blockchain,
+                           VoterRegistry& registry) {
+    CheckpointData data;
+    if (!blockchain.captureCheckpoint(data)) {
+        return false;
+    }
+    // Captured after the tip, so every voter logged before it is included
+    data.voterCount = registry.snapshotVoted(data.logEnd, data.deltas, data.votedWords);
+    data.registryBytes = registry.registryBytes();
+    data.fileVoterCount = registry.fileVoterCount();
+    // The log must hold everything the checkpoint reflects before it exists
+    return blockchain.sync() && CheckpointFile::write(path, data);
+}
+
+// Restores the blockchain, the registry deltas and the voted flags from the
+// checkpoint at path and sets from to the log position to replay from.
+// Call before any delta is applied. Returns false, changing nothing, if
+// there is no checkpoint or it does not match the registry.
+inline bool loadCheckpoint(const std::string& path, Blockchain& blockchain, VoterRegistry& registry,
+                           LogPosition& from) {
+    CheckpointFile checkpoint;
+    if (!checkpoint.open(path)) {
+        return false;
+    }
+    if (checkpoint.fileVoterCount() != registry.voterCount() ||
+        checkpoint.registryBytes() != registry.registryBytes() || registry.deltasApplied() > 0) {
+        std::cerr << "Ignoring " << path << ": it was taken against a different voter registry"
+                  << std::endl;
+        return false;
+    }
+    if (blockchain.indexedHeights() <= checkpoint.height()) {
+        std::cerr << "Ignoring " << path << ": the chain index does not reach it, so the whole"
+                  << " log is replayed to rebuild the index" << std::endl;
+        return false;
+    }
+    if (!blockchain.restoreCheckpoint(checkpoint.height(), checkpoint.tipBlock(),
+                                      checkpoint.tipBlockBytes(), checkpoint.counts(),
+                                      checkpoint.logEnd())) {
+        std::cerr << "Ignoring " << path << ": its tip block does not match its hash" << std::endl;
+        return false;
+    }
+    for (std::string_view delta : checkpoint.deltas()) {
+        registry.restoreDelta(reinterpret_cast<const uint8_t*>(delta.data()), delta.size());
+    }
+    if (!registry.restoreVoted(checkpoint.votedWords(), checkpoint.voterCount(),
+                               checkpoint.registryBytes())) {
+        // The deltas are applied and the chain restored, so there is no
+        // falling back to a full replay from here
+        std::cerr << "Error: the registry deltas in " << path << " do not reproduce its registry;"
+                  << " remove it to replay the whole log" << std::endl;
+        std::exit(1);
+    }
+    from = checkpoint.logEnd();
+    return true;
+}
+
+#endif  // RECOVERY_H
@@ -0,0 +1,84 @@
+#ifndef REGISTRY_DELTA_WATCHER_H
+#define REGISTRY_DELTA_WATCHER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include "mapped_file.h"
+#include "voter_registry.h"
+
+// Applies registry delta files dropped at a fixed path while voting goes
+// on. About once a second the watcher looks for the file; when it is there
+// it is applied to the registry, the outcome is reported on stderr and the
+// file is renamed to PATH.applied so it is not applied twice. Write the
+// delta under another name and rename it into place, so it is never read
+// half written.
+class RegistryDeltaWatcher {
+public:
+    RegistryDeltaWatcher(VoterRegistry& registry, const std::string& path)
+        : registry(registry), path(path), stopping(false) {
+        worker = std::thread([this] { run(); });
+    }
+
+    ~RegistryDeltaWatcher() {
+        {
+            std::lock_guard<std::mutex> lock(stateLock);
+            stopping = true;
+        }
+        wake.notify_all();
+        worker.join();
+    }
+
+    RegistryDeltaWatcher(const RegistryDeltaWatcher&) = delete;
+    RegistryDeltaWatcher& operator=(const RegistryDeltaWatcher&) = delete;
+
+private:
+    void run() {
+        const auto poll = std::chrono::seconds(1);
+        std::unique_lock<std::mutex> lock(stateLock);
+        while (!wake.wait_for(lock, poll, [this] { return stopping; })) {
+            lock.unlock();
+            bool renamed = applyPending();
+            lock.lock();
+            if (!renamed) {
+                break;
+            }
+        }
+    }
+
+    // Applies the delta file if there is one; false if it could not be
+    // moved out of the way afterwards
+    bool applyPending() {
+        MappedFile delta;
+        if (!delta.open(path)) {
+            return true;
+        }
+        RegistryDeltaCounts counts =
+            registry.applyDelta(std::string_view(delta.data(), delta.size()));
+        delta.close();
+        std::string applied = path + ".applied";
+        if (std::rename(path.c_str(), applied.c_str()) != 0) {
+            std::cerr << "Error: Could not rename " << path << " to " << applied
+                      << "; stopping registry updates" << std::endl;
+            return false;
+        }
+        std::cerr << "Registry delta " << path << ": " << counts.added << " added, "
+                  << counts.updated << " updated, " << counts.removed << " removed, "
+                  << counts.rejected << " rejected" << std::endl;
+        return true;
+    }
+
+    VoterRegistry& registry;
+    std::string path;
+    bool stopping;
+    std::mutex stateLock;
+    std::condition_variable wake;
+    std::thread worker;
+};
+
+#endif  // REGISTRY_DELTA_WATCHER_H
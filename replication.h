@@ -0,0 +1,707 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "blockchain.h"
+#include "chain_log.h"
+#include "voter_registry.h"
+
+// Leader/follower replication of the chain log over a stream socket, for
+// a hot standby on the same machine or network. Addresses are "unix:PATH"
+// (or any path starting with '/') for a Unix socket, or "HOST:PORT" for
+// TCP with a numeric IPv4 host such as 127.0.0.1.
+//
+// The leader ships the raw bytes of its chain log, block, voted and
+// registry delta records alike, straight from the segment files with sendfile(), as soon as a
+// group commit makes them durable. Messages, integers in host order like
+// the log itself:
+//   hello  follower -> leader  u32 'VRH1' | u32 segment | u64 offset
+//   data   leader -> follower  u32 'VRD1' | u32 segment | u64 offset | u64 frame
+//                              | u32 bytes | u32 0, then the log bytes
+//   ack    follower -> leader  u32 'VRA1' | u32 0 | u64 frame | u64 height
+// The hello names the leader log position the follower resumes from; each
+// data frame carries the next bytes of one segment, up to 1 MiB, and may end
+// inside a record. Up to kWindowFrames frames are in flight before the
+// leader waits for an ack, so shipping overlaps with the follower's work.
+//
+// The follower checks each record's checksum, appends blocks only if they
+// link to its tip and hash correctly, writes everything to its own chain
+// log and acknowledges once that log has made it durable.
+namespace replication {
+
+constexpr uint32_t kHelloMagic = 0x31485256; // "VRH1"
+constexpr uint32_t kDataMagic = 0x31445256;  // "VRD1"
+constexpr uint32_t kAckMagic = 0x31415256;   // "VRA1"
+constexpr std::size_t kMaxFrameBytes = 1 << 20;
+constexpr uint64_t kWindowFrames = 32;
+
+struct Hello {
+    uint32_t magic;
+    uint32_t segment;
+    uint64_t offset;
+};
+
+struct DataHeader {
+    uint32_t magic;
+    uint32_t segment;
+    uint64_t offset;
+    uint64_t frame;
+    uint32_t bytes;
+    uint32_t reserved;
+};
+
+struct Ack {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t frame;  // Last data frame durable on the follower
+    uint64_t height; // Blocks in the follower's chain once that frame is applied
+};
+
+// Fills a socket address from "unix:PATH", "/PATH" or "HOST:PORT"
+inline bool parseAddress(const std::string& address, sockaddr_storage& storage,
+                         socklen_t& length) {
+    std::memset(&storage, 0, sizeof(storage));
+    std::string path = address.compare(0, 5, "unix:") == 0 ? address.substr(5) : std::string();
+    if (path.empty() && !address.empty() && address[0] == '/') {
+        path = address;
+    }
+    if (!path.empty()) {
+        sockaddr_un* unixAddress = reinterpret_cast<sockaddr_un*>(&storage);
+        if (path.size() >= sizeof(unixAddress->sun_path)) {
+            return false;
+        }
+        unixAddress->sun_family = AF_UNIX;
+        std::memcpy(unixAddress->sun_path, path.c_str(), path.size() + 1);
+        length = sizeof(sockaddr_un);
+        return true;
+    }
+    std::size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+    sockaddr_in* inetAddress = reinterpret_cast<sockaddr_in*>(&storage);
+    inetAddress->sin_family = AF_INET;
+    inetAddress->sin_port = htons(static_cast<uint16_t>(std::atoi(address.c_str() + colon + 1)));
+    length = sizeof(sockaddr_in);
+    return inet_pton(AF_INET, address.substr(0, colon).c_str(), &inetAddress->sin_addr) == 1;
+}
+
+inline void disableNagle(int socket, const sockaddr_storage& storage) {
+    if (storage.ss_family == AF_INET) {
+        int on = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+}
+
+inline bool sendAll(int socket, const void* data, std::size_t size, int flags = 0) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = ::send(socket, bytes, size, flags | MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+inline bool receiveAll(int socket, void* data, std::size_t size) {
+    char* bytes = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = ::recv(socket, bytes, size, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+// Ships the durable chain log to every follower that connects. Each
+// follower gets a sender thread, which streams the log as it becomes
+// durable, and a thread reading its acks.
+class Leader {
+public:
+    // Replication state of one connected follower
+    struct FollowerStatus {
+        uint64_t framesSent = 0;
+        uint64_t bytesSent = 0;
+        uint64_t ackedFrames = 0;
+        uint64_t ackedHeight = 0;    // Follower's durable chain height
+        double lastLagMicros = 0;    // From sending a frame to its ack
+        double maxLagMicros = 0;
+        bool connected = true;
+    };
+
+    explicit Leader(ChainLog& chainLog) : log(chainLog), listener(-1), stopping(false) {}
+
+    Leader(const Leader&) = delete;
+    Leader& operator=(const Leader&) = delete;
+
+    ~Leader() { stop(); }
+
+    // Starts accepting followers at address. SIGPIPE is ignored from then
+    // on, so a follower going away fails a send instead of the process.
+    bool listen(const std::string& address) {
+        sockaddr_storage storage;
+        socklen_t length;
+        if (!parseAddress(address, storage, length)) {
+            std::cerr << "Error: Bad replication address " << address << std::endl;
+            return false;
+        }
+        if (storage.ss_family == AF_UNIX) {
+            ::unlink(reinterpret_cast<sockaddr_un*>(&storage)->sun_path);
+        }
+        listener = ::socket(storage.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int on = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr*>(&storage), length) != 0 ||
+            ::listen(listener, 16) != 0) {
+            std::cerr << "Error: Could not listen on " << address << ": " << std::strerror(errno)
+                      << std::endl;
+            stop();
+            return false;
+        }
+        std::signal(SIGPIPE, SIG_IGN);
+        acceptor = std::thread([this] { acceptFollowers(); });
+        return true;
+    }
+
+    // Disconnects every follower and stops listening
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(stateLock);
+            stopping = true;
+            for (std::unique_ptr<Follower>& follower : followers) {
+                ::shutdown(follower->socket, SHUT_RDWR);
+            }
+        }
+        windowOpen.notify_all();
+        if (listener >= 0) {
+            ::shutdown(listener, SHUT_RDWR);
+        }
+        if (acceptor.joinable()) {
+            acceptor.join();
+        }
+        for (std::unique_ptr<Follower>& follower : followers) {
+            release(*follower);
+        }
+        followers.clear();
+        if (listener >= 0) {
+            ::close(listener);
+            listener = -1;
+        }
+    }
+
+    // Status of every follower held, in connection order: the connected
+    // ones and those that disconnected after the newest was accepted
+    std::vector<FollowerStatus> status() const {
+        std::lock_guard<std::mutex> lock(stateLock);
+        std::vector<FollowerStatus> result;
+        for (const std::unique_ptr<Follower>& follower : followers) {
+            result.push_back(follower->status);
+        }
+        return result;
+    }
+
+    // Waits until count followers have acknowledged a chain of height
+    // blocks, or the timeout passes
+    bool waitForAcks(std::size_t count, uint64_t height, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(stateLock);
+        return acked.wait_for(lock, timeout, [this, count, height] {
+            std::size_t caughtUp = 0;
+            for (const std::unique_ptr<Follower>& follower : followers) {
+                caughtUp += follower->status.ackedHeight >= height ? 1 : 0;
+            }
+            return caughtUp >= count;
+        });
+    }
+
+private:
+    struct Follower {
+        int socket;
+        FollowerStatus status;
+        std::deque<std::pair<uint64_t, std::chrono::steady_clock::time_point>> inFlight;
+        std::thread sender;
+        std::thread ackReader;
+    };
+
+    void acceptFollowers() {
+        while (true) {
+            int socket = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (socket < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                return;
+            }
+            // Followers that have disconnected are released here, so one
+            // that keeps reconnecting does not pile up sockets and threads
+            std::vector<std::unique_ptr<Follower>> disconnected;
+            {
+                std::lock_guard<std::mutex> lock(stateLock);
+                if (stopping) {
+                    ::close(socket);
+                    return;
+                }
+                for (auto it = followers.begin(); it != followers.end();) {
+                    if ((*it)->status.connected) {
+                        ++it;
+                        continue;
+                    }
+                    ::shutdown((*it)->socket, SHUT_RDWR);  // stops a half-closed sender
+                    disconnected.push_back(std::move(*it));
+                    it = followers.erase(it);
+                }
+                // Only takes effect on TCP; Unix sockets have no Nagle delay
+                int on = 1;
+                setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                followers.emplace_back(new Follower());
+                Follower* follower = followers.back().get();
+                follower->socket = socket;
+                follower->sender = std::thread([this, follower] { ship(*follower); });
+            }
+            windowOpen.notify_all();
+            for (std::unique_ptr<Follower>& follower : disconnected) {
+                release(*follower);
+            }
+        }
+    }
+
+    // Joins a follower's threads and closes its socket; call without
+    // stateLock once it is disconnected or stopping is set. The sender is
+    // joined first, as it is what starts the ack reader.
+    static void release(Follower& follower) {
+        if (follower.sender.joinable()) {
+            follower.sender.join();
+        }
+        if (follower.ackReader.joinable()) {
+            follower.ackReader.join();
+        }
+        ::close(follower.socket);
+    }
+
+    // Sender thread: validates the hello, then streams the log from there
+    void ship(Follower& follower) {
+        Hello hello;
+        LogPosition position;
+        bool ok = receiveAll(follower.socket, &hello, sizeof(hello)) && hello.magic == kHelloMagic;
+        position.segment = hello.segment;
+        position.offset = hello.offset;
+        LogPosition durable = log.durableEnd();
+        if (ok && (position.segment > durable.segment ||
+                   (position.segment == durable.segment && position.offset > durable.offset))) {
+            std::cerr << "Replication follower asked for log position " << position.segment << ":"
+                      << position.offset << " past the leader's end" << std::endl;
+            ok = false;
+        }
+        if (ok) {
+            follower.ackReader = std::thread([this, &follower] { readAcks(follower); });
+        }
+        int segmentFile = -1;
+        uint32_t openSegment = 0;
+        uint64_t frame = 0;
+        while (ok) {
+            durable = log.durableEnd();
+            if (durable.segment == position.segment && durable.offset == position.offset) {
+                {
+                    std::lock_guard<std::mutex> lock(stateLock);
+                    if (stopping || !follower.status.connected) {
+                        break;
+                    }
+                }
+                log.waitDurablePast(position, std::chrono::milliseconds(100));
+                continue;
+            }
+            if (segmentFile < 0 || openSegment != position.segment) {
+                if (segmentFile >= 0) {
+                    ::close(segmentFile);
+                }
+                segmentFile = log.openSegmentForReading(position.segment);
+                openSegment = position.segment;
+                if (segmentFile < 0) {
+                    break;
+                }
+            }
+            // The whole of an earlier segment is durable
+            uint64_t end = durable.offset;
+            if (durable.segment != position.segment) {
+                struct stat info;
+                if (fstat(segmentFile, &info) != 0) {
+                    break;
+                }
+                end = static_cast<uint64_t>(info.st_size);
+                if (end == position.offset) {
+                    position.segment++;
+                    position.offset = 0;
+                    continue;
+                }
+            }
+            uint32_t bytes = static_cast<uint32_t>(std::min<uint64_t>(end - position.offset,
+                                                                      kMaxFrameBytes));
+            if (!waitForWindow(follower, frame)) {
+                break;
+            }
+            DataHeader header{kDataMagic, position.segment, position.offset, frame, bytes, 0};
+            ok = sendAll(follower.socket, &header, sizeof(header), MSG_MORE) &&
+                 sendRange(follower.socket, segmentFile, position.offset, bytes);
+            position.offset += bytes;
+            std::lock_guard<std::mutex> lock(stateLock);
+            follower.status.framesSent++;
+            follower.status.bytesSent += bytes;
+            follower.inFlight.emplace_back(frame, std::chrono::steady_clock::now());
+            ++frame;
+        }
+        if (segmentFile >= 0) {
+            ::close(segmentFile);
+        }
+        ::shutdown(follower.socket, SHUT_RDWR);
+        std::lock_guard<std::mutex> lock(stateLock);
+        follower.status.connected = false;
+    }
+
+    // Zero-copy send of bytes [offset, offset + bytes) of a segment file
+    static bool sendRange(int socket, int file, uint64_t offset, std::size_t bytes) {
+        off_t from = static_cast<off_t>(offset);
+        while (bytes > 0) {
+            ssize_t n = ::sendfile(socket, file, &from, bytes);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            bytes -= static_cast<std::size_t>(n);
+        }
+        return true;
+    }
+
+    // Waits while kWindowFrames frames are unacknowledged
+    bool waitForWindow(Follower& follower, uint64_t frame) {
+        std::unique_lock<std::mutex> lock(stateLock);
+        windowOpen.wait(lock, [this, &follower, frame] {
+            return stopping || !follower.status.connected ||
+                   frame < follower.status.ackedFrames + kWindowFrames;
+        });
+        return !stopping && follower.status.connected;
+    }
+
+    void readAcks(Follower& follower) {
+        Ack ack;
+        while (receiveAll(follower.socket, &ack, sizeof(ack)) && ack.magic == kAckMagic) {
+            auto now = std::chrono::steady_clock::now();
+            std::unique_lock<std::mutex> lock(stateLock);
+            std::chrono::steady_clock::time_point sent = now;
+            while (!follower.inFlight.empty() && follower.inFlight.front().first <= ack.frame) {
+                sent = follower.inFlight.front().second;
+                follower.inFlight.pop_front();
+            }
+            std::chrono::nanoseconds lag = now - sent;
+            FollowerStatus& status = follower.status;
+            status.ackedFrames = std::max(status.ackedFrames, ack.frame + 1);
+            status.ackedHeight = std::max(status.ackedHeight, ack.height);
+            status.lastLagMicros = lag.count() / 1000.0;
+            status.maxLagMicros = std::max(status.maxLagMicros, status.lastLagMicros);
+            lock.unlock();
+            windowOpen.notify_all();
+            acked.notify_all();
+        }
+        {
+            std::lock_guard<std::mutex> lock(stateLock);
+            follower.status.connected = false;
+        }
+        windowOpen.notify_all();
+        acked.notify_all();
+    }
+
+    ChainLog& log;
+    int listener;
+    std::thread acceptor;
+    mutable std::mutex stateLock;
+    std::condition_variable windowOpen;
+    std::condition_variable acked;
+    std::vector<std::unique_ptr<Follower>> followers;
+    bool stopping;
+};
+
+// Applies the log shipped by a leader to a local chain, its chain log and,
+// optionally, the voter registry's voted flags and deltas. The chain must
+// already be attached to the log; the registry must not be, as voted and
+// delta records are copied into the log as they arrive.
+//
+// Where the leader's log has been applied up to is kept in a small state
+// file, rewritten with every ack, so a restarted follower resumes there.
+// Records the follower already has, for example after a crash between its
+// log commit and the state file update, are checked against the local
+// chain and skipped.
+class Follower {
+public:
+    Follower(Blockchain& chain, ChainLog& chainLog, VoterRegistry* registry,
+             const std::string& statePath)
+        : chain(chain), log(chainLog), registry(registry), statePath(statePath), socket(-1),
+          nextHeight(0), acking(true), ackerFailed(false) {
+        position.segment = 0;
+        position.offset = 0;
+        std::ifstream state(statePath);
+        unsigned long long segment, offset, height;
+        if (state >> segment >> offset >> height && height <= chain.size()) {
+            position.segment = static_cast<uint32_t>(segment);
+            position.offset = offset;
+            nextHeight = height;
+        }
+    }
+
+    Follower(const Follower&) = delete;
+    Follower& operator=(const Follower&) = delete;
+
+    ~Follower() {
+        stop();
+        if (socket >= 0) {
+            ::close(socket);
+        }
+    }
+
+    bool connect(const std::string& address) {
+        sockaddr_storage storage;
+        socklen_t length;
+        if (!parseAddress(address, storage, length)) {
+            std::cerr << "Error: Bad replication address " << address << std::endl;
+            return false;
+        }
+        socket = ::socket(storage.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (socket < 0 || ::connect(socket, reinterpret_cast<sockaddr*>(&storage), length) != 0) {
+            std::cerr << "Error: Could not connect to " << address << ": " << std::strerror(errno)
+                      << std::endl;
+            return false;
+        }
+        disableNagle(socket, storage);
+        return true;
+    }
+
+    // Applies shipped records until the leader disconnects or stop() is
+    // called. False if the leader's log does not match the local chain or a
+    // record is damaged.
+    bool run() {
+        Hello hello{kHelloMagic, position.segment, position.offset};
+        if (!sendAll(socket, &hello, sizeof(hello))) {
+            return false;
+        }
+        acker = std::thread([this] { sendAcks(); });
+        std::vector<uint8_t> pending;  // Bytes of records not yet complete
+        bool ok = true;
+        DataHeader header;
+        while (ok && receiveAll(socket, &header, sizeof(header))) {
+            uint64_t expected = position.offset + pending.size();
+            bool nextSegment = header.segment == position.segment + 1 && header.offset == 0 &&
+                               pending.empty();
+            if (header.magic != kDataMagic || header.bytes > kMaxFrameBytes ||
+                (!nextSegment && (header.segment != position.segment ||
+                                  header.offset != expected))) {
+                std::cerr << "Replication stream out of order" << std::endl;
+                ok = false;
+                break;
+            }
+            if (nextSegment) {
+                position.segment = header.segment;
+                position.offset = 0;
+            }
+            std::size_t filled = pending.size();
+            pending.resize(filled + header.bytes);
+            if (!receiveAll(socket, pending.data() + filled, header.bytes)) {
+                break;
+            }
+            std::size_t used = 0;
+            ok = applyRecords(pending, used);
+            pending.erase(pending.begin(), pending.begin() + used);
+            position.offset += used;
+            std::lock_guard<std::mutex> lock(ackLock);
+            toAck.push_back(Applied{header.frame, position, nextHeight, log.lastSequence()});
+            ackReady.notify_one();
+        }
+        stopAcker();
+        return ok && !ackerFailed;
+    }
+
+    // Ends run() from another thread
+    void stop() {
+        if (socket >= 0) {
+            ::shutdown(socket, SHUT_RDWR);
+        }
+    }
+
+    // Blocks in the local chain that have come from the leader
+    uint64_t height() const {
+        return chain.size();
+    }
+
+private:
+    // What applying one data frame led to, awaiting the local commit
+    struct Applied {
+        uint64_t frame;
+        LogPosition position;  // Leader log position applied up to
+        uint64_t height;
+        uint64_t logSeq;       // Local log record that makes it durable
+    };
+
+    // Applies the complete records at the start of bytes; used receives the
+    // bytes they take up
+    bool applyRecords(const std::vector<uint8_t>& bytes, std::size_t& used) {
+        used = 0;
+        while (bytes.size() - used >= ChainLog::frameBytes(0)) {
+            uint32_t length, crc;
+            std::memcpy(&length, &bytes[used], 4);
+            std::memcpy(&crc, &bytes[used + 4], 4);
+            if (length == 0) {
+                std::cerr << "Replicated log record is damaged" << std::endl;
+                return false;
+            }
+            if (bytes.size() - used - 8 < length) {
+                return true;  // the rest arrives with the next frame
+            }
+            const uint8_t* record = &bytes[used + 8];
+            if (crc32c(record, length) != crc) {
+                std::cerr << "Replicated log record is damaged" << std::endl;
+                return false;
+            }
+            if (!applyRecord(record[0], record + 1, length - 1)) {
+                return false;
+            }
+            used += 8 + length;
+        }
+        return true;
+    }
+
+    bool applyRecord(uint8_t type, const uint8_t* payload, std::size_t size) {
+        bool known = nextHeight < chain.size();  // already applied before a restart
+        if (type == VotedRecord || type == RegistryDeltaRecord) {
+            if (!known) {
+                LogPosition end;
+                log.append(type, payload, size, &end);
+                if (registry != nullptr && type == VotedRecord) {
+                    registry->restoreVoted(payload, size);
+                } else if (registry != nullptr) {
+                    registry->restoreDelta(payload, size, end);
+                }
+            }
+            return true;
+        }
+        if (type != BlockRecord) {
+            return true;
+        }
+        if (known) {
+            Hash256 hash;
+            if (size >= 68 && nextHeight >= chain.firstHeight()) {
+                std::memcpy(hash.data(), payload + 36, 32);
+                if (chain.at(nextHeight).hash != hash) {
+                    std::cerr << "Replicated block " << nextHeight
+                              << " differs from the local chain" << std::endl;
+                    return false;
+                }
+            }
+        } else if (!chain.appendRecord(payload, size)) {
+            std::cerr << "Replicated block " << nextHeight << " does not extend the local chain"
+                      << std::endl;
+            return false;
+        }
+        ++nextHeight;
+        return true;
+    }
+
+    // Ack thread: waits for the local log to commit what was applied, then
+    // records the position and acknowledges the newest frame
+    void sendAcks() {
+        std::unique_lock<std::mutex> lock(ackLock);
+        while (true) {
+            ackReady.wait(lock, [this] { return !toAck.empty() || !acking; });
+            if (toAck.empty()) {
+                return;
+            }
+            Applied newest = toAck.back();
+            toAck.clear();
+            lock.unlock();
+            bool ok = log.waitDurable(newest.logSeq) && saveState(newest);
+            Ack ack{kAckMagic, 0, newest.frame, newest.height};
+            ok = ok && sendAll(socket, &ack, sizeof(ack));
+            lock.lock();
+            if (!ok) {
+                ackerFailed = !log.ok();
+                return;
+            }
+        }
+    }
+
+    void stopAcker() {
+        {
+            std::lock_guard<std::mutex> lock(ackLock);
+            acking = false;
+        }
+        ackReady.notify_one();
+        if (acker.joinable()) {
+            acker.join();
+        }
+    }
+
+    bool saveState(const Applied& applied) {
+        std::string temporary = statePath + ".tmp";
+        {
+            std::ofstream state(temporary, std::ios::trunc);
+            state << applied.position.segment << ' ' << applied.position.offset << ' '
+                  << applied.height << '\n';
+            if (!state) {
+                return false;
+            }
+        }
+        return std::rename(temporary.c_str(), statePath.c_str()) == 0;
+    }
+
+    Blockchain& chain;
+    ChainLog& log;
+    VoterRegistry* registry;
+    std::string statePath;
+    int socket;
+    LogPosition position; // Leader log position of the first byte not applied
+    uint64_t nextHeight;  // Height of the next block record in the stream
+
+    std::thread acker;
+    std::mutex ackLock;
+    std::condition_variable ackReady;
+    std::deque<Applied> toAck;
+    bool acking;
+    bool ackerFailed;
+};
+
+}  // namespace replication
+
+#endif  // REPLICATION_H
@@ -0,0 +1,420 @@
+#ifndef SHA256_BACKEND_H
+#define SHA256_BACKEND_H
+
+// Runtime-selected SHA-256 compression backends for picosha2.
+//
+// Including this header installs the fastest backend the CPU supports into
+// picosha2's block compressor, so every existing picosha2 call site
+// (hash256_one_by_one, hash256, hash256_hex_string) picks it up unchanged:
+//
+//   scalar  - the portable picosha2::detail::hash256_block code
+//   sha_ni  - x86 SHA extensions, one message at a time
+//   avx2    - 8-lane multi-buffer code; only used by hash256_many(), which
+//             hashes independent messages side by side
+//
+// The chosen backend is checked against the scalar code before it is
+// installed and the scalar code is kept if they disagree.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "picosha2.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PICOSHA2_BACKEND_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace picosha2 {
+namespace backend {
+
+enum kind { scalar, sha_ni, avx2 };
+
+namespace detail {
+
+const uint32_t round_constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+#ifdef PICOSHA2_BACKEND_X86
+
+inline bool cpu_has(kind k) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    bool sse41 = (ecx & bit_SSE4_1) != 0;
+    bool osxsave = (ecx & bit_OSXSAVE) != 0;
+    if (__get_cpuid_max(0, nullptr) < 7) {
+        return false;
+    }
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    if (k == sha_ni) {
+        return sse41 && (ebx & bit_SHA) != 0;
+    }
+    if (k == avx2) {
+        if (!osxsave || (ebx & bit_AVX2) == 0) {
+            return false;
+        }
+        // the OS must save the YMM registers on context switch
+        unsigned int xcr0_lo, xcr0_hi;
+        __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+        return (xcr0_lo & 0x6) == 0x6;
+    }
+    return true;
+}
+
+__attribute__((target("sha,sse4.1"))) inline void compress_sha_ni(
+    uint32_t state[8], const byte_t* data, std::size_t block_count) {
+    const __m128i byte_swap =
+        _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0]));
+    __m128i state1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4]));
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);           // CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1B);     // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);  // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);  // CDGH
+
+    for (; block_count > 0; --block_count, data += 64) {
+        __m128i abef_save = state0;
+        __m128i cdgh_save = state1;
+        __m128i w[4];
+        for (int i = 0; i < 16; ++i) {
+            __m128i msg;
+            if (i < 4) {
+                msg = _mm_shuffle_epi8(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * i)),
+                    byte_swap);
+            } else {
+                // w[i-4], w[i-3], w[i-2], w[i-1] live at (i, i+1, i+2, i+3) & 3
+                msg = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+                msg = _mm_add_epi32(msg, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+                msg = _mm_sha256msg2_epu32(msg, w[(i + 3) & 3]);
+            }
+            w[i & 3] = msg;
+            __m128i k = _mm_add_epi32(
+                msg, _mm_loadu_si128(reinterpret_cast<const __m128i*>(&round_constants[4 * i])));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, k);
+            k = _mm_shuffle_epi32(k, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, k);
+        }
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);        // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);     // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);  // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);     // HGFE
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), state0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), state1);
+}
+
+__attribute__((target("avx2"))) inline __m256i rotr_x8(__m256i x, int n) {
+    return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+}
+
+// One 64-byte block for each of 8 independent states. state[j] holds word j
+// of all eight lanes; lanes whose bit in active_mask is clear keep their state.
+__attribute__((target("avx2"))) inline void compress_avx2_x8(
+    __m256i state[8], const byte_t* const blocks[8], __m256i active_mask) {
+    __m256i w[64];
+    for (int t = 0; t < 16; ++t) {
+        uint32_t words[8];
+        for (int lane = 0; lane < 8; ++lane) {
+            uint32_t word;
+            std::memcpy(&word, blocks[lane] + 4 * t, 4);
+            words[lane] = __builtin_bswap32(word);
+        }
+        w[t] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words));
+    }
+    for (int t = 16; t < 64; ++t) {
+        __m256i s0 = _mm256_xor_si256(
+            _mm256_xor_si256(rotr_x8(w[t - 15], 7), rotr_x8(w[t - 15], 18)),
+            _mm256_srli_epi32(w[t - 15], 3));
+        __m256i s1 = _mm256_xor_si256(
+            _mm256_xor_si256(rotr_x8(w[t - 2], 17), rotr_x8(w[t - 2], 19)),
+            _mm256_srli_epi32(w[t - 2], 10));
+        w[t] = _mm256_add_epi32(_mm256_add_epi32(w[t - 16], s0),
+                                _mm256_add_epi32(w[t - 7], s1));
+    }
+
+    __m256i a = state[0], b = state[1], c = state[2], d = state[3];
+    __m256i e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int t = 0; t < 64; ++t) {
+        __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(rotr_x8(e, 6), rotr_x8(e, 11)),
+                                      rotr_x8(e, 25));
+        __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+        __m256i temp1 = _mm256_add_epi32(
+            _mm256_add_epi32(_mm256_add_epi32(h, s1), ch),
+            _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(round_constants[t])), w[t]));
+        __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(rotr_x8(a, 2), rotr_x8(a, 13)),
+                                      rotr_x8(a, 22));
+        __m256i maj = _mm256_xor_si256(
+            _mm256_xor_si256(_mm256_and_si256(a, b), _mm256_and_si256(a, c)),
+            _mm256_and_si256(b, c));
+        __m256i temp2 = _mm256_add_epi32(s0, maj);
+        h = g;
+        g = f;
+        f = e;
+        e = _mm256_add_epi32(d, temp1);
+        d = c;
+        c = b;
+        b = a;
+        a = _mm256_add_epi32(temp1, temp2);
+    }
+
+    __m256i out[8] = {a, b, c, d, e, f, g, h};
+    for (int j = 0; j < 8; ++j) {
+        state[j] = _mm256_blendv_epi8(state[j], _mm256_add_epi32(state[j], out[j]), active_mask);
+    }
+}
+
+#else
+
+inline bool cpu_has(kind k) { return k == scalar; }
+
+#endif  // PICOSHA2_BACKEND_X86
+
+// Adapts a uint32_t compressor to picosha2's word_t digest layout
+template <void (*Compress)(uint32_t*, const byte_t*, std::size_t)>
+void compress_words(word_t* message_digest, const byte_t* blocks, std::size_t block_count) {
+    uint32_t state[8];
+    for (int i = 0; i < 8; ++i) {
+        state[i] = static_cast<uint32_t>(message_digest[i]);
+    }
+    Compress(state, blocks, block_count);
+    for (int i = 0; i < 8; ++i) {
+        message_digest[i] = state[i];
+    }
+}
+
+inline kind& multi_buffer_kind() {
+    static kind k = scalar;
+    return k;
+}
+
+// Number of 64-byte blocks a message of the given length pads out to
+inline std::size_t padded_block_count(std::size_t length) {
+    return (length + 9 + 63) / 64;
+}
+
+// Writes the final one or two padded blocks of a message into tail (128 bytes)
+inline void pad_tail(const byte_t* data, std::size_t length, byte_t* tail) {
+    std::size_t full = length / 64;
+    std::size_t remains = length - full * 64;
+    std::memset(tail, 0, 128);
+    std::memcpy(tail, data + full * 64, remains);
+    tail[remains] = 0x80;
+    std::size_t tail_blocks = padded_block_count(length) - full;
+    uint64_t bit_length = static_cast<uint64_t>(length) * 8;
+    for (int i = 0; i < 8; ++i) {
+        tail[tail_blocks * 64 - 1 - i] = static_cast<byte_t>(bit_length >> (8 * i));
+    }
+}
+
+inline void store_digest(const word_t* message_digest, byte_t* out) {
+    for (int i = 0; i < 8; ++i) {
+        out[4 * i] = static_cast<byte_t>(message_digest[i] >> 24);
+        out[4 * i + 1] = static_cast<byte_t>(message_digest[i] >> 16);
+        out[4 * i + 2] = static_cast<byte_t>(message_digest[i] >> 8);
+        out[4 * i + 3] = static_cast<byte_t>(message_digest[i]);
+    }
+}
+
+#ifdef PICOSHA2_BACKEND_X86
+
+// Hashes up to eight messages side by side, one per AVX2 lane
+__attribute__((target("avx2"))) inline void hash256_x8_avx2(
+    const byte_t* const* messages, const std::size_t* lengths, std::size_t lanes, byte_t* out) {
+    static const byte_t zero_block[64] = {};
+    byte_t tails[8][128];
+    std::size_t full[8] = {}, total[8] = {}, most = 0;
+    for (std::size_t lane = 0; lane < lanes; ++lane) {
+        full[lane] = lengths[lane] / 64;
+        total[lane] = padded_block_count(lengths[lane]);
+        pad_tail(messages[lane], lengths[lane], tails[lane]);
+        most = std::max(most, total[lane]);
+    }
+    __m256i state[8];
+    for (int j = 0; j < 8; ++j) {
+        state[j] = _mm256_set1_epi32(
+            static_cast<int>(picosha2::detail::initial_message_digest[j]));
+    }
+    for (std::size_t block = 0; block < most; ++block) {
+        const byte_t* blocks[8];
+        int32_t active_lanes[8];
+        for (std::size_t lane = 0; lane < 8; ++lane) {
+            bool live = block < total[lane];
+            active_lanes[lane] = live ? -1 : 0;
+            if (!live) {
+                blocks[lane] = zero_block;
+            } else if (block < full[lane]) {
+                blocks[lane] = messages[lane] + 64 * block;
+            } else {
+                blocks[lane] = tails[lane] + 64 * (block - full[lane]);
+            }
+        }
+        compress_avx2_x8(state, blocks,
+                         _mm256_loadu_si256(reinterpret_cast<const __m256i*>(active_lanes)));
+    }
+    uint32_t words[8][8];
+    for (int j = 0; j < 8; ++j) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(words[j]), state[j]);
+    }
+    for (std::size_t lane = 0; lane < lanes; ++lane) {
+        word_t h[8];
+        for (int j = 0; j < 8; ++j) {
+            h[j] = words[j][lane];
+        }
+        store_digest(h, out + 32 * lane);
+    }
+}
+
+#endif  // PICOSHA2_BACKEND_X86
+
+}  // namespace detail
+
+// Whether the running CPU can execute the given backend
+inline bool supported(kind k) { return detail::cpu_has(k); }
+
+inline const char* name(kind k) {
+    switch (k) {
+        case sha_ni:
+            return "sha_ni";
+        case avx2:
+            return "avx2";
+        default:
+            return "scalar";
+    }
+}
+
+// Backend currently used by hash256_many()
+inline kind active() { return detail::multi_buffer_kind(); }
+
+// Hashes one contiguous message with the installed compressor
+inline void hash256(const byte_t* data, std::size_t length, byte_t* out) {
+    word_t h[8];
+    std::copy(picosha2::detail::initial_message_digest,
+              picosha2::detail::initial_message_digest + 8, h);
+    std::size_t full = length / 64;
+    picosha2::detail::block_compressor()(h, data, full);
+    byte_t tail[128];
+    detail::pad_tail(data, length, tail);
+    picosha2::detail::block_compressor()(h, tail, detail::padded_block_count(length) - full);
+    detail::store_digest(h, out);
+}
+
+// Hashes count independent messages, writing digest i to out + 32 * i.
+// With the avx2 backend eight messages are compressed at once.
+inline void hash256_many(const byte_t* const* messages, const std::size_t* lengths,
+                         std::size_t count, byte_t* out) {
+#ifdef PICOSHA2_BACKEND_X86
+    if (active() == avx2) {
+        for (std::size_t base = 0; base < count; base += 8) {
+            detail::hash256_x8_avx2(messages + base, lengths + base,
+                                    std::min<std::size_t>(8, count - base), out + 32 * base);
+        }
+        return;
+    }
+#endif
+    for (std::size_t i = 0; i < count; ++i) {
+        hash256(messages[i], lengths[i], out + 32 * i);
+    }
+}
+
+// Installs separate backends for single messages (scalar or sha_ni) and for
+// hash256_many(); returns false and changes nothing if either is unsupported
+inline bool select(kind single, kind many) {
+    if (single == avx2 || !supported(single) || !supported(many)) {
+        return false;
+    }
+#ifdef PICOSHA2_BACKEND_X86
+    if (single == sha_ni) {
+        picosha2::detail::block_compressor() =
+            &detail::compress_words<&detail::compress_sha_ni>;
+    } else {
+        picosha2::detail::block_compressor() = &picosha2::detail::compress_scalar;
+    }
+#endif
+    detail::multi_buffer_kind() = many;
+    return true;
+}
+
+// Installs one backend everywhere; avx2 only speeds up independent messages,
+// so single messages keep the scalar compressor under it
+inline bool select(kind k) {
+    return select(k == avx2 ? scalar : k, k);
+}
+
+// Checks the active backend against the portable scalar code on a spread of
+// message lengths covering one and two padding blocks
+inline bool self_test() {
+    std::vector<byte_t> message(300);
+    for (std::size_t i = 0; i < message.size(); ++i) {
+        message[i] = static_cast<byte_t>(i * 131 + 7);
+    }
+    const std::size_t lengths[] = {0, 3, 55, 56, 63, 64, 65, 119, 128, 300};
+    const std::size_t count = sizeof(lengths) / sizeof(lengths[0]);
+    const byte_t* messages[count];
+    for (std::size_t i = 0; i < count; ++i) {
+        messages[i] = message.data();
+    }
+    byte_t many[count * 32];
+    hash256_many(messages, lengths, count, many);
+    for (std::size_t i = 0; i < count; ++i) {
+        word_t h[8];
+        std::copy(picosha2::detail::initial_message_digest,
+                  picosha2::detail::initial_message_digest + 8, h);
+        std::size_t full = lengths[i] / 64;
+        picosha2::detail::compress_scalar(h, message.data(), full);
+        byte_t tail[128];
+        detail::pad_tail(message.data(), lengths[i], tail);
+        picosha2::detail::compress_scalar(h, tail, detail::padded_block_count(lengths[i]) - full);
+        byte_t expected[32];
+        detail::store_digest(h, expected);
+
+        byte_t single[32];
+        hash256(message.data(), lengths[i], single);
+        if (std::memcmp(expected, single, 32) != 0 ||
+            std::memcmp(expected, many + 32 * i, 32) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Picks the fastest supported backend that passes the self test. SHA-NI
+// one message at a time keeps pace with eight AVX2 lanes, so AVX2 is only
+// used for hash256_many() on CPUs without SHA extensions.
+inline kind install_best() {
+    const kind preference[] = {sha_ni, avx2};
+    for (kind k : preference) {
+        if (select(k) && self_test()) {
+            return k;
+        }
+    }
+    select(scalar);
+    return scalar;
+}
+
+namespace detail {
+inline const kind installed = install_best();
+}  // namespace detail
+
+}  // namespace backend
+}  // namespace picosha2
+
+#endif  // SHA256_BACKEND_H
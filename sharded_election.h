@@ -0,0 +1,402 @@
+#ifndef SHARDED_ELECTION_H
+#define SHARDED_ELECTION_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <sys/stat.h>
+#include "blockchain.h"
+#include "bounded_queue.h"
+#include "chain_log.h"
+#include "hash256.h"
+#include "tally.h"
+#include "voter_registry.h"
+
+// An election split into independent chains, one per shard, so votes for
+// different shards are hashed and logged in parallel. Each voter belongs
+// to one shard, chosen by a registry column (county, state or precinct);
+// every value of that column is assigned to a shard up front, balancing
+// the shards by registered voters.
+//
+// A coordinator thread periodically commits the durable tip of every
+// shard into the root chain, as one batch block with a vote record per
+// shard:
+//   "<shard>,<height>,<tip hash hex>"
+// so the root's tip hash pins every shard and a Merkle proof ties any
+// shard tip to a root block. The root chain's log also holds the voted
+// flags of the registry; registry deltas are not supported here.
+//
+// On disk, under directory:
+//   layout          shard count and routing column, fixed on first use
+//   root/           root chain log, indexes and lasthash.txt
+//   shard-000/ ...  one such directory per shard
+class ShardedElection {
+public:
+    // Registry column a voter's shard is chosen by
+    enum RouteBy { ByCounty, ByState, ByPrecinct };
+
+    // Most shards an election may have: each runs its own thread, and shard
+    // numbers are kept as uint16_t per registry row
+    static constexpr std::size_t kMaxShards = 1024;
+
+    // Parses "county", "state" or "precinct"
+    static bool parseRouteBy(const std::string& name, RouteBy& routeBy) {
+        if (name == "county") {
+            routeBy = ByCounty;
+        } else if (name == "state") {
+            routeBy = ByState;
+        } else if (name == "precinct") {
+            routeBy = ByPrecinct;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    ShardedElection(VoterRegistry& registry, const CandidateList& candidates,
+                    std::size_t shardCount, RouteBy routeBy, std::size_t votesPerBlock,
+                    const std::string& directory, unsigned commitIntervalMillis = 1000)
+        : registry(registry), candidates(candidates), routeBy(routeBy),
+          votesPerBlock(std::max<std::size_t>(1, votesPerBlock)), directory(directory),
+          commitInterval(commitIntervalMillis), root(CandidateList(std::vector<std::string>())),
+          stopping(false), failed(false) {
+        shardCount = std::min(std::max<std::size_t>(1, shardCount), kMaxShards);
+        for (std::size_t i = 0; i < shardCount; ++i) {
+            shards.emplace_back(new Shard(candidates));
+        }
+    }
+
+    ShardedElection(const ShardedElection&) = delete;
+    ShardedElection& operator=(const ShardedElection&) = delete;
+
+    ~ShardedElection() { finish(); }
+
+    // Assigns voters to shards, replays every chain log, restores the voted
+    // flags and starts the shard workers and the coordinator. The registry
+    // must be loaded and not yet attached to a log.
+    bool open() {
+        mkdir(directory.c_str(), 0755);
+        if (!checkLayout()) {
+            return false;
+        }
+        assignShards();
+        std::string rootDir = directory + "/root";
+        root.setTipFile(rootDir + "/lasthash.txt");
+        bool replayed = root.openIndex(rootDir) &&
+            rootLog.open(rootDir, ChainLog::Options(),
+                [this](uint8_t type, const uint8_t* payload, std::size_t size) {
+                    if (type == BlockRecord) {
+                        return root.restoreBlock(payload, size, rootLog.replayPosition());
+                    }
+                    // Sharded imports apply no registry deltas, so a delta
+                    // record means the log is not this election's
+                    return type == VotedRecord && registry.restoreVoted(payload, size);
+                });
+        if (!replayed) {
+            std::cerr << "Error: Could not open or replay the chain log in " << rootDir
+                      << std::endl;
+            return false;
+        }
+        for (std::size_t i = 0; i < shards.size(); ++i) {
+            Shard& shard = *shards[i];
+            std::string shardDir = shardDirectory(i);
+            shard.chain.setTipFile(shardDir + "/lasthash.txt");
+            replayed = shard.chain.openIndex(shardDir) &&
+                shard.log.open(shardDir, ChainLog::Options(),
+                    [&shard](uint8_t type, const uint8_t* payload, std::size_t size) {
+                        return type == BlockRecord &&
+                               shard.chain.restoreBlock(payload, size, shard.log.replayPosition());
+                    });
+            if (!replayed) {
+                std::cerr << "Error: Could not open or replay the chain log in " << shardDir
+                          << std::endl;
+                return false;
+            }
+            shard.chain.attachLog(shard.log);
+            shard.chain.addGenesisBlock();
+        }
+        root.attachLog(rootLog);
+        registry.attachLog(rootLog);
+        root.addGenesisBlock();
+        lastCommitted.assign(shards.size(), 0);
+        for (std::size_t i = 0; i < shards.size(); ++i) {
+            Shard* shard = shards[i].get();
+            shard->worker = std::thread([this, shard] { runShard(*shard); });
+        }
+        coordinator = std::thread([this] { runCoordinator(); });
+        return true;
+    }
+
+    std::size_t shardCount() const { return shards.size(); }
+
+    // Shard of the voter at a registry row
+    std::size_t shardOf(uint32_t row) const { return shardOfRow[row]; }
+
+    // Queues accepted votes for a shard's chain; waits while the shard is
+    // behind. The voters must already be claimed, with their VotedRecords
+    // durable, so a crash can never let them vote twice.
+    void submit(std::size_t shard, std::vector<std::string> votes) {
+        shards[shard]->queue.push(std::move(votes));
+    }
+
+    // Forces the registry's VotedRecords to disk; call before submitting
+    // the votes of the voters claimed so far
+    bool syncVoters() {
+        return rootLog.sync();
+    }
+
+    // Drains every shard, makes all chains durable and commits the final
+    // shard tips to the root chain. Returns false if a log failed.
+    bool finish() {
+        if (!coordinator.joinable()) {
+            return !failed;
+        }
+        for (std::unique_ptr<Shard>& shard : shards) {
+            shard->queue.close();
+        }
+        for (std::unique_ptr<Shard>& shard : shards) {
+            shard->worker.join();
+            if (!shard->chain.sync()) {
+                failed = true;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(coordinatorLock);
+            stopping = true;
+        }
+        wake.notify_all();
+        coordinator.join();
+        commitShardTips();
+        if (!root.sync()) {
+            failed = true;
+        }
+        return !failed;
+    }
+
+    // Running counts summed over the shards
+    TallySnapshot currentTally() const {
+        TallySnapshot total{0, std::vector<uint64_t>(candidates.bucketCount(), 0)};
+        for (const std::unique_ptr<Shard>& shard : shards) {
+            TallySnapshot counts = shard->chain.currentTally();
+            total.height += counts.height;
+            for (std::size_t i = 0; i < counts.counts.size(); ++i) {
+                total.counts[i] += counts.counts[i];
+            }
+        }
+        return total;
+    }
+
+    // Votes per shard, for reporting how evenly the load was spread
+    std::vector<uint64_t> votesPerShard() const {
+        std::vector<uint64_t> votes;
+        for (const std::unique_ptr<Shard>& shard : shards) {
+            TallySnapshot counts = shard->chain.currentTally();
+            uint64_t sum = 0;
+            for (uint64_t count : counts.counts) {
+                sum += count;
+            }
+            votes.push_back(sum);
+        }
+        return votes;
+    }
+
+    const Blockchain& rootChain() const { return root; }
+    const Blockchain& shardChain(std::size_t shard) const { return shards[shard]->chain; }
+
+    // Checks every chain end to end and that the newest root block commits
+    // to the final tip of every shard, once each, so the root tip pins
+    // every shard chain. Call once finish() has returned.
+    bool verify(unsigned threads = 0) const {
+        if (coordinator.joinable()) {
+            std::cerr << "The sharded election is still running" << std::endl;
+            return false;
+        }
+        std::size_t badHeight;
+        if (!root.verifyFull(threads, badHeight)) {
+            std::cerr << "Root chain is compromised at block " << badHeight << std::endl;
+            return false;
+        }
+        for (std::size_t i = 0; i < shards.size(); ++i) {
+            if (!shards[i]->chain.verifyFull(threads, badHeight)) {
+                std::cerr << "Shard " << i << " is compromised at block " << badHeight << std::endl;
+                return false;
+            }
+        }
+        const Block& tip = root.at(root.size() - 1);
+        std::vector<bool> committed(shards.size(), false);
+        bool consistent = tip.isBatch() && tip.voteCount == shards.size();
+        tip.forEachVote([&](std::string_view record) {
+            unsigned long long shard, height;
+            char hex[65];
+            std::string line(record);
+            if (std::sscanf(line.c_str(), "%llu,%llu,%64s", &shard, &height, hex) != 3 ||
+                shard >= shards.size() || committed[shard] ||
+                height != shards[shard]->chain.size() - 1 ||
+                toHex(shards[shard]->chain.at(height).hash) != hex) {
+                consistent = false;
+                return;
+            }
+            committed[shard] = true;
+        });
+        if (!consistent) {
+            std::cerr << "Root chain does not commit to the final tip of every shard" << std::endl;
+        }
+        return consistent;
+    }
+
+private:
+    struct Shard {
+        explicit Shard(const CandidateList& candidates) : chain(candidates), queue(8) {}
+
+        Blockchain chain;
+        ChainLog log;  // Closed before chain goes away, being declared after it
+        BoundedQueue<std::vector<std::string>> queue;
+        std::thread worker;
+    };
+
+    std::string shardDirectory(std::size_t shard) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/shard-%03zu", shard);
+        return directory + name;
+    }
+
+    // Records the shard count and routing in directory/layout on first use
+    // and refuses to reopen the election with different ones, which would
+    // move voters between chains
+    bool checkLayout() const {
+        char layout[64];
+        std::snprintf(layout, sizeof(layout), "shards=%zu route=%d", shards.size(),
+                      routeColumn());
+        std::string path = directory + "/layout";
+        std::ifstream existing(path);
+        std::string line;
+        if (std::getline(existing, line)) {
+            if (line != layout) {
+                std::cerr << "Error: " << directory << " holds an election with " << line
+                          << ", not " << layout << std::endl;
+                return false;
+            }
+            return true;
+        }
+        std::ofstream created(path);
+        created << layout << '\n';
+        return static_cast<bool>(created);
+    }
+
+    int routeColumn() const {
+        switch (routeBy) {
+        case ByState:    return 7;
+        case ByPrecinct: return 8;  // ZipCode
+        default:         return 6;  // County
+        }
+    }
+
+    // Gives every value of the routing column a shard, largest groups first,
+    // each to the shard with the fewest voters so far
+    void assignShards() {
+        std::size_t rows = registry.voterCount();
+        std::vector<uint32_t> groupOfRow(rows);
+        std::unordered_map<std::string_view, uint32_t> groups;
+        std::vector<uint64_t> groupSize;
+        int column = routeColumn();
+        for (uint32_t row = 0; row < rows; ++row) {
+            auto inserted = groups.emplace(registry.field(row, column),
+                                           static_cast<uint32_t>(groupSize.size()));
+            if (inserted.second) {
+                groupSize.push_back(0);
+            }
+            groupOfRow[row] = inserted.first->second;
+            groupSize[inserted.first->second]++;
+        }
+        std::vector<uint32_t> order(groupSize.size());
+        for (uint32_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(),
+                  [&groupSize](uint32_t a, uint32_t b) { return groupSize[a] > groupSize[b]; });
+        std::vector<uint64_t> load(shards.size(), 0);
+        std::vector<uint16_t> shardOfGroup(groupSize.size());
+        for (uint32_t group : order) {
+            std::size_t lightest = std::min_element(load.begin(), load.end()) - load.begin();
+            shardOfGroup[group] = static_cast<uint16_t>(lightest);
+            load[lightest] += groupSize[group];
+        }
+        shardOfRow.resize(rows);
+        for (uint32_t row = 0; row < rows; ++row) {
+            shardOfRow[row] = shardOfGroup[groupOfRow[row]];
+        }
+        if (groups.size() < shards.size()) {
+            std::cerr << "Only " << groups.size() << " distinct routing values for "
+                      << shards.size() << " shards; some shards stay idle" << std::endl;
+        }
+    }
+
+    void runShard(Shard& shard) {
+        std::vector<std::string> votes;
+        while (shard.queue.pop(votes)) {
+            shard.chain.addBlocks(votes, votesPerBlock);
+        }
+    }
+
+    void runCoordinator() {
+        std::unique_lock<std::mutex> lock(coordinatorLock);
+        while (!wake.wait_for(lock, std::chrono::milliseconds(commitInterval),
+                              [this] { return stopping; })) {
+            lock.unlock();
+            commitShardTips();
+            lock.lock();
+        }
+    }
+
+    // Appends a root block with every shard's durable tip, if any moved
+    void commitShardTips() {
+        std::vector<std::string> records;
+        bool moved = false;
+        for (std::size_t i = 0; i < shards.size(); ++i) {
+            uint64_t height;
+            Hash256 hash;
+            if (!shards[i]->chain.durableTip(height, hash)) {
+                return;  // a shard has nothing on disk yet
+            }
+            moved = moved || height != lastCommitted[i];
+            lastCommitted[i] = height;
+            records.push_back(std::to_string(i) + "," + std::to_string(height) + "," + toHex(hash));
+        }
+        if (moved || root.size() == 1) {
+            root.addBatchBlock(records);
+        }
+    }
+
+    VoterRegistry& registry;
+    CandidateList candidates;
+    RouteBy routeBy;
+    std::size_t votesPerBlock;
+    std::string directory;
+    unsigned commitInterval;
+    std::vector<uint16_t> shardOfRow;
+
+    Blockchain root;
+    ChainLog rootLog;
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::vector<uint64_t> lastCommitted; // Shard heights in the newest root block
+
+    std::mutex coordinatorLock;
+    std::condition_variable wake;
+    bool stopping;
+    bool failed;
+    std::thread coordinator;
+};
+
+#endif  // SHARDED_ELECTION_H
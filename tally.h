@@ -0,0 +1,181 @@
+#ifndef TALLY_H
+#define TALLY_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The candidates on the ballot. A vote is the candidate's 1-based number;
+// any other vote counts as NOTA, which gets the bucket after the last
+// candidate.
+class CandidateList {
+public:
+    // The ballot used before candidate files existed
+    CandidateList() : names{"RAHUL SINGH", "KOMAL GUPTA", "ABHISHEK TOMAR"} {}
+
+    explicit CandidateList(std::vector<std::string> names) : names(std::move(names)) {}
+
+    // Reads one candidate name per line, skipping blank lines; leaves the
+    // list unchanged and returns false if the file is missing or empty
+    bool load(const std::string& path) {
+        std::ifstream file(path);
+        std::vector<std::string> loaded;
+        std::string line;
+        while (std::getline(file, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (!line.empty()) {
+                loaded.push_back(line);
+            }
+        }
+        if (loaded.empty()) {
+            return false;
+        }
+        names.swap(loaded);
+        return true;
+    }
+
+    std::size_t size() const { return names.size(); }
+    const std::string& name(std::size_t candidate) const { return names[candidate]; }
+
+    // Bucket for NOTA votes; there are size() + 1 buckets in all
+    std::size_t notaBucket() const { return names.size(); }
+    std::size_t bucketCount() const { return names.size() + 1; }
+
+    // Bucket a vote is counted in
+    std::size_t bucketOf(std::string_view vote) const {
+        if (vote.empty() || vote.size() > 9) {
+            return notaBucket();
+        }
+        std::size_t number = 0;
+        for (char c : vote) {
+            if (c < '0' || c > '9') {
+                return notaBucket();
+            }
+            number = number * 10 + static_cast<std::size_t>(c - '0');
+        }
+        return number >= 1 && number <= names.size() ? number - 1 : notaBucket();
+    }
+
+private:
+    std::vector<std::string> names;
+};
+
+// Vote counts per bucket as of the block at height
+struct TallySnapshot {
+    uint64_t height = 0;
+    std::vector<uint64_t> counts;
+};
+
+// Running per-bucket vote counts, updated block by block as the chain
+// grows. A single writer applies blocks; any number of readers can take a
+// consistent snapshot at the latest applied height at any time without
+// blocking the writer (a sequence lock around each block's updates). Every
+// checkpointInterval heights a copy of the counts is kept so a snapshot at
+// an earlier height only needs the blocks after the nearest checkpoint.
+class TallyEngine {
+public:
+    explicit TallyEngine(std::size_t bucketCount, uint64_t checkpointInterval = 4096)
+        : buckets(bucketCount), interval(std::max<uint64_t>(1, checkpointInterval)),
+          counts(new std::atomic<uint64_t>[bucketCount]), sequence(0), appliedHeight(0) {
+        for (std::size_t i = 0; i < buckets; ++i) {
+            counts[i].store(0, std::memory_order_relaxed);
+        }
+        checkpoints.push_back(TallySnapshot{0, std::vector<uint64_t>(buckets, 0)});
+    }
+
+    TallyEngine(const TallyEngine&) = delete;
+    TallyEngine& operator=(const TallyEngine&) = delete;
+
+    std::size_t bucketCount() const { return buckets; }
+
+    // Writer: opens the updates for the next block
+    void beginBlock() {
+        sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    // Writer: counts one vote of the open block
+    void count(std::size_t bucket) {
+        counts[bucket].store(counts[bucket].load(std::memory_order_relaxed) + 1,
+                             std::memory_order_relaxed);
+    }
+
+    // Writer: closes the block at height and publishes its counts
+    void endBlock(uint64_t height) {
+        appliedHeight.store(height, std::memory_order_relaxed);
+        sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        if (height % interval == 0) {
+            TallySnapshot checkpoint{height, std::vector<uint64_t>(buckets)};
+            for (std::size_t i = 0; i < buckets; ++i) {
+                checkpoint.counts[i] = counts[i].load(std::memory_order_relaxed);
+            }
+            std::lock_guard<std::mutex> lock(checkpointLock);
+            checkpoints.push_back(std::move(checkpoint));
+        }
+    }
+
+    // Counts as of the latest applied block; never blocks the writer
+    TallySnapshot current() const {
+        TallySnapshot snapshot;
+        snapshot.counts.resize(buckets);
+        while (true) {
+            uint64_t before = sequence.load(std::memory_order_acquire);
+            if (before & 1) {
+                continue;  // a block is being applied
+            }
+            snapshot.height = appliedHeight.load(std::memory_order_relaxed);
+            for (std::size_t i = 0; i < buckets; ++i) {
+                snapshot.counts[i] = counts[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence.load(std::memory_order_relaxed) == before) {
+                return snapshot;
+            }
+        }
+    }
+
+    // Writer: starts over from saved counts, which become the only kept
+    // checkpoint; earlier heights can no longer be snapshotted
+    void restore(const TallySnapshot& saved) {
+        beginBlock();
+        for (std::size_t i = 0; i < buckets; ++i) {
+            counts[i].store(i < saved.counts.size() ? saved.counts[i] : 0,
+                            std::memory_order_relaxed);
+        }
+        appliedHeight.store(saved.height, std::memory_order_relaxed);
+        sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        std::lock_guard<std::mutex> lock(checkpointLock);
+        checkpoints.assign(1, TallySnapshot{saved.height, std::vector<uint64_t>(buckets)});
+        for (std::size_t i = 0; i < buckets; ++i) {
+            checkpoints[0].counts[i] = counts[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    // Latest kept checkpoint at or below height
+    TallySnapshot checkpointAtOrBefore(uint64_t height) const {
+        std::lock_guard<std::mutex> lock(checkpointLock);
+        auto after = std::upper_bound(checkpoints.begin(), checkpoints.end(), height,
+            [](uint64_t h, const TallySnapshot& checkpoint) { return h < checkpoint.height; });
+        return after == checkpoints.begin() ? checkpoints.front() : *(after - 1);
+    }
+
+private:
+    std::size_t buckets;
+    uint64_t interval;
+    std::unique_ptr<std::atomic<uint64_t>[]> counts;
+    std::atomic<uint64_t> sequence;      // Odd while a block is being applied
+    std::atomic<uint64_t> appliedHeight; // Height the counts are as of
+    mutable std::mutex checkpointLock;
+    std::vector<TallySnapshot> checkpoints; // Ascending by height, starting at 0
+};
+
+#endif  // TALLY_H
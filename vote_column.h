@@ -0,0 +1,166 @@
+#ifndef VOTE_COLUMN_H
+#define VOTE_COLUMN_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "hash256.h"
+#include "sha256_backend.h"
+
+// Packed, columnar copy of the chain's ballots for audits. Each ballot is
+// stored as its tally bucket, one byte wide while there are at most 256
+// buckets and two bytes wide otherwise, in chain order. The hash of every
+// block is kept alongside so a recount can be tied to the chain tip it was
+// taken from. Block i of the column is the block at height firstHeight + i.
+struct VoteColumn {
+    std::size_t bucketCount = 0;
+    uint64_t firstHeight = 0;
+    std::vector<uint8_t> narrow;       // Bucket per ballot when !isWide()
+    std::vector<uint16_t> wide;        // Bucket per ballot when isWide()
+    std::vector<uint64_t> ballotStart; // First ballot of each block, plus the total at the end
+    std::vector<Hash256> blockHashes;  // Hash of each block
+
+    static constexpr std::size_t kMaxBuckets = 65536;
+
+    bool isWide() const { return bucketCount > 256; }
+
+    std::size_t ballots() const { return ballotStart.empty() ? 0 : ballotStart.back(); }
+
+    // Sizes the column for the given ballot count
+    void resize(std::size_t buckets, std::size_t ballotCount) {
+        bucketCount = buckets;
+        narrow.assign(isWide() ? 0 : ballotCount, 0);
+        wide.assign(isWide() ? ballotCount : 0, 0);
+    }
+
+    void set(std::size_t ballot, std::size_t bucket) {
+        if (isWide()) {
+            wide[ballot] = static_cast<uint16_t>(bucket);
+        } else {
+            narrow[ballot] = static_cast<uint8_t>(bucket);
+        }
+    }
+};
+
+namespace vote_column_detail {
+
+// Scalar histogram; four interleaved sub-histograms hide the store-to-load
+// latency when neighbouring ballots hit the same bucket
+template <typename Bucket>
+inline void histogramScalar(const Bucket* ballots, std::size_t count, std::size_t buckets,
+                            uint64_t* counts) {
+    std::vector<uint64_t> partial(4 * buckets, 0);
+    std::size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        partial[ballots[i]]++;
+        partial[buckets + ballots[i + 1]]++;
+        partial[2 * buckets + ballots[i + 2]]++;
+        partial[3 * buckets + ballots[i + 3]]++;
+    }
+    for (; i < count; ++i) {
+        partial[ballots[i]]++;
+    }
+    for (std::size_t b = 0; b < buckets; ++b) {
+        counts[b] += partial[b] + partial[buckets + b] + partial[2 * buckets + b] +
+                     partial[3 * buckets + b];
+    }
+}
+
+#ifdef PICOSHA2_BACKEND_X86
+// AVX2 histogram for byte-wide columns with few buckets: each bucket is
+// counted with 32 compares per instruction into byte counters, which are
+// widened with SAD before they can overflow
+__attribute__((target("avx2"))) inline void histogramAvx2(const uint8_t* ballots,
+                                                          std::size_t count,
+                                                          std::size_t buckets,
+                                                          uint64_t* counts) {
+    const std::size_t chunkBytes = 255 * 32;
+    const __m256i zero = _mm256_setzero_si256();
+    std::size_t vectorBytes = count & ~std::size_t(31);
+    for (std::size_t start = 0; start < vectorBytes; start += chunkBytes) {
+        std::size_t end = std::min(vectorBytes, start + chunkBytes);
+        for (std::size_t b = 0; b < buckets; ++b) {
+            const __m256i needle = _mm256_set1_epi8(static_cast<char>(b));
+            __m256i hits = zero;
+            for (std::size_t i = start; i < end; i += 32) {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ballots + i));
+                hits = _mm256_sub_epi8(hits, _mm256_cmpeq_epi8(v, needle));
+            }
+            __m256i sums = _mm256_sad_epu8(hits, zero);
+            counts[b] += static_cast<uint64_t>(_mm256_extract_epi64(sums, 0)) +
+                         static_cast<uint64_t>(_mm256_extract_epi64(sums, 1)) +
+                         static_cast<uint64_t>(_mm256_extract_epi64(sums, 2)) +
+                         static_cast<uint64_t>(_mm256_extract_epi64(sums, 3));
+        }
+    }
+    histogramScalar(ballots + vectorBytes, count - vectorBytes, buckets, counts);
+}
+#endif
+
+// Compare-per-bucket only pays off while the buckets are few
+inline bool useSimdHistogram(std::size_t buckets) {
+    static const bool avx2 = picosha2::backend::supported(picosha2::backend::avx2);
+    return avx2 && buckets <= 32;
+}
+
+template <typename Bucket>
+inline void histogramSlice(const Bucket* ballots, std::size_t count, std::size_t buckets,
+                           uint64_t* counts) {
+#ifdef PICOSHA2_BACKEND_X86
+    if (sizeof(Bucket) == 1 && useSimdHistogram(buckets)) {
+        histogramAvx2(reinterpret_cast<const uint8_t*>(ballots), count, buckets, counts);
+        return;
+    }
+#endif
+    histogramScalar(ballots, count, buckets, counts);
+}
+
+template <typename Bucket>
+inline std::vector<uint64_t> histogramParallel(const std::vector<Bucket>& ballots,
+                                               std::size_t buckets, unsigned threads) {
+    // Small columns are not worth the thread start-up cost
+    const std::size_t minSliceBallots = 1 << 20;
+    std::size_t slices = std::max<std::size_t>(
+        1, std::min<std::size_t>(threads, ballots.size() / minSliceBallots));
+    std::size_t sliceSize = (ballots.size() + slices - 1) / slices;
+    std::vector<std::vector<uint64_t>> partial(slices, std::vector<uint64_t>(buckets, 0));
+
+    std::vector<std::thread> workers;
+    for (std::size_t s = 1; s < slices; ++s) {
+        workers.emplace_back([&, s] {
+            std::size_t begin = std::min(ballots.size(), s * sliceSize);
+            std::size_t end = std::min(ballots.size(), begin + sliceSize);
+            histogramSlice(ballots.data() + begin, end - begin, buckets, partial[s].data());
+        });
+    }
+    histogramSlice(ballots.data(), std::min(ballots.size(), sliceSize), buckets,
+                   partial[0].data());
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    for (std::size_t s = 1; s < slices; ++s) {
+        for (std::size_t b = 0; b < buckets; ++b) {
+            partial[0][b] += partial[s][b];
+        }
+    }
+    return partial[0];
+}
+
+}  // namespace vote_column_detail
+
+// Counts the ballots in each bucket using up to threads threads (0 picks
+// the core count)
+inline std::vector<uint64_t> histogramColumn(const VoteColumn& column, unsigned threads = 0) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if (column.isWide()) {
+        return vote_column_detail::histogramParallel(column.wide, column.bucketCount, threads);
+    }
+    return vote_column_detail::histogramParallel(column.narrow, column.bucketCount, threads);
+}
+
+#endif  // VOTE_COLUMN_H
@@ -0,0 +1,127 @@
+#ifndef VOTE_INGESTOR_H
+#define VOTE_INGESTOR_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "blockchain.h"
+#include "recovery.h"
+#include "voter_registry.h"
+
+// Accepts votes from many threads at once. Each submission is checked and
+// marked in the registry atomically; accepted votes are queued and a single
+// sequencer thread appends them to the blockchain in order, in batches.
+// While the ingestor is running the sequencer owns the blockchain: only
+// currentTally() and tallyAt() may be called meanwhile; read anything else
+// after flush() or once the ingestor is destroyed.
+class VoteIngestor {
+private:
+    VoterRegistry& registry;
+    Blockchain& blockchain;
+    std::mutex queueLock;
+    std::condition_variable queueReady;   // Signals the sequencer that votes are pending
+    std::condition_variable queueDrained; // Signals flush() that the queue is empty
+    std::vector<std::string> pending;          // Accepted votes not yet appended
+    std::size_t votesPerBlock;            // Batch block size; 1 for a block per vote
+    std::string checkpointPath;           // Where periodic checkpoints go, if anywhere
+    uint64_t checkpointEveryBlocks;  // Blocks between checkpoints; 0 for none
+    uint64_t lastCheckpointHeight;
+    bool appending;                  // Sequencer holds a batch it is appending
+    bool stopping;
+    std::thread sequencer;
+
+    // Writes a checkpoint once enough blocks were appended since the last one
+    void maybeCheckpoint() {
+        if (checkpointEveryBlocks == 0 ||
+            blockchain.size() < lastCheckpointHeight + checkpointEveryBlocks + 1) {
+            return;
+        }
+        lastCheckpointHeight = blockchain.size() - 1;
+        if (!saveCheckpoint(checkpointPath, blockchain, registry)) {
+            std::cerr << "Unable to write checkpoint " << checkpointPath << std::endl;
+        }
+    }
+
+    // Sequencer loop: takes everything queued so far and appends it as a batch
+    void run() {
+        std::vector<std::string> batch;
+        std::unique_lock<std::mutex> lock(queueLock);
+        while (true) {
+            queueReady.wait(lock, [this] { return stopping || !pending.empty(); });
+            if (pending.empty()) {
+                return;
+            }
+            batch.swap(pending);
+            appending = true;
+            lock.unlock();
+            blockchain.addBlocks(batch, votesPerBlock);
+            batch.clear();
+            maybeCheckpoint();
+            lock.lock();
+            appending = false;
+            if (pending.empty()) {
+                queueDrained.notify_all();
+            }
+        }
+    }
+
+public:
+    // With a checkpoint path, a checkpoint is written there from the
+    // sequencer every checkpointEveryBlocks blocks; both the blockchain and
+    // the registry must then be attached to the chain log
+    VoteIngestor(VoterRegistry& registry, Blockchain& blockchain, std::size_t votesPerBlock = 1,
+                 const std::string& checkpointPath = std::string(), uint64_t checkpointEveryBlocks = 0)
+        : registry(registry), blockchain(blockchain), votesPerBlock(votesPerBlock),
+          checkpointPath(checkpointPath),
+          checkpointEveryBlocks(checkpointPath.empty() ? 0 : checkpointEveryBlocks),
+          lastCheckpointHeight(blockchain.size() == 0 ? 0 : blockchain.size() - 1),
+          appending(false), stopping(false) {
+        sequencer = std::thread([this] { run(); });
+    }
+
+    // Appends every queued vote and stops the sequencer
+    ~VoteIngestor() {
+        {
+            std::lock_guard<std::mutex> lock(queueLock);
+            stopping = true;
+        }
+        queueReady.notify_one();
+        sequencer.join();
+    }
+
+    // Checks and marks the voter, and queues the vote if they were accepted.
+    // Callable from any thread. Choices containing '\n' are rejected when
+    // batching since the newline separates votes inside a batch block.
+    VoterRegistry::VoteStatus submit(std::string_view voterID, std::string choice) {
+        if (votesPerBlock > 1 && choice.find('\n') != std::string::npos) {
+            return VoterRegistry::InvalidChoice;
+        }
+        VoterRegistry::VoteStatus status = registry.claimVote(voterID);
+        if (status == VoterRegistry::Accepted) {
+            bool wasEmpty;
+            {
+                std::lock_guard<std::mutex> lock(queueLock);
+                wasEmpty = pending.empty();
+                pending.push_back(std::move(choice));
+            }
+            if (wasEmpty) {
+                queueReady.notify_one();
+            }
+        }
+        return status;
+    }
+
+    // Blocks until every vote submitted so far is on the blockchain
+    void flush() {
+        std::unique_lock<std::mutex> lock(queueLock);
+        queueDrained.wait(lock, [this] { return pending.empty() && !appending; });
+    }
+};
+
+#endif  // VOTE_INGESTOR_H
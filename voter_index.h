@@ -0,0 +1,219 @@
+#ifndef VOTER_INDEX_H
+#define VOTER_INDEX_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Parses a decimal voter ID; rejects empty, non-numeric and overlong
+// input, and leading zeros, so that "0123" and "123" are not taken for the
+// same voter
+inline bool parseVoterID(std::string_view text, uint64_t& id) {
+    if (text.empty() || text.size() > 19 || (text[0] == '0' && text.size() > 1)) {
+        return false;
+    }
+    uint64_t value = 0;
+    for (char c : text) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        value = value * 10 + static_cast<uint64_t>(c - '0');
+    }
+    id = value;
+    return true;
+}
+
+// Bitset whose bits can be set concurrently from many threads. It can also
+// grow while in use: the bits live in fixed-size chunks that never move,
+// found through a directory sized for the largest registry.
+class AtomicBitset {
+public:
+    AtomicBitset() : chunks(new std::atomic<std::atomic<uint64_t>*>[kMaxChunks]), bitCount(0) {
+        for (std::size_t i = 0; i < kMaxChunks; ++i) {
+            chunks[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    explicit AtomicBitset(std::size_t bits) : AtomicBitset() { resize(bits); }
+
+    AtomicBitset(const AtomicBitset&) = delete;
+    AtomicBitset& operator=(const AtomicBitset&) = delete;
+
+    ~AtomicBitset() { release(); }
+
+    // Resizes to hold the given number of bits and clears them all
+    void resize(std::size_t bits) {
+        release();
+        grow(bits);
+    }
+
+    // Makes room for the given number of bits, keeping the bits already set;
+    // safe while other threads test and set bits below the old size
+    void grow(std::size_t bits) {
+        for (std::size_t chunk = 0; chunk * kChunkBits < bits; ++chunk) {
+            if (chunks[chunk].load(std::memory_order_relaxed) == nullptr) {
+                std::atomic<uint64_t>* words = new std::atomic<uint64_t>[kChunkWords];
+                for (std::size_t i = 0; i < kChunkWords; ++i) {
+                    words[i].store(0, std::memory_order_relaxed);
+                }
+                chunks[chunk].store(words, std::memory_order_release);
+            }
+        }
+        if (bits > bitCount.load(std::memory_order_relaxed)) {
+            bitCount.store(bits, std::memory_order_release);
+        }
+    }
+
+    bool test(std::size_t bit) const {
+        return (word(bit).load(std::memory_order_acquire) >> (bit & 63)) & 1;
+    }
+
+    // Sets the bit and reports whether this call was the one that set it
+    bool testAndSet(std::size_t bit) {
+        uint64_t mask = uint64_t(1) << (bit & 63);
+        return (word(bit).fetch_or(mask, std::memory_order_acq_rel) & mask) == 0;
+    }
+
+    std::size_t size() const { return bitCount.load(std::memory_order_acquire); }
+
+    std::size_t bytes() const {
+        return (size() + kChunkBits - 1) / kChunkBits * kChunkWords * sizeof(uint64_t);
+    }
+
+    // Copies the first bits bits out, 64 per word; bits set concurrently
+    // may or may not be included
+    void copyWords(std::vector<uint64_t>& out, std::size_t bits) const {
+        out.resize((bits + 63) / 64);
+        for (std::size_t i = 0; i < out.size(); ++i) {
+            out[i] = word(i * 64).load(std::memory_order_acquire);
+        }
+        if (bits % 64 != 0) {
+            out.back() &= (uint64_t(1) << (bits % 64)) - 1;
+        }
+    }
+
+    // Sets every bit that is set in source, which holds one word per 64 bits
+    void mergeWords(const uint64_t* source) {
+        for (std::size_t i = 0; i < (size() + 63) / 64; ++i) {
+            word(i * 64).fetch_or(source[i], std::memory_order_relaxed);
+        }
+    }
+
+private:
+    static constexpr std::size_t kChunkBits = std::size_t(1) << 20;
+    static constexpr std::size_t kChunkWords = kChunkBits / 64;
+    static constexpr std::size_t kMaxChunks = std::size_t(1) << 12;  // Room for 2^32 rows
+
+    std::atomic<uint64_t>& word(std::size_t bit) const {
+        return chunks[bit / kChunkBits].load(std::memory_order_acquire)[(bit % kChunkBits) >> 6];
+    }
+
+    void release() {
+        for (std::size_t i = 0; i < kMaxChunks; ++i) {
+            delete[] chunks[i].exchange(nullptr, std::memory_order_relaxed);
+        }
+        bitCount.store(0, std::memory_order_relaxed);
+    }
+
+    std::unique_ptr<std::atomic<std::atomic<uint64_t>*>[]> chunks;
+    std::atomic<std::size_t> bitCount;  // Only changed by the thread that grows the set
+};
+
+// Open-addressing (linear probing) map from numeric voter ID to the row
+// that registered it. Probing only walks the flat key array; the parallel
+// row array is read once, at the slot the probe ends on.
+class VoterIndex {
+public:
+    static constexpr uint32_t npos = UINT32_MAX;
+
+    VoterIndex() : mask(0), count(0) {}
+
+    // Rebuilds the index; ids[row] is the voter ID registered on that row.
+    // A repeated ID keeps its last row, as the CSV loader always has.
+    void build(const std::vector<uint64_t>& ids) {
+        std::size_t capacity = 16;
+        while (capacity * 3 < ids.size() * 4) {  // keep the load factor under 0.75
+            capacity <<= 1;
+        }
+        keys.assign(capacity, kEmpty);
+        rows.assign(capacity, npos);
+        mask = capacity - 1;
+        count = 0;
+        for (std::size_t row = 0; row < ids.size(); ++row) {
+            std::size_t slot = probe(ids[row]);
+            if (keys[slot] == kEmpty) {
+                keys[slot] = ids[row];
+                ++count;
+            }
+            rows[slot] = static_cast<uint32_t>(row);
+        }
+    }
+
+    // Maps the ID to row, replacing any row it had; grows the table when it
+    // passes the load factor
+    void insert(uint64_t id, uint32_t row) {
+        if (keys.empty() || (count + 1) * 4 > keys.size() * 3) {
+            rehash(std::max<std::size_t>(16, keys.size() * 2));
+        }
+        std::size_t slot = probe(id);
+        if (keys[slot] == kEmpty) {
+            keys[slot] = id;
+            ++count;
+        }
+        rows[slot] = row;
+    }
+
+    // Row registered for the ID, or npos
+    uint32_t find(uint64_t id) const {
+        if (keys.empty()) {
+            return npos;
+        }
+        return rows[probe(id)];
+    }
+
+    // Number of distinct voter IDs
+    std::size_t size() const { return count; }
+
+    std::size_t bytes() const {
+        return keys.size() * sizeof(uint64_t) + rows.size() * sizeof(uint32_t);
+    }
+
+private:
+    static constexpr uint64_t kEmpty = UINT64_MAX;  // IDs have at most 19 digits
+
+    void rehash(std::size_t capacity) {
+        std::vector<uint64_t> oldKeys(capacity, kEmpty);
+        std::vector<uint32_t> oldRows(capacity, npos);
+        oldKeys.swap(keys);
+        oldRows.swap(rows);
+        mask = capacity - 1;
+        for (std::size_t i = 0; i < oldKeys.size(); ++i) {
+            if (oldKeys[i] != kEmpty) {
+                std::size_t slot = probe(oldKeys[i]);
+                keys[slot] = oldKeys[i];
+                rows[slot] = oldRows[i];
+            }
+        }
+    }
+
+    // Slot holding the ID, or the empty slot where it would be inserted
+    std::size_t probe(uint64_t id) const {
+        uint64_t hash = id * 0x9e3779b97f4a7c15ULL;
+        std::size_t slot = static_cast<std::size_t>(hash >> 32) & mask;
+        while (keys[slot] != id && keys[slot] != kEmpty) {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> rows;
+    std::size_t mask;
+    std::size_t count;
+};
+
+#endif  // VOTER_INDEX_H
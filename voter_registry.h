@@ -0,0 +1,583 @@
+#ifndef VOTER_REGISTRY_H
+#define VOTER_REGISTRY_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "chain_log.h"
+#include "mapped_file.h"
+#include "metrics.h"
+#include "voter_index.h"
+
+// Voter class to handle registration and verification. The fields are
+// views into the memory-mapped registry file owned by VoterRegistry.
+class Voter {
+public:
+    std::string_view voterID;
+    std::string_view firstName;
+    std::string_view lastName;
+
+    // Default constructor
+    Voter() {}
+
+    // Parameterized constructor for registering new voters
+    Voter(std::string_view id, std::string_view firstName, std::string_view lastName)
+        : voterID(id), firstName(firstName), lastName(lastName) {}
+
+    // Full name as "First Last"
+    std::string name() const {
+        std::string fullName;
+        fullName.reserve(firstName.size() + 1 + lastName.size());
+        fullName.append(firstName).append(1, ' ').append(lastName);
+        return fullName;
+    }
+};
+
+// Outcome counts of applying a registry delta
+struct RegistryDeltaCounts {
+    uint64_t added = 0;
+    uint64_t updated = 0;
+    uint64_t removed = 0;
+    uint64_t rejected = 0;  // Unknown action, bad voter ID, or a voter in the wrong state
+};
+
+// VoterRegistry class to manage voter registration and verification.
+//
+// The registry can change while votes are being cast: applyDelta() builds
+// the next version of the row table and ID index aside and publishes it
+// with one pointer swap, freeing the old version once every lookup that
+// might still use it has finished (epoch-based reclamation). Lookups never
+// wait for a delta. A voter keeps their row, and so their voted flag, for
+// the life of the registry, even across removal and re-registration.
+class VoterRegistry {
+private:
+    // One published version of the registry
+    struct Generation {
+        std::vector<std::string_view> sources; // The registry file, then each applied delta
+        std::vector<uint64_t> rowStart;        // Per row: source << 48 | offset, or kRemovedRow
+        VoterIndex index;                      // Numeric voter ID -> row, removed voters included
+    };
+
+    static constexpr uint64_t kRemovedRow = UINT64_MAX;
+    static constexpr int kSourceShift = 48;
+
+    // A delta applied since the registry file was loaded
+    struct AppliedDelta {
+        std::unique_ptr<std::string> bytes;
+        LogPosition logEnd;    // Just past its log record; zeroes if it was not logged here
+        uint64_t rows;         // Registry rows once it was applied
+    };
+
+    MappedFile registryFile;   // Backing storage for the rows loaded at startup
+    uint64_t fileRows = 0;     // Rows loaded from the registry file
+    std::vector<AppliedDelta> applied; // Every applied delta in order; guarded by deltaLock
+    std::atomic<Generation*> current{nullptr}; // Version new lookups use
+    std::mutex deltaLock;      // Serialises applyDelta()
+    std::atomic<uint64_t> deltaCount{0};
+    AtomicBitset hasVoted;     // Tracks, per row, if a voter has already voted
+    ChainLog* log = nullptr;   // Receives a VotedRecord for every newly marked voter
+
+    // Lookups and claims in flight, counted per epoch parity.
+    // snapshotVoted() waits for the claims it may have seen, and
+    // applyDelta() for the lookups that may still use the old generation.
+    mutable std::atomic<uint64_t> claimEpoch{0};
+    mutable std::atomic<uint64_t> claimsInFlight[2] = {};
+    std::mutex snapshotLock;
+
+    // Rows parsed by one loader thread
+    struct ParsedRows {
+        std::vector<uint64_t> ids;
+        std::vector<uint64_t> offsets;
+        std::size_t rejected = 0;
+    };
+
+    static constexpr int kMaxColumns = 16;
+
+    // Splits the row starting at row into its first fieldCount fields
+    static void splitRow(const char* row, const char* lineEnd, std::string_view* fields,
+                         int fieldCount) {
+        const char* field = row;
+        for (int i = 0; i < fieldCount && field <= lineEnd; ++i) {
+            const char* comma = static_cast<const char*>(std::memchr(field, ',', lineEnd - field));
+            const char* fieldEnd = comma != nullptr ? comma : lineEnd;
+            fields[i] = std::string_view(field, fieldEnd - field);
+            field = fieldEnd + 1;
+        }
+    }
+
+    // End of the row starting at row, excluding the newline and any '\r'
+    static const char* lineEndOf(const char* row, const char* end) {
+        const char* rowEnd = static_cast<const char*>(std::memchr(row, '\n', end - row));
+        const char* lineEnd = rowEnd != nullptr ? rowEnd : end;
+        if (lineEnd > row && lineEnd[-1] == '\r') {
+            --lineEnd;
+        }
+        return lineEnd;
+    }
+
+    // Parses the rows in [begin, end) in place; every row must end in '\n'
+    // except possibly the last one
+    void parseRows(const char* begin, const char* end, ParsedRows& parsed) const {
+        const char* row = begin;
+        while (row < end) {
+            const char* lineEnd = lineEndOf(row, end);
+            if (lineEnd > row) {
+                std::string_view id;
+                splitRow(row, lineEnd, &id, 1);
+                uint64_t numericID;
+                if (parseVoterID(id, numericID)) {
+                    parsed.ids.push_back(numericID);
+                    parsed.offsets.push_back(row - registryFile.data());
+                } else {
+                    parsed.rejected++;
+                }
+            }
+            const char* newline = static_cast<const char*>(std::memchr(lineEnd, '\n', end - lineEnd));
+            row = newline != nullptr ? newline + 1 : end;
+        }
+    }
+
+    // Counts a lookup or claim as in flight for as long as it is in scope,
+    // and pins the generation current when it started. The epoch is
+    // re-read after counting so nothing is counted against an epoch that a
+    // waiter has already moved past.
+    struct EpochGuard {
+        std::atomic<uint64_t>* counter;
+        const Generation* generation;
+
+        explicit EpochGuard(const VoterRegistry& registry) {
+            while (true) {
+                uint64_t epoch = registry.claimEpoch.load();
+                counter = &registry.claimsInFlight[epoch & 1];
+                counter->fetch_add(1);
+                if (registry.claimEpoch.load() == epoch) {
+                    break;
+                }
+                counter->fetch_sub(1);
+            }
+            generation = registry.current.load();
+        }
+
+        ~EpochGuard() { counter->fetch_sub(1); }
+    };
+
+    // Waits for every lookup and claim that started before the call; the
+    // caller holds snapshotLock. Two epochs are waited out, as one begun
+    // just before the previous wait may still be running.
+    void waitForReaders() {
+        for (int i = 0; i < 2; ++i) {
+            uint64_t epoch = claimEpoch.fetch_add(1);
+            while (claimsInFlight[epoch & 1].load() != 0) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // The text of a row, from its voter ID to the end of its line
+    static std::string_view rowText(const Generation& generation, uint32_t row) {
+        uint64_t location = generation.rowStart[row];
+        std::string_view source = generation.sources[location >> kSourceShift];
+        const char* start = source.data() + (location & ((uint64_t(1) << kSourceShift) - 1));
+        return std::string_view(start, lineEndOf(start, source.data() + source.size()) - start);
+    }
+
+    // Row registered for the voter ID, or VoterIndex::npos
+    static uint32_t findRow(const Generation& generation, std::string_view id,
+                            uint64_t& numericID) {
+        METRIC_SCOPE(RegistryLookup);
+        if (!parseVoterID(id, numericID)) {
+            return VoterIndex::npos;
+        }
+        uint32_t row = generation.index.find(numericID);
+        return row != VoterIndex::npos && generation.rowStart[row] != kRemovedRow
+            ? row : VoterIndex::npos;
+    }
+
+    // Makes next the current generation and frees the one it replaces
+    void publish(Generation* next) {
+        hasVoted.grow(next->rowStart.size());
+        Generation* previous;
+        {
+            std::lock_guard<std::mutex> lock(snapshotLock);
+            previous = current.exchange(next);
+            waitForReaders();
+        }
+        delete previous;
+    }
+
+    // Applies a delta as applyDelta() describes; logs it if logIt is set,
+    // otherwise records logEnd as the end of its log record
+    RegistryDeltaCounts applyDeltaAt(std::string_view csv, bool logIt, LogPosition logEnd) {
+        std::lock_guard<std::mutex> lock(deltaLock);
+        RegistryDeltaCounts counts;
+        const Generation& previous = *current.load();
+        if (previous.sources.size() >= (std::size_t(1) << (64 - kSourceShift)) - 1) {
+            counts.rejected = 1;
+            return counts;
+        }
+        applied.push_back(AppliedDelta{std::unique_ptr<std::string>(new std::string(csv)),
+                                       LogPosition(), 0});
+        const std::string& bytes = *applied.back().bytes;
+        std::unique_ptr<Generation> next(new Generation(previous));
+        uint64_t sourceTag = uint64_t(next->sources.size()) << kSourceShift;
+        next->sources.emplace_back(bytes);
+
+        const char* begin = bytes.data();
+        const char* end = begin + bytes.size();
+        for (const char* row = begin; row < end;) {
+            const char* lineEnd = lineEndOf(row, end);
+            const char* newline = static_cast<const char*>(std::memchr(lineEnd, '\n', end - lineEnd));
+            bool firstLine = row == begin;
+            std::string_view fields[2];
+            splitRow(row, lineEnd, fields, 2);
+            row = newline != nullptr ? newline + 1 : end;
+
+            uint64_t numericID;
+            if (fields[0].empty() && fields[1].empty()) {
+                continue;  // blank line
+            }
+            if (!parseVoterID(fields[1], numericID)) {
+                counts.rejected += !firstLine;  // a bad first row is taken as the header
+                continue;
+            }
+            const char* voterRow = fields[1].data();
+            uint32_t found = next->index.find(numericID);
+            bool registered = found != VoterIndex::npos && next->rowStart[found] != kRemovedRow;
+            uint64_t location = sourceTag | uint64_t(voterRow - begin);
+            if (fields[0] == "add" && !registered) {
+                if (found == VoterIndex::npos) {
+                    if (next->rowStart.size() >= VoterIndex::npos) {
+                        counts.rejected++;
+                        continue;
+                    }
+                    found = static_cast<uint32_t>(next->rowStart.size());
+                    next->rowStart.push_back(location);
+                    next->index.insert(numericID, found);
+                } else {
+                    next->rowStart[found] = location;  // re-registered, voted flag kept
+                }
+                counts.added++;
+            } else if (fields[0] == "update" && registered) {
+                next->rowStart[found] = location;
+                counts.updated++;
+            } else if (fields[0] == "remove" && registered) {
+                next->rowStart[found] = kRemovedRow;
+                counts.removed++;
+            } else {
+                counts.rejected++;
+            }
+        }
+        if (logIt && log != nullptr) {
+            log->append(RegistryDeltaRecord, bytes.data(), bytes.size(), &logEnd);
+        }
+        applied.back().logEnd = logEnd;
+        applied.back().rows = next->rowStart.size();
+        publish(next.release());
+        deltaCount.fetch_add(1);
+        return counts;
+    }
+
+public:
+    VoterRegistry() = default;
+    VoterRegistry(const VoterRegistry&) = delete;
+    VoterRegistry& operator=(const VoterRegistry&) = delete;
+
+    ~VoterRegistry() { delete current.load(); }
+
+    // Load voter registry from a specified CSV file. The file is memory-mapped
+    // and parsed in place, split at row boundaries across threads (0 picks
+    // the core count). Voter IDs must be numeric without leading zeros;
+    // other rows are skipped. A voter ID on several rows is reported and
+    // keeps its last row. Call once, before any lookup.
+    void loadVoterRegistry(const std::string& filePath, unsigned threads = 0) {
+        if (!registryFile.open(filePath)) {
+            std::cerr << "Error: Could not open voter registry file: " << filePath << std::endl;
+            std::exit(1);  // Exit the program if the file cannot be opened
+        }
+
+        const char* begin = registryFile.data();
+        const char* end = begin + registryFile.size();
+        const char* headerEnd =
+            begin != end ? static_cast<const char*>(std::memchr(begin, '\n', end - begin)) : nullptr;
+        begin = headerEnd != nullptr ? headerEnd + 1 : end; // Skip the header line
+
+        // Small files are not worth the thread start-up cost
+        const std::size_t minChunkBytes = 1 << 20;
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        std::size_t chunkCount =
+            std::max<std::size_t>(1, std::min<std::size_t>(threads, (end - begin) / minChunkBytes));
+
+        // Cut the rows into chunks that start right after a newline
+        std::vector<const char*> cuts = {begin};
+        for (std::size_t i = 1; i < chunkCount; ++i) {
+            const char* cut = begin + (end - begin) * i / chunkCount;
+            cut = std::max(cut, cuts.back());
+            const char* newline = static_cast<const char*>(std::memchr(cut, '\n', end - cut));
+            cuts.push_back(newline != nullptr ? newline + 1 : end);
+        }
+        cuts.push_back(end);
+
+        std::vector<ParsedRows> parsed(chunkCount);
+        if (chunkCount == 1) {
+            parseRows(cuts[0], cuts[1], parsed[0]);
+        } else {
+            std::vector<std::thread> workers;
+            for (std::size_t i = 0; i < chunkCount; ++i) {
+                workers.emplace_back([this, &cuts, &parsed, i] {
+                    parseRows(cuts[i], cuts[i + 1], parsed[i]);
+                });
+            }
+            for (std::thread& worker : workers) {
+                worker.join();
+            }
+        }
+
+        std::size_t total = 0, rejected = 0;
+        for (const ParsedRows& chunk : parsed) {
+            total += chunk.ids.size();
+            rejected += chunk.rejected;
+        }
+        std::unique_ptr<Generation> loaded(new Generation());
+        loaded->sources.emplace_back(registryFile.data(), registryFile.size());
+        std::vector<uint64_t> ids;
+        ids.reserve(total);
+        loaded->rowStart.reserve(total);
+        for (ParsedRows& chunk : parsed) {
+            ids.insert(ids.end(), chunk.ids.begin(), chunk.ids.end());
+            loaded->rowStart.insert(loaded->rowStart.end(), chunk.offsets.begin(),
+                                    chunk.offsets.end());
+            chunk = ParsedRows();
+        }
+        loaded->index.build(ids);
+        hasVoted.resize(loaded->rowStart.size()); // Initialize as not voted
+        fileRows = loaded->rowStart.size();
+        delete current.exchange(loaded.release());
+
+        if (rejected > 0) {
+            std::cerr << "Skipped " << rejected << " registry rows without a valid voter ID"
+                      << std::endl;
+        }
+        std::size_t duplicates = ids.size() - current.load()->index.size();
+        if (duplicates > 0) {
+            std::cerr << "Warning: " << duplicates << " registry rows repeat an earlier voter ID;"
+                      << " the last row for each ID is used" << std::endl;
+        }
+        std::cout << "Voter registry loaded successfully from " << filePath << std::endl;
+    }
+
+    // Applies a registry delta: CSV rows of an action followed by a
+    // registry row,
+    //   add,<VoterID>,<FirstName>,<LastName>,...   register a new voter
+    //   update,<VoterID>,<FirstName>,...           replace a voter's details
+    //   remove,<VoterID>                           unregister a voter
+    // with an optional header line. Rows that do not fit the current
+    // registry are counted as rejected and skipped. A voter removed and
+    // added again keeps their voted flag. With a log attached, the delta
+    // is logged before it takes effect so a replay re-applies it ahead of
+    // the votes that depend on it. Runs alongside lookups and claims,
+    // which switch to the new registry once it is complete.
+    RegistryDeltaCounts applyDelta(std::string_view csv) {
+        return applyDeltaAt(csv, true, LogPosition());
+    }
+
+    // Number of deltas applied since the registry file was loaded
+    uint64_t deltasApplied() const {
+        return deltaCount.load();
+    }
+
+    // Re-applies a RegistryDeltaRecord while replaying the chain log, or a
+    // delta held by a checkpoint; logEnd is the position just past the
+    // record, zeroes for a checkpoint's
+    bool restoreDelta(const uint8_t* payload, std::size_t size,
+                      const LogPosition& logEnd = LogPosition()) {
+        applyDeltaAt(std::string_view(reinterpret_cast<const char*>(payload), size), false, logEnd);
+        return true;
+    }
+
+    // Looks up a registered voter's details
+    bool findVoter(const std::string& id, Voter& voter) const {
+        EpochGuard guard(*this);
+        uint64_t numericID;
+        uint32_t row = findRow(*guard.generation, id, numericID);
+        if (row == VoterIndex::npos) {
+            return false;
+        }
+        std::string_view text = rowText(*guard.generation, row);
+        std::string_view fields[3];
+        splitRow(text.data(), text.data() + text.size(), fields, 3);
+        voter = Voter(fields[0], fields[1], fields[2]);
+        return true;
+    }
+
+    // Outcome of a vote submission
+    enum VoteStatus { Accepted, NotRegistered, AlreadyVoted, InvalidChoice };
+
+    // Checks that a voter is registered and has not voted yet, without
+    // marking them: Accepted, NotRegistered or AlreadyVoted
+    VoteStatus checkVoter(std::string_view id) const {
+        EpochGuard guard(*this);
+        uint64_t numericID;
+        uint32_t row = findRow(*guard.generation, id, numericID);
+        if (row == VoterIndex::npos) {
+            return NotRegistered;
+        }
+        return hasVoted.test(row) ? AlreadyVoted : Accepted;
+    }
+
+    // Verify if a voter is registered and hasn't voted yet
+    bool verifyVoter(const std::string& id) {
+        VoteStatus status = checkVoter(id);
+        if (status == NotRegistered) {
+            std::cout << "Voter ID not found." << std::endl;
+            return false;
+        }
+        if (status == AlreadyVoted) {
+            std::cout << "Voter has already voted." << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Checks the voter and marks them as voted in one step. Safe to call
+    // from many threads: for each voter exactly one call returns Accepted.
+    // If claimedRow is given it receives the voter's registry row.
+    VoteStatus claimVote(std::string_view id, uint32_t* claimedRow = nullptr) {
+        EpochGuard guard(*this);
+        uint64_t numericID;
+        uint32_t row = findRow(*guard.generation, id, numericID);
+        if (row == VoterIndex::npos) {
+            return NotRegistered;
+        }
+        if (claimedRow != nullptr) {
+            *claimedRow = row;
+        }
+        if (!hasVoted.testAndSet(row)) {
+            return AlreadyVoted;
+        }
+        if (log != nullptr) {
+            log->append(VotedRecord, &numericID, sizeof(numericID));
+        }
+        return Accepted;
+    }
+
+    // Mark voter as having voted
+    void markAsVoted(const std::string& id) {
+        claimVote(id);
+    }
+
+    // Writes every voter marked, and every delta applied, from now on to
+    // the chain log
+    void attachLog(ChainLog& chainLog) {
+        log = &chainLog;
+    }
+
+    // Re-applies a VotedRecord while replaying the chain log. Voters never
+    // in the registry are ignored; removed voters keep the flag for when
+    // they are registered again.
+    bool restoreVoted(const uint8_t* payload, std::size_t size) {
+        uint64_t numericID;
+        if (size != sizeof(numericID)) {
+            return false;
+        }
+        std::memcpy(&numericID, payload, sizeof(numericID));
+        EpochGuard guard(*this);
+        uint32_t row = guard.generation->index.find(numericID);
+        if (row != VoterIndex::npos) {
+            hasVoted.testAndSet(row);
+        }
+        return true;
+    }
+
+    // Copies, for a checkpoint whose replay starts at upTo, the deltas
+    // logged before upTo and the voted flags of the rows the registry file
+    // and those deltas hold, one bit per row. The VotedRecord of every
+    // voter copied as voted has already been appended to the log. Returns
+    // the number of rows copied.
+    uint64_t snapshotVoted(const LogPosition& upTo, std::vector<std::string>& deltas,
+                           std::vector<uint64_t>& words) {
+        std::lock_guard<std::mutex> deltaGuard(deltaLock);
+        std::lock_guard<std::mutex> lock(snapshotLock);
+        uint64_t rows = fileRows;
+        deltas.clear();
+        for (const AppliedDelta& delta : applied) {
+            if (delta.logEnd.segment > upTo.segment ||
+                (delta.logEnd.segment == upTo.segment && delta.logEnd.offset > upTo.offset)) {
+                break;  // logged after upTo, so replayed from the log
+            }
+            deltas.push_back(*delta.bytes);
+            rows = delta.rows;
+        }
+        hasVoted.copyWords(words, rows);
+        // Wait out the claims that may have set a copied bit but not logged it
+        uint64_t epoch = claimEpoch.fetch_add(1);
+        while (claimsInFlight[epoch & 1].load() != 0) {
+            std::this_thread::yield();
+        }
+        return rows;
+    }
+
+    // Marks every voter flagged in a checkpoint's voted words, once the
+    // checkpoint's deltas are restored; false if the checkpoint was taken
+    // against a different registry
+    bool restoreVoted(const uint64_t* words, uint64_t voterCount, uint64_t registryBytes) {
+        if (voterCount != this->voterCount() || registryBytes != registryFile.size()) {
+            return false;
+        }
+        hasVoted.mergeWords(words);
+        return true;
+    }
+
+    // A field of a registry row by column (0 is the voter ID); empty if the
+    // row is shorter or the voter was removed
+    std::string_view field(uint32_t row, int column) const {
+        std::string_view fields[kMaxColumns];
+        EpochGuard guard(*this);
+        if (column < 0 || column >= kMaxColumns || guard.generation->rowStart[row] == kRemovedRow) {
+            return std::string_view();
+        }
+        std::string_view text = rowText(*guard.generation, row);
+        splitRow(text.data(), text.data() + text.size(), fields, column + 1);
+        return fields[column];
+    }
+
+    // Registry rows, including removed voters, and the size of the file
+    // loaded at startup; a checkpoint records both to recognise its registry
+    std::size_t voterCount() const {
+        EpochGuard guard(*this);
+        return guard.generation->rowStart.size();
+    }
+
+    std::size_t registryBytes() const {
+        return registryFile.size();
+    }
+
+    // Rows loaded from the registry file, before any delta
+    std::size_t fileVoterCount() const {
+        return fileRows;
+    }
+
+    // Approximate bytes held per registered voter, excluding the mapped file
+    double bytesPerVoter() const {
+        EpochGuard guard(*this);
+        const Generation& generation = *guard.generation;
+        if (generation.rowStart.empty()) {
+            return 0;
+        }
+        std::size_t bytes = generation.index.bytes() + hasVoted.bytes() +
+                            generation.rowStart.capacity() * sizeof(uint64_t);
+        return double(bytes) / generation.rowStart.size();
+    }
+};
+
+#endif  // VOTER_REGISTRY_H